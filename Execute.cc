@@ -25,6 +25,7 @@ inline void set_note(request_rec *r, int num, result_buffer &res) {
   char note[32];
   sprintf(note, "ndb_result_%d",num);
   log_debug(r->server,"Setting note %s",note);
+  res.flatten();
   ap_table_set(r->main->notes, note, res.buff);
 }
 
@@ -46,7 +47,13 @@ bool handle_exec_error(request_rec *r, int &response_code,
   bool stale_dictionary = 0;
   
   // client errors
-  if(error.classification == NdbError::NoDataFound)
+  if(error.code == PRECONDITION_FAILED_ERROR)   // conditional update
+    response_code = 412;
+  else if(error.code == GUARD_FAILED_ERROR) {   // "@+N,max=M" etc.
+    response_code = 409;
+    error_message = "Value out of range.\n";
+  }
+  else if(error.classification == NdbError::NoDataFound)
     response_code = 404;
   else if(error.classification == NdbError::ConstraintViolation)
     response_code = 409;
@@ -80,6 +87,58 @@ bool handle_exec_error(request_rec *r, int &response_code,
 }
 
 
+/* Callback for asynchronous execution: count down pending transactions.
+*/
+void tx_complete(int result, NdbTransaction *tx, void *v) {
+  (* (int *) v)--;
+}
+
+
+/* execute_async():
+   Commit the main transaction and all of the independent read groups
+   together, using the asynchronous API, and poll until all are complete.
+   On a retry, only the transactions that failed with a temporary error 
+   are sent again.  Returns the first error, or else the main transaction's
+   (successful) NdbError.
+   A pushed-down join (NdbQuery) cannot be executed with the asynchronous
+   API, so a main transaction that holds one is executed afterwards. 
+*/
+const NdbError *execute_async(ndb_instance *i, bool retry) {
+  NdbTransaction *tx;
+  int pending = 0;
+  int n;
+  
+  for(n = -1 ; n < i->n_groups ; n++) {
+    tx = (n < 0) ? i->tx : i->groups[n].tx;
+    if(retry && tx->getNdbError().status != NdbError::TemporaryError) 
+      continue;
+    if(tx == i->tx && i->flag.has_join)
+      continue;
+    tx->executeAsynchPrepare(NdbTransaction::Commit, tx_complete, &pending,
+                             TX_ABORT_OPT);
+    pending++;
+  }
+
+  if(pending) {
+    i->db->sendPollNdb(3000, pending, i->conn->ndb_force_send);
+    while(pending > 0) 
+      i->db->pollNdb(3000, pending);
+  }
+  
+  if(i->flag.has_join && ! (retry && 
+     i->tx->getNdbError().status != NdbError::TemporaryError))
+    i->tx->execute(NdbTransaction::Commit, TX_ABORT_OPT, 
+                   i->conn->ndb_force_send);
+  
+  for(n = -1 ; n < i->n_groups ; n++) {
+    tx = (n < 0) ? i->tx : i->groups[n].tx;
+    if(tx->getNdbError().classification != NdbError::NoError) 
+      return & tx->getNdbError();
+  }
+  return & i->tx->getNdbError();
+}
+
+
 /******** Execute batched transactions *************/
 
 int ExecuteAll(request_rec *r, ndb_instance *i) {
@@ -87,8 +146,9 @@ int ExecuteAll(request_rec *r, ndb_instance *i) {
   int response_code = OK;
   int opn;     // operation number
   unsigned int retries = 0, total_wait_time = 0;
-  bool apache_notes = 0, must_restart = 0;
+  bool apache_notes = 0, must_restart = 0, streamed = 0;
   const char *error_message = 0;
+  const NdbError *tx_error = 0;
   result_buffer my_results;
   my_results.buff = 0;
   
@@ -115,12 +175,45 @@ int ExecuteAll(request_rec *r, ndb_instance *i) {
  
   /* Activate BLOB handles; call the callback functions */
   i->tx->executePendingBlobOps();
+  for(opn = 0 ; opn < i->n_groups ; opn++) 
+    i->groups[opn].tx->executePendingBlobOps();
       
-  /* Execute and Commit the transaction */
+  /* Nested resources ("?expand="): read the parent rows first, then add
+     the reads of their children to the same transaction, which is 
+     committed below.  This costs one more round trip, but only one. */
+  if(i->flag.has_expand) {
+    i->tx->execute(NdbTransaction::NoCommit, TX_ABORT_OPT, 
+                   i->conn->ndb_force_send);
+    tx_error = & i->tx->getNdbError();
+    if(tx_error->status == NdbError::TemporaryError) {
+      response_code = 503;
+      i->stats.temp_errors++;
+      goto cleanup1;
+    }
+    if(tx_error->classification != NdbError::NoError) {
+      must_restart = handle_exec_error(r, response_code, error_message, 
+                                       *tx_error);
+      goto cleanup1;
+    }
+    response_code = expand_all(r, i);
+    if(response_code != OK) {
+      if(! i->tx) goto cleanup2;
+      goto cleanup1;
+    }
+    i->tx->executePendingBlobOps();
+  }
+
+  /* Execute and Commit the transaction 
+     (or, in a batch, all of the transactions in parallel) */
   exec_commit:
-  i->tx->execute(NdbTransaction::Commit, TX_ABORT_OPT, i->conn->ndb_force_send); 
+  if(i->n_groups || i->server_config->async_execute) 
+    tx_error = execute_async(i, retries > 0);
+  else {
+    i->tx->execute(NdbTransaction::Commit, TX_ABORT_OPT, i->conn->ndb_force_send); 
+    tx_error = & i->tx->getNdbError();
+  }
 
-  if(i->tx->getNdbError().status == NdbError::TemporaryError) {
+  if(tx_error->status == NdbError::TemporaryError) {
     register unsigned int sleep_ms = 5 + ( 2 * retries * retries);
     if(total_wait_time + sleep_ms < i->server_config->max_retry_ms) {
       milliSleep(sleep_ms);  
@@ -138,41 +231,54 @@ int ExecuteAll(request_rec *r, ndb_instance *i) {
     goto cleanup1;
   }
 
-  if(i->tx->getNdbError().classification != NdbError::NoError) {
+  if(tx_error->classification != NdbError::NoError) {
     must_restart = handle_exec_error(r, response_code, error_message, 
-                                     i->tx->getNdbError());
+                                     *tx_error);
     goto cleanup1;
   }
   
   /* Loop over the operations and build the result page */
   for(opn = 0 ; opn < i->n_read_ops ; opn++) {
     struct data_operation *data = i->data + opn ;
+    if(data->relation) continue;   /* nested in its parent's result */
+    if(data->expiry && row_has_expired(data->expiry, time(0))) {
+      response_code = 404;   /* expired, but not yet deleted by the reaper */
+      break;
+    }
     if(data->result_cols && data->fmt) {
       if(i->flag.jsonrequest && (! data->fmt->flag.is_JSON))
         response_code = 406;  // "406 NOT ACCEPTABLE"
       else response_code = build_results(r, data, my_results);
       if(apache_notes) set_note(r, opn, my_results);
+      /* An Arrow scan has already been sent, a batch at a time */
+      if(data->flag.stream_rows && response_code == OK) streamed = 1;
     }
   }
   
-  if(response_code == OK && (! apache_notes)) {
+  if(response_code == OK && (! apache_notes) && (! streamed)) {
     // Set content-length
     if(my_results.buff)
-      ap_set_content_length(r, my_results.sz);
+      ap_set_content_length(r, my_results.length());
     else {
       ap_set_content_length(r, 0);
       response_code = 204;  // No content
     }
       
     // Set ETag
+    char *etag = 0;
     if(i->flag.use_etag && my_results.buff) {
-      char *etag = ap_md5_binary(r->pool, (const unsigned char *) 
-                                 my_results.buff, my_results.sz);
+      etag = my_results.md5(r->pool);
       ap_table_setn(r->headers_out, "ETag",  etag);
-      // If the ETag matches the client's cache, the page should not be returned 
-      response_code = ap_meets_conditions(r);
     }
 
+    // Share the result with any single-flight followers
+    if(i->flight) 
+      single_flight_land(i, response_code, & my_results, etag);
+
+    // If the ETag matches the client's cache, the page should not be returned 
+    if(etag) 
+      response_code = ap_meets_conditions(r);
+
     // Special handling for JSONRequest 
     if(i->flag.jsonrequest) {
       r->content_type = "application/jsonrequest";  // Set content-type
@@ -189,21 +295,27 @@ int ExecuteAll(request_rec *r, ndb_instance *i) {
     if(response_code == OK) {
       ap_send_http_header(r);
       if(my_results.buff)
-        ap_rwrite(my_results.buff, my_results.sz, r);
+        my_results.send(r);
     }
   }
 
  // todo: must_restart && ! (force_restart) --> log a message?
   cleanup1:
   if(must_restart && i->server_config->force_restart) {
-    response_code = ndb_handle_error(r, 503, & i->tx->getNdbError(), "10");
+    response_code = ndb_handle_error(r, 503, tx_error, "10");
     module_must_restart();
   }
-  else if(response_code > 399) 
+  else if(response_code > 399) {
+    if(response_code == 404 && i->flight)
+      single_flight_land(i, 404, 0, 0);
     response_code = ndb_handle_error(r, response_code, 
-                                     & i->tx->getNdbError(), error_message); 
+                                     tx_error, error_message); 
+  }
   i->tx->close();
   i->tx = 0;  
+  i->close_tx_groups();
+  if(must_restart)    /* the joins were built from a stale dictionary */
+    release_join_defs(i);
   
   cleanup2:
   log_debug(r->server, "Returning %d%s", response_code,
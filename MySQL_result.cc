@@ -23,10 +23,14 @@
 */
 
 #include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "my_global.h"
 #include "mysql.h"
 #include "mysql_time.h"
 #include "NdbApi.hpp"
+#include "ndb_api_compat.h"
 #include "httpd.h"
 #include "http_config.h"
 #include "mod_ndb_compat.h"
@@ -36,6 +40,7 @@
 
 #include "MySQL_value.h"
 #include "MySQL_result.h"
+#include "binary_format.h"
 
 /*  BlobHook() is a callback function; we register it with the NDB API 
     in the MySQL::result constructor.  It is called from the API when 
@@ -48,33 +53,57 @@ int BlobHook(NdbBlob *blob, void *v) {
 
 
 namespace {  // i.e. "static"
-  inline void factor_HHMMSS(MYSQL_TIME *tm, int int_time) {
-    if(int_time < 0) {
-      tm->neg = true; int_time = - int_time;
+  /* MySQL's binary DECIMAL packs nine decimal digits into each 4-byte 
+     word, and a partial group of n digits into dig2bytes[n] bytes */
+  const int DIG_PER_DEC = 9;
+  const int dig2bytes[DIG_PER_DEC + 1] = { 0, 1, 1, 2, 2, 3, 3, 4, 4, 4 };
+
+  /* Strings are escaped a block at a time, so that the worst-case 
+     reservation for a long TEXT value stays small */
+  const size_t ESCAPE_BLOCK = 4096;
+
+  /* next_escape(): find the next character that has an escape sequence.
+     With SSE2, sixteen characters are tested at once against every 
+     character that any of the tables in initialize_escapes() escapes: 
+     the control characters, the quote, backslash, <, >, and &.  This can 
+     find a character that the current table leaves alone, so the caller
+     must still look it up.
+  */
+  inline const unsigned char *next_escape(const unsigned char *s, 
+                                          const unsigned char *end,
+                                          const char **escapes) {
+#ifdef __SSE2__
+    const __m128i ctrl  = _mm_set1_epi8(0x1F);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bksl  = _mm_set1_epi8('\\');
+    const __m128i lt    = _mm_set1_epi8('<');
+    const __m128i gt    = _mm_set1_epi8('>');
+    const __m128i amp   = _mm_set1_epi8('&');
+
+    for( ; end - s >= 16 ; s += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i *) s);
+      __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(x, ctrl), ctrl);  /* x <= 0x1F */
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(x, quote));
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(x, bksl));
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(x, lt));
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(x, gt));
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(x, amp));
+      int bits = _mm_movemask_epi8(m);
+      if(bits) return s + __builtin_ctz(bits);
     }
-    tm->hour = int_time/10000;
-    tm->minute  = int_time/100 % 100;
-    tm->second  = int_time % 100;  
+#endif
+    while(s < end && ! escapes[*s]) s++;
+    return s;
   }
 
-  inline void factor_YYYYMMDD(MYSQL_TIME *tm, int int_date) {
-    tm->year = int_date/10000 % 10000;
-    tm->month  = int_date/100 % 100;
-    tm->day = int_date % 100;  
+  /* Read a big-endian group of n bytes */
+  inline unsigned int decimal_group(const unsigned char *&p, int n) {
+    unsigned int x = 0;
+    while(n--) x = (x << 8) | *p++;
+    return x;
   }
 }
 
-/* result_buffer::out(decimal_t *) is defined here
-   because this file includes the full set of MySQL headers
-*/
-
-void result_buffer::out(decimal_t *decimal) {
-  int to_len = decimal_string_size(decimal);
-  this->prepare(to_len);
-  decimal2string(decimal, buff + sz, &to_len, 0, 0, 0);
-  sz += to_len; // to_len has been reset to the length actually written 
-}
-
 
 namespace MySQL {
 
@@ -82,31 +111,53 @@ namespace MySQL {
      the rest of the source does not need to include a 
      full set of MySQL header files
   */
-  void field_to_tm(MYSQL_TIME *, const NdbRecAttr &);
+  void Date(result_buffer &, const NdbRecAttr &);
+  void Time(result_buffer &, const NdbRecAttr &);
+  void Datetime(result_buffer &, const NdbRecAttr &);
   void Decimal(result_buffer &, const NdbRecAttr &);
   void String(result_buffer &, const NdbRecAttr &,
               enum ndb_string_packing, const char **);   
+  char *string_ref(const NdbRecAttr &, enum ndb_string_packing, unsigned &);
   void escape_string(char *, unsigned, result_buffer &, const char **);
   
   
   /* Implementation of class MySQL::result */
   
-  result::result(NdbOperation *op, const NdbDictionary::Column *col) : 
-        contents(0) , blob(0) , _RecAttr(0) , _col(col)  
-  {    
-    type = col->getType();
+  /* fetch() works with either an NdbOperation or an NdbQueryOperation.
+     The buffer for a blob comes from the thread's block_pool. */
+  template <class OP> void result::fetch(OP *op, block_pool *pool) {
+    type = _col->getType();
+    encode = choose_encoder(type);
     
     if((type == NdbDictionary::Column::Blob) || 
        (type == NdbDictionary::Column::Text)) { 
       
-      blob = op->getBlobHandle(col->getColumnNo()); 
+      blob = op->getBlobHandle(_col->getColumnNo()); 
       blob->setActiveHook(BlobHook, (void *) this);
       contents = new result_buffer();
-      contents->init(0, 8192);
+      contents->init(0, 8192, pool);
     }
     else
-      _RecAttr = op->getValue(col, 0);
+      _RecAttr = op->getValue(_col, 0);
   }
+
+
+  result::result(NdbOperation *op, const NdbDictionary::Column *col,
+                 block_pool *pool) : 
+        contents(0) , inflate(false) , blob(0) , _RecAttr(0) , _col(col)  
+  {    
+    fetch(op, pool);
+  }
+
+#ifdef HAVE_NDB_SPJ
+  /* A column from one table of a pushed-down join */
+  result::result(NdbQueryOperation *op, const NdbDictionary::Column *col,
+                 block_pool *pool) : 
+        contents(0) , inflate(false) , blob(0) , _RecAttr(0) , _col(col)  
+  {    
+    fetch(op, pool);
+  }
+#endif
   
   result::~result() {
     COV_point("destructor");
@@ -118,6 +169,7 @@ namespace MySQL {
     COV_point("activateBlob");
     if(isNull()) return 0;
     contents->read_blob(blob);  
+    if(inflate && ! contents->inflate()) return -1;   /* "Compress" */
     return 0;
   }
   
@@ -131,164 +183,529 @@ namespace MySQL {
   }
   
   
-  void result::out(result_buffer &rbuf, const char **escapes) {
-    MYSQL_TIME tm;
-    NdbRecAttr &rec = *_RecAttr;
-    
-    switch(type) {
-        
+  /* The encoders.  Each one is a friend of class result. */
+  struct encoders {
+    static void Int(result &r, result_buffer &rbuf, const char **) {
+      COV_point("int");
+      rbuf.out_int(r._RecAttr->int32_value()); 
+    }
+    static void Unsigned(result &r, result_buffer &rbuf, const char **) {
+      COV_point("unsigned");
+      rbuf.out_uint(r._RecAttr->u_32_value());
+    }
+    static void Varchar(result &r, result_buffer &rbuf, const char **escapes) {
+      COV_point("varchar");
+      MySQL::String(rbuf, *r._RecAttr, char_var, escapes);
+    }
+    static void Char(result &r, result_buffer &rbuf, const char **escapes) {
+      COV_point("char");
+      MySQL::String(rbuf, *r._RecAttr, char_fixed, escapes);
+    }
+    static void Longvarchar(result &r, result_buffer &rbuf, const char **escapes) {
+      COV_point("longvarchar");
+      MySQL::String(rbuf, *r._RecAttr, char_longvar, escapes);
+    }
+    static void Float(result &r, result_buffer &rbuf, const char **) {
+      COV_point("float");
+      rbuf.out_float(r._RecAttr->float_value());
+    }
+    static void Double(result &r, result_buffer &rbuf, const char **) {
+      COV_point("double");
+      rbuf.out_double(r._RecAttr->double_value());
+    }
+    static void Date(result &r, result_buffer &rbuf, const char **) {
+      COV_point("date");
+      MySQL::Date(rbuf, *r._RecAttr);
+    }
+    static void Time(result &r, result_buffer &rbuf, const char **) {
+      COV_point("time");
+      MySQL::Time(rbuf, *r._RecAttr);
+    }
+    static void Bigunsigned(result &r, result_buffer &rbuf, const char **) {
+      COV_point("bigunsigned");
+      rbuf.out_uint(r._RecAttr->u_64_value()); 
+    }
+    static void Bit(result &r, result_buffer &rbuf, const char **) {
+      COV_point("bit");
+      rbuf.out_uint(ndbapi_bit_flip(r._RecAttr->u_64_value()));
+    }
+    static void Smallunsigned(result &r, result_buffer &rbuf, const char **) {
+      COV_point("smallunsigned");
+      rbuf.out_uint(r._RecAttr->u_short_value());
+    }
+    static void Tinyunsigned(result &r, result_buffer &rbuf, const char **) {
+      COV_point("tinyunsigned");
+      rbuf.out_uint(r._RecAttr->u_char_value());
+    }
+    static void Bigint(result &r, result_buffer &rbuf, const char **) {
+      COV_point("bigint");
+      rbuf.out_int(r._RecAttr->int64_value());
+    }
+    static void Smallint(result &r, result_buffer &rbuf, const char **) {
+      COV_point("smallint");
+      rbuf.out_int(r._RecAttr->short_value());
+    }
+    static void Tinyint(result &r, result_buffer &rbuf, const char **) {
+      COV_point("tinyint");
+      rbuf.out_int(r._RecAttr->char_value());
+    }
+    static void Mediumint(result &r, result_buffer &rbuf, const char **) {
+      COV_point("mediumint");
+      rbuf.out_int(r._RecAttr->medium_value());
+    }
+    static void Mediumunsigned(result &r, result_buffer &rbuf, const char **) {
+      COV_point("mediumunsigned");
+      rbuf.out_uint(r._RecAttr->u_medium_value());
+    }
+    static void Year(result &r, result_buffer &rbuf, const char **) {
+      COV_point("year");
+      if(rbuf.prepare(4)) rbuf.put_digits(1900 + r._RecAttr->u_char_value(), 4);
+    }
+    static void Datetime(result &r, result_buffer &rbuf, const char **) {
+      COV_point("datetime");
+      MySQL::Datetime(rbuf, *r._RecAttr);
+    }
+    static void Decimal(result &r, result_buffer &rbuf, const char **) {
+      COV_point("decimal");
+      MySQL::Decimal(rbuf, *r._RecAttr);
+    }
+    static void Text(result &r, result_buffer &rbuf, const char **escapes) {
+      COV_point("text");
+      if(escapes) 
+        escape_string(r.contents->buff, r.contents->sz, rbuf, escapes);
+      else
+        rbuf.out(r.contents->sz, r.contents->buff);
+    }
+    static void Blob(result &r, result_buffer &rbuf, const char **escapes) {
+      COV_point("blob");
+      if(escapes) rbuf.out("++ CANNOT ESCAPE BLOB ++");
+      else rbuf.out(r.contents->sz, r.contents->buff);
+    }
+    static void Unsupported(result &, result_buffer &, const char **) {
+      COV_point("bad data type");
+    }
+  };
+
+
+  encoder result::choose_encoder(NdbDictionary::Column::Type col_type) {
+    switch(col_type) {
       case NdbDictionary::Column::Int:
-        COV_point("int");
-        return rbuf.out("%d", (int)  rec.int32_value()); 
-        
+        return encoders::Int;
       case NdbDictionary::Column::Unsigned:
       case NdbDictionary::Column::Timestamp:
-        COV_point("unsigned");
-        return rbuf.out("%u", (unsigned int) rec.u_32_value());
-        
+        return encoders::Unsigned;
       case NdbDictionary::Column::Varchar:
       case NdbDictionary::Column::Varbinary:
-        COV_point("varchar");
-        return MySQL::String(rbuf, rec, char_var, escapes);
-        
+        return encoders::Varchar;
       case NdbDictionary::Column::Char:
       case NdbDictionary::Column::Binary:
-        COV_point("char");
-        return MySQL::String(rbuf, rec, char_fixed, escapes);
-        
+        return encoders::Char;
       case NdbDictionary::Column::Longvarchar:
       case NdbDictionary::Column::Longvarbinary:
-        COV_point("longvarchar");
-        return MySQL::String(rbuf, rec, char_longvar, escapes);
-        
+        return encoders::Longvarchar;
       case NdbDictionary::Column::Float:
-        COV_point("float");
-        return rbuf.out("%G", (double) rec.float_value());
-        
+        return encoders::Float;
       case NdbDictionary::Column::Double:
-        COV_point("double");
-        return rbuf.out("%G", (double) rec.double_value());
-        
+        return encoders::Double;
       case NdbDictionary::Column::Date:
-        COV_point("date");
-        field_to_tm(&tm, rec);
-        return rbuf.out("%04d-%02d-%02d",tm.year, tm.month, tm.day);
-        
+        return encoders::Date;
       case NdbDictionary::Column::Time:
-        COV_point("time");
-        field_to_tm(&tm, rec);
-        return rbuf.out("%s%02d:%02d:%02d", tm.neg ? "-" : "" ,
-                        tm.hour, tm.minute, tm.second);
-        
+        return encoders::Time;
       case NdbDictionary::Column::Bigunsigned:
-        COV_point("bigunsigned");
-        return rbuf.out("%llu", rec.u_64_value()); 
- 
+        return encoders::Bigunsigned;
       case NdbDictionary::Column::Bit:
-        COV_point("bit");
-        return rbuf.out("%llu",ndbapi_bit_flip(rec.u_64_value()));
-        
+        return encoders::Bit;
       case NdbDictionary::Column::Smallunsigned:
-        COV_point("smallunsigned");
-        return rbuf.out("%hu", (short) rec.u_short_value());
-        
+        return encoders::Smallunsigned;
       case NdbDictionary::Column::Tinyunsigned:
-        COV_point("tinyunsigned");
-        return rbuf.out("%u", (int) rec.u_char_value());
-        
+        return encoders::Tinyunsigned;
       case NdbDictionary::Column::Bigint:
-        COV_point("bigint");
-        return rbuf.out("%lld", rec.int64_value());
-        
+        return encoders::Bigint;
       case NdbDictionary::Column::Smallint:
-        COV_point("smallint");
-        return rbuf.out("%hd", (short) rec.short_value());
-        
+        return encoders::Smallint;
       case NdbDictionary::Column::Tinyint:
-        COV_point("tinyint");
-        return rbuf.out("%d", (int) rec.char_value());
-        
+        return encoders::Tinyint;
       case NdbDictionary::Column::Mediumint:
-        COV_point("mediumint");
-        return rbuf.out("%d", rec.medium_value());
-        
+        return encoders::Mediumint;
       case NdbDictionary::Column::Mediumunsigned:
-        COV_point("mediumunsigned");
-        return rbuf.out("%d", rec.u_medium_value());
-        
+        return encoders::Mediumunsigned;
       case NdbDictionary::Column::Year:
-        COV_point("year");
-        return rbuf.out("%04d", 1900 + rec.u_char_value());
-        
+        return encoders::Year;
       case NdbDictionary::Column::Datetime:
-        COV_point("datetime");
-        field_to_tm(&tm, rec);
-        return rbuf.out("%04d-%02d-%02d %02d:%02d:%02d", tm.year, tm.month, 
-                        tm.day, tm.hour, tm.minute, tm.second);
-        
+        return encoders::Datetime;
       case NdbDictionary::Column::Decimal:
       case NdbDictionary::Column::Decimalunsigned:
-        COV_point("decimal");
-        return MySQL::Decimal(rbuf,rec);
-        
+        return encoders::Decimal;
       case NdbDictionary::Column::Text:
-        COV_point("text");
-        if(escapes) 
-          escape_string(contents->buff, contents->sz, rbuf, escapes);
-        else
-          rbuf.out(contents->sz, contents->buff);
-        return;
-        
+        return encoders::Text;
       case NdbDictionary::Column::Blob:
-        COV_point("blob");
-        if(escapes) rbuf.out("++ CANNOT ESCAPE BLOB ++");
-        else rbuf.out(contents->sz, contents->buff);
-        return;
-        
+        return encoders::Blob;
       case NdbDictionary::Column::Olddecimal:
       case NdbDictionary::Column::Olddecimalunsigned:
       default:
-        COV_point("bad data type");
-        return;        
+        return encoders::Unsupported;
+    }
+  }
+
+
+  /* The packers write typed values for a binary format: integers as 
+     integers, floats in IEEE format, and character strings and blobs 
+     with a length and no escaping.  Dates, times, and decimals are 
+     written as strings, in the same text as the encoders write.  
+  */
+  template <class S> struct packers {
+    static void Int(result &r, result_buffer &rbuf, const char **) {
+      put_int<S>(rbuf, r._RecAttr->int32_value());
+    }
+    static void Unsigned(result &r, result_buffer &rbuf, const char **) {
+      put_uint<S>(rbuf, r._RecAttr->u_32_value());
+    }
+    static void Bigint(result &r, result_buffer &rbuf, const char **) {
+      put_int<S>(rbuf, r._RecAttr->int64_value());
+    }
+    static void Bigunsigned(result &r, result_buffer &rbuf, const char **) {
+      put_uint<S>(rbuf, r._RecAttr->u_64_value());
+    }
+    static void Mediumint(result &r, result_buffer &rbuf, const char **) {
+      put_int<S>(rbuf, r._RecAttr->medium_value());
+    }
+    static void Mediumunsigned(result &r, result_buffer &rbuf, const char **) {
+      put_uint<S>(rbuf, r._RecAttr->u_medium_value());
+    }
+    static void Smallint(result &r, result_buffer &rbuf, const char **) {
+      put_int<S>(rbuf, r._RecAttr->short_value());
+    }
+    static void Smallunsigned(result &r, result_buffer &rbuf, const char **) {
+      put_uint<S>(rbuf, r._RecAttr->u_short_value());
+    }
+    static void Tinyint(result &r, result_buffer &rbuf, const char **) {
+      put_int<S>(rbuf, r._RecAttr->char_value());
+    }
+    static void Tinyunsigned(result &r, result_buffer &rbuf, const char **) {
+      put_uint<S>(rbuf, r._RecAttr->u_char_value());
+    }
+    static void Year(result &r, result_buffer &rbuf, const char **) {
+      put_uint<S>(rbuf, 1900 + r._RecAttr->u_char_value());
+    }
+    static void Bit(result &r, result_buffer &rbuf, const char **) {
+      put_uint<S>(rbuf, ndbapi_bit_flip(r._RecAttr->u_64_value()));
+    }
+    static void Float(result &r, result_buffer &rbuf, const char **) {
+      put_float<S>(rbuf, r._RecAttr->float_value());
+    }
+    static void Double(result &r, result_buffer &rbuf, const char **) {
+      put_double<S>(rbuf, r._RecAttr->double_value());
+    }
+    static void string(result &r, result_buffer &rbuf, 
+                       enum ndb_string_packing packing, bool binary) {
+      unsigned sz;
+      char *ref = string_ref(*r._RecAttr, packing, sz);
+      if(binary) put_bin<S>(rbuf, sz, ref);
+      else put_str<S>(rbuf, sz, ref);
+    }
+    static void Char(result &r, result_buffer &rbuf, const char **) {
+      string(r, rbuf, char_fixed, false);
+    }
+    static void Varchar(result &r, result_buffer &rbuf, const char **) {
+      string(r, rbuf, char_var, false);
+    }
+    static void Longvarchar(result &r, result_buffer &rbuf, const char **) {
+      string(r, rbuf, char_longvar, false);
+    }
+    static void Binary(result &r, result_buffer &rbuf, const char **) {
+      string(r, rbuf, char_fixed, true);
+    }
+    static void Varbinary(result &r, result_buffer &rbuf, const char **) {
+      string(r, rbuf, char_var, true);
+    }
+    static void Longvarbinary(result &r, result_buffer &rbuf, const char **) {
+      string(r, rbuf, char_longvar, true);
+    }
+    static void Text(result &r, result_buffer &rbuf, const char **) {
+      put_str<S>(rbuf, r.contents->sz, r.contents->buff);
+    }
+    static void Blob(result &r, result_buffer &rbuf, const char **) {
+      put_bin<S>(rbuf, r.contents->sz, r.contents->buff);
+    }
+    /* The text of these is never more than 255 bytes long */
+    static void text(result &r, result_buffer &rbuf,
+                     void (*write)(result_buffer &, const NdbRecAttr &)) {
+      unsigned char *header = open_str8<S>(rbuf);
+      size_t start = rbuf.length();
+      write(rbuf, *r._RecAttr);
+      if(header) header[1] = (unsigned char) (rbuf.length() - start);
+    }
+    static void Date(result &r, result_buffer &rbuf, const char **) {
+      text(r, rbuf, MySQL::Date);
+    }
+    static void Time(result &r, result_buffer &rbuf, const char **) {
+      text(r, rbuf, MySQL::Time);
+    }
+    static void Datetime(result &r, result_buffer &rbuf, const char **) {
+      text(r, rbuf, MySQL::Datetime);
+    }
+    static void Decimal(result &r, result_buffer &rbuf, const char **) {
+      text(r, rbuf, MySQL::Decimal);
+    }
+    static void Unsupported(result &, result_buffer &rbuf, const char **) {
+      put_nil<S>(rbuf);
+    }
+    
+    static encoder choose(NdbDictionary::Column::Type col_type) {
+      switch(col_type) {
+        case NdbDictionary::Column::Int:            return Int;
+        case NdbDictionary::Column::Unsigned:
+        case NdbDictionary::Column::Timestamp:      return Unsigned;
+        case NdbDictionary::Column::Bigint:         return Bigint;
+        case NdbDictionary::Column::Bigunsigned:    return Bigunsigned;
+        case NdbDictionary::Column::Mediumint:      return Mediumint;
+        case NdbDictionary::Column::Mediumunsigned: return Mediumunsigned;
+        case NdbDictionary::Column::Smallint:       return Smallint;
+        case NdbDictionary::Column::Smallunsigned:  return Smallunsigned;
+        case NdbDictionary::Column::Tinyint:        return Tinyint;
+        case NdbDictionary::Column::Tinyunsigned:   return Tinyunsigned;
+        case NdbDictionary::Column::Year:           return Year;
+        case NdbDictionary::Column::Bit:            return Bit;
+        case NdbDictionary::Column::Float:          return Float;
+        case NdbDictionary::Column::Double:         return Double;
+        case NdbDictionary::Column::Char:           return Char;
+        case NdbDictionary::Column::Varchar:        return Varchar;
+        case NdbDictionary::Column::Longvarchar:    return Longvarchar;
+        case NdbDictionary::Column::Binary:         return Binary;
+        case NdbDictionary::Column::Varbinary:      return Varbinary;
+        case NdbDictionary::Column::Longvarbinary:  return Longvarbinary;
+        case NdbDictionary::Column::Text:           return Text;
+        case NdbDictionary::Column::Blob:           return Blob;
+        case NdbDictionary::Column::Date:           return Date;
+        case NdbDictionary::Column::Time:           return Time;
+        case NdbDictionary::Column::Datetime:       return Datetime;
+        case NdbDictionary::Column::Decimal:
+        case NdbDictionary::Column::Decimalunsigned: return Decimal;
+        default:                                    return Unsupported;
+      }
+    }
+  };
+
+
+  encoder result::choose_packer(NdbDictionary::Column::Type col_type,
+                                binary_syntax_id syntax) {
+    switch(syntax) {
+      case syntax_msgpack:
+        return packers<MessagePack>::choose(col_type);
+      case syntax_cbor:
+        return packers<CBOR>::choose(col_type);
+      default:       /* Arrow uses appenders */
+        return 0;
+    }
+  }
+
+
+  /* The appenders.  A fixed-width value is copied from the NdbRecAttr 
+     when NDB stores it at its Arrow width; a medium int, a year, or a 
+     bit field is converted.  A string is added to the column's data, 
+     and then its end offset to the column's values.
+  */
+  struct appenders {
+    static void Copy(result &r, arrow_column &a) {
+      a.values.out(a.type.width, r._RecAttr->aRef());
+    }
+    static void Mediumint(result &r, arrow_column &a) {
+      Int32 v = r._RecAttr->medium_value();
+      a.values.out(4, (const char *) &v);
+    }
+    static void Mediumunsigned(result &r, arrow_column &a) {
+      Uint32 v = r._RecAttr->u_medium_value();
+      a.values.out(4, (const char *) &v);
+    }
+    static void Year(result &r, arrow_column &a) {
+      Uint16 v = 1900 + r._RecAttr->u_char_value();
+      a.values.out(2, (const char *) &v);
+    }
+    static void Bit(result &r, arrow_column &a) {
+      Uint64 v = ndbapi_bit_flip(r._RecAttr->u_64_value());
+      a.values.out(8, (const char *) &v);
+    }
+    static void end_string(arrow_column &a) {
+      Int32 end = (Int32) a.data.sz;
+      a.values.out(4, (const char *) &end);
+    }
+    static void string(result &r, arrow_column &a,
+                       enum ndb_string_packing packing) {
+      unsigned sz;
+      char *ref = string_ref(*r._RecAttr, packing, sz);
+      a.data.out(sz, ref);
+      end_string(a);
+    }
+    static void Char(result &r, arrow_column &a) {
+      string(r, a, char_fixed);
+    }
+    static void Varchar(result &r, arrow_column &a) {
+      string(r, a, char_var);
+    }
+    static void Longvarchar(result &r, arrow_column &a) {
+      string(r, a, char_longvar);
+    }
+    static void Blob(result &r, arrow_column &a) {   /* and Text */
+      a.data.out(r.contents->sz, r.contents->buff);
+      end_string(a);
+    }
+    static void Date(result &r, arrow_column &a) {
+      MySQL::Date(a.data, *r._RecAttr);
+      end_string(a);
+    }
+    static void Time(result &r, arrow_column &a) {
+      MySQL::Time(a.data, *r._RecAttr);
+      end_string(a);
+    }
+    static void Datetime(result &r, arrow_column &a) {
+      MySQL::Datetime(a.data, *r._RecAttr);
+      end_string(a);
+    }
+    static void Decimal(result &r, arrow_column &a) {
+      MySQL::Decimal(a.data, *r._RecAttr);
+      end_string(a);
+    }
+    static void Unsupported(result &, arrow_column &a) {
+      end_string(a);
+    }
+  };
+
+
+  inline appender arrow_int(arrow_type &t, int bits, bool is_signed, 
+                            appender append) {
+    t.id = arrow_Int;
+    t.bit_width = bits;
+    t.is_signed = is_signed;
+    t.width = bits / 8;
+    return append;
+  }
+
+  inline appender arrow_float(arrow_type &t, short precision, size_t width) {
+    t.id = arrow_FloatingPoint;
+    t.precision = precision;
+    t.width = width;
+    return appenders::Copy;
+  }
+
+  inline appender arrow_string(arrow_type &t, arrow_type_id id, 
+                               appender append) {
+    t.id = id;
+    t.width = 0;
+    return append;
+  }
+
+
+  /* choose_appender(): the Arrow type of a column, and its appender.
+     Dates, times, and decimals are strings, as in the other formats. */
+  appender result::choose_appender(NdbDictionary::Column::Type col_type,
+                                   arrow_type &t) {
+    switch(col_type) {
+      case NdbDictionary::Column::Int:
+        return arrow_int(t, 32, true, appenders::Copy);
+      case NdbDictionary::Column::Unsigned:
+      case NdbDictionary::Column::Timestamp:
+        return arrow_int(t, 32, false, appenders::Copy);
+      case NdbDictionary::Column::Bigint:
+        return arrow_int(t, 64, true, appenders::Copy);
+      case NdbDictionary::Column::Bigunsigned:
+        return arrow_int(t, 64, false, appenders::Copy);
+      case NdbDictionary::Column::Mediumint:
+        return arrow_int(t, 32, true, appenders::Mediumint);
+      case NdbDictionary::Column::Mediumunsigned:
+        return arrow_int(t, 32, false, appenders::Mediumunsigned);
+      case NdbDictionary::Column::Smallint:
+        return arrow_int(t, 16, true, appenders::Copy);
+      case NdbDictionary::Column::Smallunsigned:
+        return arrow_int(t, 16, false, appenders::Copy);
+      case NdbDictionary::Column::Tinyint:
+        return arrow_int(t, 8, true, appenders::Copy);
+      case NdbDictionary::Column::Tinyunsigned:
+        return arrow_int(t, 8, false, appenders::Copy);
+      case NdbDictionary::Column::Year:
+        return arrow_int(t, 16, false, appenders::Year);
+      case NdbDictionary::Column::Bit:
+        return arrow_int(t, 64, false, appenders::Bit);
+      case NdbDictionary::Column::Float:
+        return arrow_float(t, 1, 4);
+      case NdbDictionary::Column::Double:
+        return arrow_float(t, 2, 8);
+      case NdbDictionary::Column::Char:
+        return arrow_string(t, arrow_Utf8, appenders::Char);
+      case NdbDictionary::Column::Varchar:
+        return arrow_string(t, arrow_Utf8, appenders::Varchar);
+      case NdbDictionary::Column::Longvarchar:
+        return arrow_string(t, arrow_Utf8, appenders::Longvarchar);
+      case NdbDictionary::Column::Text:
+        return arrow_string(t, arrow_Utf8, appenders::Blob);
+      case NdbDictionary::Column::Binary:
+        return arrow_string(t, arrow_Binary, appenders::Char);
+      case NdbDictionary::Column::Varbinary:
+        return arrow_string(t, arrow_Binary, appenders::Varchar);
+      case NdbDictionary::Column::Longvarbinary:
+        return arrow_string(t, arrow_Binary, appenders::Longvarchar);
+      case NdbDictionary::Column::Blob:
+        return arrow_string(t, arrow_Binary, appenders::Blob);
+      case NdbDictionary::Column::Date:
+        return arrow_string(t, arrow_Utf8, appenders::Date);
+      case NdbDictionary::Column::Time:
+        return arrow_string(t, arrow_Utf8, appenders::Time);
+      case NdbDictionary::Column::Datetime:
+        return arrow_string(t, arrow_Utf8, appenders::Datetime);
+      case NdbDictionary::Column::Decimal:
+      case NdbDictionary::Column::Decimalunsigned:
+        return arrow_string(t, arrow_Utf8, appenders::Decimal);
+      default:
+        return arrow_string(t, arrow_Utf8, appenders::Unsupported);
     }
   }
     
   /* MySQL:: data type helper funtions */
   
+  /* escape_string(): copy the string from NDB into the result buffer, 
+     encoded according to the escapes, in a single pass.  Each block is 
+     given room for the worst case, where every character is escaped; 
+     runs of characters with no escapes are copied with memcpy().
+  */
   void escape_string(char *ref, unsigned sz, result_buffer &rbuf, 
                              const char **escapes) {
-    size_t escaped_size = 0;
-    
-    /* How long will the string be when it is escaped? */
-    for(unsigned int i = 0; i < sz ; i++) {
-      const char *esc = escapes[ref[i]];
-      if(esc) escaped_size += esc[0];
-      else escaped_size++;
-    }
+    const unsigned char *s = (const unsigned char *) ref;
+    const unsigned char *end = s + sz;
+    const unsigned char *block_end, *run;
+    const char *esc;
+    char *dst;
     
-    /* Prepare the buffer.  This returns false only after a malloc error. */
-    if(!rbuf.prepare(escaped_size)) return;
-    
-    /* Now copy the string from NDB into the result buffer,
-     encoded appropriately according to the escapes 
-     */
-    for(unsigned int i = 0; i < sz ; i++) {
-      const unsigned char c = ref[i];
-      const char *esc = escapes[c];
-      if(esc) {
-        for(char j = 1 ; j <= esc[0]; j++) 
-          rbuf.putc(esc[j]);
+    while(s < end) {
+      block_end = (size_t) (end - s) > ESCAPE_BLOCK ? s + ESCAPE_BLOCK : end;
+
+      /* Prepare the buffer.  This returns false only after a malloc error. */
+      if(! rbuf.prepare((block_end - s) * MAX_ESCAPE_LEN)) return;
+      dst = rbuf.buff + rbuf.sz;
+
+      while(s < block_end) {
+        run = s;
+        s = next_escape(s, block_end, escapes);
+        memcpy(dst, run, s - run);
+        dst += s - run;
+        if(s == block_end) break;
+        if((esc = escapes[*s])) {
+          memcpy(dst, esc + 1, esc[0]);
+          dst += esc[0];
+        }
+        else *dst++ = *s;
+        s++;
       }
-      else rbuf.putc(c);
+      rbuf.sz = dst - rbuf.buff;
     }
   }
 
     
-  void String(result_buffer &rbuf, const NdbRecAttr &rec,
-              enum ndb_string_packing packing, const char **escapes) {
-    unsigned sz = 0;
+  /* string_ref(): the bytes of a string value, after its length prefix
+     and without any null padding at the end */
+  char *string_ref(const NdbRecAttr &rec, enum ndb_string_packing packing,
+                   unsigned &sz) {
     char *ref = 0;
     
+    sz = 0;
     switch(packing) {
       case char_fixed:
         sz = rec.get_size_in_bytes();
@@ -311,6 +728,14 @@ namespace MySQL {
       if (ref[i] == 0) sz--;
       else break;
     }
+    return ref;
+  }
+
+
+  void String(result_buffer &rbuf, const NdbRecAttr &rec,
+              enum ndb_string_packing packing, const char **escapes) {
+    unsigned sz;
+    char *ref = string_ref(rec, packing, sz);
     
     if(escapes) 
       escape_string(ref, sz, rbuf, escapes);
@@ -319,43 +744,102 @@ namespace MySQL {
   }
 
 
-  void field_to_tm(MYSQL_TIME *tm, const NdbRecAttr &rec) {
-    int int_date = -1, int_time = -99;
-    unsigned long long datetime;
-    
-    bzero (tm, sizeof(MYSQL_TIME));
-    switch(rec.getType()) {
-      case NdbDictionary::Column::Datetime :
-        datetime = rec.u_64_value();
-        int_date = datetime / 1000000;
-        int_time = datetime - (unsigned long long) int_date * 1000000;
-        break;
-      case NdbDictionary::Column::Time :
-        int_time = rec.medium_value();
-        break;
-      case NdbDictionary::Column::Date :
-        int_date = rec.u_medium_value();
-        tm->day = (int_date & 31);      // five bits
-        tm->month  = (int_date >> 5 & 15); // four bits
-        tm->year = (int_date >> 9);
-        return;
-      default:
-        assert(0);
+  /* Dates, times, and datetimes are written a field at a time from their
+     NDB encodings, with the fixed widths of MySQL's own formats.
+  */
+  void Date(result_buffer &rbuf, const NdbRecAttr &rec) {
+    unsigned int d = rec.u_medium_value();    // YYYY...YMMMMDDDDD
+
+    if(! rbuf.prepare(12)) return;
+    rbuf.put_digits(d >> 9, 4);
+    rbuf.putc('-');
+    rbuf.put_digits(d >> 5 & 15, 2);
+    rbuf.putc('-');
+    rbuf.put_digits(d & 31, 2);
+  }
+
+
+  void Time(result_buffer &rbuf, const NdbRecAttr &rec) {
+    int t = rec.medium_value();               // [-]HHHMMSS
+
+    if(! rbuf.prepare(12)) return;
+    if(t < 0) {
+      rbuf.putc('-');
+      t = -t;
     }
-    if(int_time != -99)factor_HHMMSS(tm, int_time);
-    if(int_date != -1) factor_YYYYMMDD(tm, int_date);
+    rbuf.put_digits(t / 10000, 2);
+    rbuf.putc(':');
+    rbuf.put_digits(t / 100 % 100, 2);
+    rbuf.putc(':');
+    rbuf.put_digits(t % 100, 2);
+  }
+
+
+  void Datetime(result_buffer &rbuf, const NdbRecAttr &rec) {
+    unsigned long long dt = rec.u_64_value(); // YYYYMMDDHHMMSS
+    unsigned int date = (unsigned int) (dt / 1000000);
+    unsigned int time = (unsigned int) (dt % 1000000);
+
+    if(! rbuf.prepare(20)) return;
+    rbuf.put_digits(date / 10000 % 10000, 4);
+    rbuf.putc('-');
+    rbuf.put_digits(date / 100 % 100, 2);
+    rbuf.putc('-');
+    rbuf.put_digits(date % 100, 2);
+    rbuf.putc(' ');
+    rbuf.put_digits(time / 10000, 2);
+    rbuf.putc(':');
+    rbuf.put_digits(time / 100 % 100, 2);
+    rbuf.putc(':');
+    rbuf.put_digits(time % 100, 2);
   }
 
 
+  /* Decimal() reads the binary format written by decimal2bin() directly,
+     a group of digits at a time, and writes the string that 
+     decimal2string() would: no leading zeros in the integer part (but at
+     least one digit), and exactly "scale" digits after the point.
+     The high bit of the first byte is the sign, inverted, and every byte 
+     of a negative number is inverted.
+  */
   void Decimal(result_buffer &rbuf, const NdbRecAttr &rec) {
-    decimal_digit_t digits[DECIMAL_BUFF]; // (an array of ints, not base-10 digits)
-    decimal_t dec = { 0, 0, DECIMAL_BUFF, 0, digits };
-    
     int prec  = rec.getColumn()->getPrecision();
     int scale = rec.getColumn()->getScale();  
-    bin2decimal(rec.aRef(), &dec, prec, scale);
-    rbuf.out(&dec);
-    return;
+    int intg = prec - scale;
+    int intg0 = intg / DIG_PER_DEC, intg0x = intg % DIG_PER_DEC;
+    int frac0 = scale / DIG_PER_DEC, frac0x = scale % DIG_PER_DEC;
+    int size = dig2bytes[intg0x] + (intg0 + frac0) * 4 + dig2bytes[frac0x];
+    const unsigned char *from = (const unsigned char *) rec.aRef();
+    unsigned char bin[40];   // 65 digits need at most 30 bytes
+    const unsigned char *p = bin;
+    unsigned char mask = (from[0] & 0x80) ? 0 : 0xFF;
+    bool started = false;
+    unsigned int x;
+
+    for(int i = 0 ; i < size ; i++) bin[i] = from[i] ^ mask;
+    bin[0] ^= 0x80;
+    
+    if(! rbuf.prepare(prec + 3)) return;
+    if(mask) rbuf.putc('-');
+
+    /* Integer part: the partial group, then whole groups */
+    for(int i = (intg0x ? -1 : 0) ; i < intg0 ; i++) {
+      x = decimal_group(p, i < 0 ? dig2bytes[intg0x] : 4);
+      if(started) rbuf.put_digits(x, DIG_PER_DEC);
+      else if(x) {
+        rbuf.put_digits(x, 0);
+        started = true;
+      }
+    }
+    if(! started) rbuf.putc('0');
+    if(! scale) return;
+
+    /* Fraction: whole groups, then the partial group */
+    rbuf.putc('.');
+    for(int i = 0 ; i < frac0 ; i++) 
+      rbuf.put_digits(decimal_group(p, 4), DIG_PER_DEC);
+    if(frac0x)
+      rbuf.put_digits(decimal_group(p, dig2bytes[frac0x]), frac0x);
   }  
 
 } // Namespace
@@ -21,6 +21,10 @@
 */
  
 
+class NdbQueryOperation;
+struct arrow_type;
+struct arrow_column;
+
 enum ndb_string_packing {
   char_fixed,
   char_var,
@@ -29,16 +33,42 @@ enum ndb_string_packing {
 
 
 namespace MySQL {
+  class result;
+  struct encoders;
+  template <class S> struct packers;
+  struct appenders;
+
+  /* An encoder writes a column value of one particular type; 
+     each result chooses its encoder once, from the column type.
+     A packer is an encoder for one of the binary formats. */
+  typedef void (*encoder)(result &, result_buffer &, const char **);
+
+  /* An appender adds a value to a column of an Arrow record batch */
+  typedef void (*appender)(result &, arrow_column &);
+
   class result {
+    friend struct encoders;
+    template <class S> friend struct packers;
+    friend struct appenders;
   public:
-    result(NdbOperation *, const NdbDictionary::Column *);
+    result(NdbOperation *, const NdbDictionary::Column *, block_pool *);
+    result(NdbQueryOperation *, const NdbDictionary::Column *, block_pool *);
     ~result();
     const NdbDictionary::Column *getColumn()  { return _col;    };
     bool isNull() { return _RecAttr ? _RecAttr->isNULL() : BLOBisNull(); };  
     int activateBlob();
-    void out(result_buffer &, const char **);
+    void out(result_buffer &rbuf, const char **escapes) {
+      encode(*this, rbuf, escapes);
+    };
+
+    static encoder choose_packer(NdbDictionary::Column::Type, 
+                                 binary_syntax_id);
+    static appender choose_appender(NdbDictionary::Column::Type, 
+                                    arrow_type &);
 
+    encoder encode;
     result_buffer *contents;
+    bool inflate;        // a "Compress" column: inflate contents when read
     
   private:
     NdbDictionary::Column::Type type;
@@ -47,5 +77,7 @@ namespace MySQL {
     const NdbDictionary::Column *_col;
 
     bool BLOBisNull();
+    static encoder choose_encoder(NdbDictionary::Column::Type);
+    template <class OP> void fetch(OP *, block_pool *);
   };
 }
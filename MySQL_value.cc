@@ -55,6 +55,13 @@ uint64_t flip64(uint64_t i) {
 }
 
 
+/* The size of the register value in an interpreted update */
+inline size_t interpreted_len(NdbDictionary::Column::Type col_type) {
+  return (col_type == NdbDictionary::Column::Bigint ||
+          col_type == NdbDictionary::Column::Bigunsigned) ? 8 : 4;
+}
+
+
 void MySQL::value(mvalue &m, ap_pool *p, 
                   const NdbDictionary::Column *col, const char *val) 
 {
@@ -195,7 +202,7 @@ void MySQL::value(mvalue &m, ap_pool *p,
     return;
   }
 
-  /* Dynamic values @++. @--. @null, @time, @autoinc */
+  /* Dynamic values @++. @--. @+N, @-N, @null, @time, @autoinc */
   if(*val == '@') {
     if(!strcmp(val,"@null")) {
       COV_point("@null");
@@ -207,12 +214,45 @@ void MySQL::value(mvalue &m, ap_pool *p,
       COV_point("@++");
       m.use_value = use_interpreted;
       m.interpreted = is_increment;
+      m.delta = 1;
+      m.bound_type = no_bound;
+      m.len = interpreted_len(col_type);
       return;
     }
     if(!strcmp(val,"@--")) {
       COV_point("@--");
       m.use_value = use_interpreted;
       m.interpreted = is_decrement;
+      m.delta = 1;
+      m.bound_type = no_bound;
+      m.len = interpreted_len(col_type);
+      return;
+    }
+    /* @+N and @-N, optionally followed by ",max=M" or ",cap=M" (after an 
+       increment) or ",min=M" or ",floor=M" (after a decrement) */
+    if((val[1] == '+' || val[1] == '-') && isdigit(val[2])) {
+      COV_point("@+N");
+      char *end;
+      const char *bound;
+      bool up = (val[1] == '+');
+      m.use_value = use_interpreted;
+      m.interpreted = up ? is_increment : is_decrement;
+      m.delta = strtoull(val + 2, &end, 10);
+      m.bound_type = no_bound;
+      m.len = interpreted_len(col_type);
+      if(*end == ',') {
+        bound = end + 1;
+        if(! strncmp(bound, up ? "max=" : "min=", 4)) 
+          m.bound_type = is_guarded, bound += 4;
+        else if(up && ! strncmp(bound, "cap=", 4)) 
+          m.bound_type = is_saturated, bound += 4;
+        else if(! up && ! strncmp(bound, "floor=", 6))
+          m.bound_type = is_saturated, bound += 6;
+        else bound = "";
+        m.bound = strtoll(bound, &end, 10);
+        if(end == bound) m.use_value = err_bad_user_value;
+      }
+      if(*end) m.use_value = err_bad_user_value;
       return;
     }
     if(!strcmp(val,"@time")) {
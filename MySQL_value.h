@@ -62,6 +62,12 @@ enum mvalue_interpreted {
   is_increment, is_decrement
 };
 
+enum mvalue_bound {   /* for "@+N,max=M" etc. */
+  no_bound = 0,
+  is_guarded,         /* max= or min= : fail if the result would pass M */
+  is_saturated        /* cap= or floor= : store M instead */
+};
+
 struct mvalue {
   const NdbDictionary::Column *ndb_column;
   union {
@@ -85,6 +91,9 @@ struct mvalue {
   Uint32 col_len;
   mvalue_use use_value;
   mvalue_interpreted interpreted;
+  Uint64 delta;       /* for interpreted updates */
+  Int64 bound;
+  mvalue_bound bound_type;
   bool over;        /* overflow indicator */
 };
 typedef struct mvalue mvalue;
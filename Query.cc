@@ -19,6 +19,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "mod_ndb.h"
 #include "ndb_api_compat.h"
 #include "query_source.h"
+#include <new>
+#include <ctype.h>
+#include <sys/time.h>
+
+extern int n_endp;                          /* from config.cc */
 
 /* There are many varieties of query: 
    read, insert, update, and delete (e.g. HTTP GET, POST, and DELETE);
@@ -36,6 +41,8 @@ namespace Plan {
   PlanMethod SetupRead; PlanMethod SetupWrite; PlanMethod SetupDelete; // setups
   PlanMethod SetupInsert;
   PlanMethod Read;      PlanMethod Write;      PlanMethod Delete;     // actions
+  PlanMethod SetupJoin; PlanMethod ReadJoin;                 // pushed-down join
+  PlanMethod SetupScanWrite; PlanMethod ScanUpdate;  // set-based writes
 };  
 
 
@@ -67,6 +74,7 @@ struct QueryItems {
   mvalue *set_vals;
   data_operation *data;
   query_source *source;
+  bool is_conditional;
 };  
 
 #include "index_object.h"
@@ -75,7 +83,14 @@ struct QueryItems {
 /* Utility function declarations
 */
 int set_up_write(request_rec *, config::dir *, struct QueryItems *, bool);
+bool set_up_values(request_rec *, config::dir *, struct QueryItems *);
+int scan_write(request_rec *, config::dir *, struct QueryItems *);
+int stream_upload(request_rec *, config::dir *, struct QueryItems *);
+int write_conditions(request_rec *, config::dir *, struct QueryItems *);
+int arithmetic_update(request_rec *, struct QueryItems *, mvalue &, Uint32 &);
 short key_col_bin_search(char *, config::dir *);
+NdbTransaction *read_group_tx(request_rec *, config::dir *, struct QueryItems *);
+config::expand *find_expansion(config::dir *, const char *);
 
 
 /* Some very simple modules are fully defined here:
@@ -125,6 +140,15 @@ int Plan::SetupDelete(request_rec *r, config::dir *dir, struct QueryItems *q) {
   return q->data->op->deleteTuple(); 
 }
 
+int Plan::SetupScanWrite(request_rec *r, config::dir *dir, struct QueryItems *q) { 
+  log_debug(r->server,"setup: This is a set-based %s.", 
+            q->set_vals ? "update" : "delete");
+  if(q->set_vals) set_up_values(r, dir, q);
+  /* An exclusive lock implies that the scan fetches key info, 
+     which is needed to take over the rows */
+  return q->data->scanop->readTuples(NdbOperation::LM_Exclusive);
+}
+
 
 /* Inlined code to test the usability of an mvalue
 */
@@ -174,6 +198,25 @@ inline void set_key(request_rec *r, short &n, char *value, config::dir *dir,
   }
 }
 
+
+/* Inlined code to build the single-flight key for a GET: the endpoint
+   and the output format (which the Accept header can change), plus every
+   key column used in the request, in the sorted order of dir->key_columns.
+   Values are length-prefixed, so any value is safe.
+*/
+inline const char *flight_key(request_rec *r, config::dir *dir, 
+                              struct QueryItems *q) {
+  char *key = ap_psprintf(r->pool, "%s|%s|%s.%s|%p", 
+                          r->server->server_hostname, dir->path,
+                          dir->database, dir->table, q->data->fmt);
+  for(short n = 0 ; n < dir->key_columns->size() ; n++) 
+    if(q->keys[n].value)
+      key = ap_psprintf(r->pool, "%s|%s=%d:%s", key, 
+                        dir->key_columns->item(n).name,
+                        (int) strlen(q->keys[n].value), q->keys[n].value);
+  return key;
+}
+
 // =============================================================
 
 /* Query():
@@ -196,9 +239,12 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
     };
   struct QueryItems *q = &Q;
   const NdbDictionary::Column *ndb_Column;
+  NdbTransaction *tx;
   int response_code = 0;
   mvalue mval;
   short col;
+  char *expand = 0;
+  bool is_set_op = 0;
   register const char * idxname;
 
   // Initialize the data dictionary 
@@ -231,7 +277,7 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
       if(i->n_read_ops < i->server_config->max_read_operations) {
         q->data = i->data + i->n_read_ops++;
         if(dir->flag.use_etags) i->flag.use_etag = 1;
-        q->data->fmt = dir->fmt;
+        q->data->fmt = choose_format(r, dir->fmt);
         q->data->flag.select_star = dir->flag.select_star;
         if(dir->flag.select_star)
           q->data->n_result_cols = q->tab->getNoOfColumns();
@@ -249,11 +295,8 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
       
       ap_discard_request_body(r);
       // Allocate an array of result objects for all desired columns.
-      // Like anything that will be stored in the ndb_instance, allocate
-      // from r->connection->pool, not r->pool
-      q->data->result_cols =  (MySQL::result**)
-        ap_pcalloc(r->connection->pool, 
-                   q->data->n_result_cols * sizeof(MySQL::result *));
+      // Like the results themselves, it comes from the instance's slab
+      q->data->result_cols = i->results.new_array(q->data->n_result_cols);
       break;
     case M_POST:
       Q.op_setup = Plan::SetupWrite;
@@ -264,10 +307,19 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
         return ndb_handle_error(r, response_code, NULL, NULL);
       /* A POST with no keys is an insert, and  
          an insert has a primary key plan: */
-      if(! (r->args || dir->pathinfo_size)) {
+      if(! (qsource.args || dir->pathinfo_size)) {
         Q.plan = PrimaryKey;
         Q.op_setup = Plan::SetupInsert;
       }
+      /* With "ReturnUpdates On", an update reads back the new values of 
+         the columns it sets, so it uses a stored data_operation, too. */
+      else if(dir->flag.return_updates && 
+              i->n_read_ops < i->server_config->max_read_operations) {
+        q->data = i->data + i->n_read_ops++;
+        q->data->fmt = choose_format(r, dir->fmt);
+        q->data->flag.select_star = 1;
+        q->data->result_cols = i->results.new_array(dir->updatable->size());
+      }
       break;
     case M_DELETE:
       if(! dir->flag.allow_delete) 
@@ -294,8 +346,8 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
      Process arguments, and then pathinfo, to determine an access plan.
      The detailed work is done within the inlined function set_key().
   */
-  if(r->args) {  /* Arguments */
-    register const char *c = r->args;
+  if(qsource.args) {  /* Arguments */
+    register const char *c = qsource.args;
     char *key, *val;
     short n;
     
@@ -303,6 +355,15 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
       key = ap_getword(r->pool, (const char **) &val, '=');
       ap_unescape_url(key);
       ap_unescape_url(val);
+      if(dir->expansions && ! strcmp(key, "expand")) {
+#ifdef HAVE_OP_ABORT_OPTION
+        expand = val;
+#else
+        /* Without per-operation abort options, a missing child row would
+           abort the whole transaction, so "?expand=" is ignored. */
+#endif
+        continue;
+      }
       n = key_col_bin_search(key, dir);
       if(n >= 0) 
         set_key(r, n, val, dir, &Q);
@@ -312,7 +373,7 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
   }   
   
   /* Pathinfo.  If args were insufficient to define a query plan (or pathinfo
-     has the "always" flag), process r->path_info from right to left, 
+     has the "always" flag), process the path_info from right to left, 
   */
   if(dir->pathinfo_size && 
      ((Q.plan == NoPlan) || dir->flag.pathinfo_always)) {
@@ -320,9 +381,9 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
     short element = dir->pathinfo_size - 1;
     register const char *s;
     // Set s to the end of the string, then work backwards.
-    for(s = r->path_info ; *s; ++s);
+    for(s = qsource.path_info ; *s; ++s);
     if(* (s-1) == '/') s -=2;   /* ignore a trailing slash */
-    for(; s >= r->path_info && element >= 0; --s) {
+    for(; s >= qsource.path_info && element >= 0; --s) {
       if(*s == '/') {
         set_key(r, dir->pathinfo[element--], 
                 ap_pstrndup(r->pool, s+1, item_len), 
@@ -342,6 +403,107 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
     response_code = 404;
     goto abort2;
   }
+
+  /* Nested resources.  "?expand=" can name only the endpoint's Expand 
+     relations, and the parent must be a single-row lookup (not a scan or 
+     a join), because each child is keyed on values from the parent row.
+  */
+  if(expand) {
+    const char *list = expand;
+    char *name;
+    if(! (Q.plan == PrimaryKey || Q.plan == UniqueIndexAccess) || dir->joins
+       || qsource.req_method != M_GET) {
+      log_debug(r->server, "Cannot expand %s: not a single-row lookup", 
+                r->unparsed_uri);
+      response_code = ndb_handle_error(r, 400, NULL, NULL);
+      goto abort2;
+    }
+    while(*list && (name = ap_getword(r->pool, &list, ','))) {
+      if(! find_expansion(dir, name)) {
+        log_debug(r->server, "Cannot expand %s: unknown relation %s", 
+                  r->unparsed_uri, name);
+        response_code = ndb_handle_error(r, 400, NULL, NULL);
+        goto abort2;
+      }
+    }
+    q->data->expand = expand;
+    q->data->endpoint = dir;
+    i->flag.has_expand = 1;
+  }
+
+  /* A BlobUpload writes into one row.  A raw body must name it by key in
+     the URL, but a multipart body can also insert a row, with its key in
+     the form items before the file. */
+  if(qsource.is_upload && (Q.plan >= Scan || 
+     (Q.op_setup == Plan::SetupInsert && ! qsource.suspended))) {
+    log_debug(r->server, "Cannot upload at %s: not a single-row lookup", 
+              r->unparsed_uri);
+    response_code = ndb_handle_error(r, 400, NULL, NULL);
+    goto abort2;
+  }
+
+  /* Set-based DELETE and UPDATE.  A write with a scan plan changes every
+     row that the scan returns, in batches that are committed as it goes, 
+     so it cannot be part of a larger transaction.
+  */
+  if(Q.plan >= Scan && qsource.req_method != M_GET) {
+    if(! dir->flag.set_ops || qsource.keep_tx_open || dir->joins) {
+      log_debug(r->server, "Cannot write at %s: not a single-row lookup", 
+                r->unparsed_uri);
+      response_code = ndb_handle_error(r, 400, NULL, NULL);
+      goto abort2;
+    }
+    if(q->data != &local_data_op) {  /* It returns a count, not the rows */
+      /* Give back the stored data_operation.  cleanup() clears only the
+         first n_read_ops of them, so clear this one now. */
+      bzero(q->data, sizeof(struct data_operation));
+      q->data = &local_data_op;
+      i->n_read_ops--;
+    }
+    is_set_op = 1;
+    Q.op_setup = Plan::SetupScanWrite;
+    Q.op_action = Q.set_vals ? Plan::ScanUpdate : Plan::Delete;
+  }
+
+  /* "StreamBlobs": a raw lookup, sent to the client as it is read from 
+     the blob, needs a transaction of its own */
+  if(dir->flag.stream_blobs && dir->fmt->flag.is_raw && q->data->fmt
+     && qsource.req_method == M_GET && Q.plan < Scan && ! r->main
+     && ! qsource.keep_tx_open && i->tx == 0 && ! expand && ! dir->joins)
+    q->data->flag.stream_blob = 1;
+
+  /* "Format Arrow": a scan is sent to the client a record batch at a 
+     time, as the rows arrive, so it also needs a transaction of its own */
+  if(qsource.req_method == M_GET && q->data->fmt && q->data->fmt->binary
+     && q->data->fmt->binary->id == syntax_arrow && Q.plan >= Scan 
+     && ! r->main && ! qsource.keep_tx_open && i->tx == 0 && ! expand 
+     && ! dir->joins)
+    q->data->flag.stream_rows = 1;
+
+  /* "Compress": a raw endpoint sends a compressed blob just as it is 
+     stored to a client that accepts the deflate content-coding */
+  if(dir->compressed && dir->fmt->flag.is_raw && q->data->fmt
+     && qsource.req_method == M_GET && accepts_deflate(r))
+    q->data->flag.deflated = 1;
+
+  /* Single-flight: if an identical GET is already running in this process,
+     wait for it and send its result, rather than reading the row again.
+     Only a self-contained request can share; not a subrequest that is part 
+     of a larger transaction, and not a JSONRequest.
+  */
+  if(dir->flag.single_flight && r->method_number == M_GET && ! r->main
+     && ! q->data->flag.stream_blob && ! q->data->flag.deflated
+     && ! q->data->flag.stream_rows
+     && ! qsource.keep_tx_open && i->tx == 0 && i->n_read_ops == 1 
+     && ! expand && ! (qsource.content_type && 
+           ! strcasecmp(qsource.content_type, "application/jsonrequest"))) {
+    response_code = single_flight_wait(r, i, flight_key(r, dir, q));
+    if(response_code != DECLINED) {
+      i->cleanup();
+      return response_code;
+    }
+    response_code = 0;
+  }
   
   /* Open a transaction, if one is not already open.
      This creates an obligation to close it later, using tx->close().
@@ -363,6 +525,19 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
     }
   }
 
+  /* In a batch of subrequests, reads from different tables can run in
+     independent transactions, which ExecuteAll() commits in parallel.
+     Once the batch contains a write, later reads stay in the main 
+     transaction, so that they will see it.  So do nested resources and
+     their parents, which are executed in two steps.
+  */
+  tx = i->tx;
+  if(qsource.keep_tx_open) {
+    if(qsource.req_method != M_GET) 
+      i->flag.has_writes = 1;
+    else if(! (i->flag.has_writes || dir->joins || expand || i->flag.expanding))
+      tx = read_group_tx(r, dir, q);
+  }
   
   /* Now set the Query Items that depend on the access plan and index type.
      Case 1: Table Scan  */    
@@ -415,8 +590,27 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
     }
   }
   
+  /* Case 5: a GET on an endpoint with N-SQL JOINs runs as one NdbQuery.
+     Its root must be a lookup or a table scan, without filters. */
+  if(dir->joins && Q.op_action == Plan::Read) {
+#ifdef HAVE_NDB_SPJ
+    if(Q.n_filters || (Q.plan == Scan && dir->index_scan->name) || 
+       Q.plan == OrderedIndexScan) {
+      log_err(r->server, "Configuration error at %s: the root of a JOIN must "
+              "be a primary key or unique index lookup, or a table scan, "
+              "without filters.", r->uri);
+      response_code = 500;
+      goto abort1;
+    }
+    delete q->idxobj;
+    q->idxobj = new Pushed_join_object(q, r);
+    Q.op_setup = Plan::SetupJoin;
+    Q.op_action = Plan::ReadJoin;
+#endif
+  }
+  
   // Get an NdbOperation (or NdbIndexOperation, etc.)
-  q->data->op = q->idxobj->get_ndb_operation(i->tx);
+  q->data->op = q->idxobj->get_ndb_operation(tx);
 
   // Query setup, e.g. Plan::SetupRead calls op->readTuple() 
   if(Q.op_setup(r, dir, & Q)) { // returns 0 on success
@@ -442,7 +636,8 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
           (q->idxobj->set_key_part(keycol.rel_op, mval))) 
       {
           log_debug(r->server," set key failed for column %s", ndb_Column->getName())
-          response_code = ndb_handle_error(r, 500, & q->data->op->getNdbError(), 
+          response_code = ndb_handle_error(r, 500, q->data->op ?
+                                           & q->data->op->getNdbError() : 0, 
                                            "Configuration error");;
           goto abort1;
       }
@@ -469,7 +664,8 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
   } /* if (plan != Scan) */
   
   // Set filters
-  if(Q.plan >= Scan && Q.n_filters) {
+  if(Q.plan >= Scan && (Q.n_filters || 
+     (dir->expire_col && Q.op_action == Plan::Read))) {
     NdbScanFilter filter(q->data->scanop);
     NdbScanFilter::BinaryCondition cond;
     filter.begin(NdbScanFilter::AND);
@@ -499,6 +695,17 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
           filter.cmp(cond, col_id, (&mval.u.val_char) ); 
       }
     } /*for*/                  
+    /* Expired rows that the reaper has not yet deleted */
+    if(dir->expire_col && Q.op_action == Plan::Read &&
+       (ndb_Column = q->tab->getColumn(dir->expire_col)) != 0) {
+      MySQL::value(mval, r->pool, ndb_Column, 
+                   expiry_now(r->pool, ndb_Column, time(0)));
+      filter.begin(NdbScanFilter::OR);
+      filter.isnull(ndb_Column->getColumnNo());
+      filter.cmp(NdbScanFilter::COND_GE, ndb_Column->getColumnNo(), 
+                 (&mval.u.val_char));
+      filter.end();
+    }
     filter.end();
   }
   
@@ -519,12 +726,19 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
   if(response_code == 0) {  
     if(qsource.keep_tx_open) 
       return OK;
+    else if(is_set_op)
+      return scan_write(r, dir, q);
+    else if(qsource.is_upload)
+      return stream_upload(r, dir, q);
+    else if(q->data->blob)
+      return stream_blob(r, i);
     else
       return ExecuteAll(r, i);
   }
 
   abort1:
   i->tx->close();
+  i->close_tx_groups();
 
   abort2:
   // Look at this later.  A failure of any operation causes the whole transaction
@@ -539,7 +753,6 @@ int Query(request_rec *r, config::dir *dir, ndb_instance *i, query_source &qsour
 
   // Clean up parts of Q that need to be freed
   if(q->idxobj) delete q->idxobj;
-  if(q->data->result_cols) delete[] q->data->result_cols;
   
   return response_code;
   
@@ -557,18 +770,39 @@ int Plan::Read(request_rec *r, config::dir *dir, struct QueryItems *q) {
   unsigned int n = 0;
   const int select_star = dir->flag.select_star;
 
+  // A streamed blob is read later, by stream_blob(), without a result
+  if(q->data->flag.stream_blob && q->data->n_result_cols == 1) {
+    col = select_star ? q->tab->getColumn(0) : q->tab->getColumn(*column_list);
+    if(col && (col->getType() == NdbDictionary::Column::Blob ||
+               col->getType() == NdbDictionary::Column::Text)
+       && ! is_compressed_column(dir, col->getName())) {
+      q->data->blob = q->data->op->getBlobHandle(col->getColumnNo());
+      if(q->data->blob) q->data->n_result_cols = 0;
+    }
+  }
+
   // Set up the result columns
   for( ; n < q->data->n_result_cols ; n++) {
     col = select_star ? 
       q->tab->getColumn(n) : q->tab->getColumn(column_list[n]);
-      q->data->result_cols[n] = new MySQL::result(q->data->op, col);
+      q->data->result_cols[n] = 
+        q->i->results.new_result(q->data->op, col, & q->i->blocks);
+      if(dir->compressed && ! q->data->flag.deflated 
+         && is_compressed_column(dir, col->getName()))
+        q->data->result_cols[n]->inflate = true;
   }
+  // A lookup at an "ExpireOn" endpoint also reads the expiry time 
+  if(dir->expire_col && q->plan < Scan) 
+    q->data->expiry = q->data->op->getValue(dir->expire_col);
   return 0;
 }
 
 
-int set_up_write(request_rec *r, config::dir *dir, 
-                 struct QueryItems *q, bool is_insert) 
+/* set_up_values():
+   Set up an mvalue for each updatable column in the request.
+   Returns 1 if any of them is an interpreted value, such as "@++".
+*/
+bool set_up_values(request_rec *r, config::dir *dir, struct QueryItems *q) 
 { 
   const NdbDictionary::Column *col;
   bool is_interpreted = 0;
@@ -591,6 +825,11 @@ int set_up_write(request_rec *r, config::dir *dir,
           MySQL::binary_value(mval, r->pool, col, binary_val);
           log_debug(r->server,"Binary update to column %s", key);
         }
+        /* "Compress": compress a blob value once, here, since a 
+           set-based update writes the same value to every row */
+        if(mval.use_value == use_blob && dir->compressed
+           && is_compressed_column(dir, key))
+          mval.binary_info = deflate_value(r->pool, mval.binary_info);
 
         if(mval.use_value == use_interpreted) {
           is_interpreted = 1;
@@ -601,11 +840,28 @@ int set_up_write(request_rec *r, config::dir *dir,
       else log_err(r->server,"AllowUpdate list includes invalid column name %s", key);
     } // end if(binary_val)
   } // end for()
+  return is_interpreted;
+}
+
+
+int set_up_write(request_rec *r, config::dir *dir, 
+                 struct QueryItems *q, bool is_insert) 
+{ 
+  bool is_interpreted = set_up_values(r, dir, q);
   
+  // An update can be conditional on If-Match or on N-SQL "IF" conditions
+  if(! is_insert && (dir->conditions || 
+     (dir->version_col && ap_table_get(r->headers_in, "If-Match"))))
+    q->is_conditional = 1;
+
+  // Only an interpreted update can read back the values it has set 
+  if(! is_insert && q->data->result_cols)
+    is_interpreted = 1;
+
   // Call the aproporiate setup on the NdbOperation
   if(is_insert) 
     return q->data->op->insertTuple();
-  if(is_interpreted) 
+  if(is_interpreted || q->is_conditional) 
     return q->data->op->interpretedUpdateTuple();
   return q->data->op->writeTuple();
 }
@@ -614,6 +870,13 @@ int set_up_write(request_rec *r, config::dir *dir,
 int Plan::Write(request_rec *r, config::dir *dir, struct QueryItems *q) {
   const NdbDictionary::Column *col;
   int eqr = 1;  
+  Uint32 label = 2;   /* labels 0 and 1 are used by write_conditions() */
+  
+  // The conditions come first in the interpreted program
+  if(q->is_conditional) {
+    int status = write_conditions(r, dir, q);
+    if(status) return status;
+  }
   
   // iterate over the mvalues that were set up in Plan::SetupWrite
   for(int n = 0; n < dir->updatable->size() ; n++) {
@@ -627,8 +890,7 @@ int Plan::Write(request_rec *r, config::dir *dir, struct QueryItems *q) {
             eqr = q->data->op->setValue(col->getColumnNo(), mval.u.val_const_char );
             break;
           case use_autoinc:
-            /* to do: tunable prefetch */
-            eqr = get_auto_inc_value(q->i->db, q->tab, next_value, 10);
+            eqr = next_auto_inc(q->i, q->tab, next_value);
             if(!eqr) 
               eqr = (mval.len == 8 ?
                  q->data->op->setValue(col->getColumnNo(), next_value) :
@@ -639,11 +901,7 @@ int Plan::Write(request_rec *r, config::dir *dir, struct QueryItems *q) {
             eqr = q->data->op->setValue(col->getColumnNo(), (char *) NULL);
             break;
           case use_interpreted: 
-            if(mval.interpreted == is_increment) 
-              eqr = q->data->op->incValue(col->getColumnNo(), (Uint32) 1);
-            else if(mval.interpreted == is_decrement) 
-              eqr = q->data->op->subValue(col->getColumnNo(), (Uint32) 1);
-            else assert(0);
+            eqr = arithmetic_update(r, q, mval, label);
             break;
           case use_blob:
             mval.u.blob_handle = q->data->op->getBlobHandle(col->getName());
@@ -674,16 +932,755 @@ int Plan::Write(request_rec *r, config::dir *dir, struct QueryItems *q) {
       }
     }
   } // for()
+
+  // "ReturnUpdates On": read back the new values in the same operation
+  if(q->data->result_cols && ! eqr) {
+    for(int n = 0; n < dir->updatable->size() ; n++) {
+      col = q->set_vals[n].ndb_column;
+      if(col && q->set_vals[n].use_value != use_blob) 
+        q->data->result_cols[q->data->n_result_cols++] = 
+          q->i->results.new_result(q->data->op, col, & q->i->blocks);
+    }
+  }
   return eqr;
 }
 
 
+/* Inlined code to add a branch to an interpreted program, which is taken
+   unless "column rel_op value" holds.  NDB compares "value op column", so
+   each test here is the negation with its operands reversed.
+*/
+inline int branch_unless(NdbOperation *op, int rel_op, Uint32 col_id,
+                         mvalue &mval, Uint32 label) {
+  const void *val = (mval.use_value == use_char) ?
+    (const void *) mval.u.val_char : (const void *) & mval.u.val_char;
+  Uint32 len = (mval.use_value == use_char) ? mval.col_len : 0;
+
+  switch(rel_op) {   /* as in NdbIndexScanOperation::BoundType */
+    case NdbIndexScanOperation::BoundLE:     /* column >= value */
+      return op->branch_col_gt(col_id, val, len, false, label);
+    case NdbIndexScanOperation::BoundLT:     /* column > value */
+      return op->branch_col_ge(col_id, val, len, false, label);
+    case NdbIndexScanOperation::BoundGE:     /* column <= value */
+      return op->branch_col_lt(col_id, val, len, false, label);
+    case NdbIndexScanOperation::BoundGT:     /* column < value */
+      return op->branch_col_le(col_id, val, len, false, label);
+    default:                                 /* column = value */
+      return op->branch_col_ne(col_id, val, len, false, label);
+  }
+}
+
+
+/* arithmetic_update():
+   Add "@+N" or "@-N" to the interpreted program.  With a bound, the old 
+   value is first tested against (bound - N) or (bound + N); if the update 
+   would pass the bound, it either fails with GUARD_FAILED_ERROR or stores
+   the bound itself.  Uses (and advances) two labels.
+*/
+int arithmetic_update(request_rec *r, struct QueryItems *q, mvalue &mval,
+                      Uint32 &label) {
+  NdbOperation *op = q->data->op;
+  const NdbDictionary::Column *col = mval.ndb_column;
+  const Uint32 col_id = col->getColumnNo();
+  const bool is_inc = (mval.interpreted == is_increment);
+  const Uint32 out_of_range = label++;
+  const Uint32 done = label++;
+  int eqr = 0;
+
+  if(mval.bound_type) {
+    mvalue limit;
+    Int64 threshold = is_inc ? mval.bound - (Int64) mval.delta 
+                             : mval.bound + (Int64) mval.delta;
+    MySQL::value(limit, r->pool, col, ap_psprintf(r->pool, "%lld", 
+                 (long long) threshold));
+    if(mval_is_usable(r, limit))
+      eqr = branch_unless(op, is_inc ? NdbIndexScanOperation::BoundGE
+                                     : NdbIndexScanOperation::BoundLE,
+                          col_id, limit, out_of_range);
+    else   /* e.g. an unsigned column that can never be in range */
+      eqr = op->branch_label(out_of_range);
+  }
+
+  if(! eqr) {
+    if(mval.len == 8) 
+      eqr = is_inc ? op->incValue(col_id, (Uint64) mval.delta)
+                   : op->subValue(col_id, (Uint64) mval.delta);
+    else 
+      eqr = is_inc ? op->incValue(col_id, (Uint32) mval.delta)
+                   : op->subValue(col_id, (Uint32) mval.delta);
+  }
+
+  if(mval.bound_type && ! eqr) {
+    eqr = op->branch_label(done);
+    if(! eqr) eqr = op->def_label(out_of_range);
+    if(! eqr) {
+      if(mval.bound_type == is_guarded) 
+        eqr = op->interpret_exit_nok(GUARD_FAILED_ERROR);
+      else {
+        eqr = (mval.len == 8) ? op->load_const_u64(1, (Uint64) mval.bound)
+                              : op->load_const_u32(1, (Uint32) mval.bound);
+        if(! eqr) eqr = op->write_attr(col_id, 1);
+      }
+    }
+    if(! eqr) eqr = op->def_label(done);
+  }
+  return eqr;
+}
+
+
+/* write_conditions():
+   Begin the interpreted program of a conditional update.  It exits with 
+   PRECONDITION_FAILED_ERROR unless the version column matches the If-Match
+   header, and every N-SQL "IF" condition holds.  The row is tested and 
+   updated in the same operation, so no lock is held between requests.
+   Returns 0, or an HTTP error code.
+*/
+int write_conditions(request_rec *r, config::dir *dir, struct QueryItems *q) {
+  NdbOperation *op = q->data->op;
+  const NdbDictionary::Column *col;
+  const char *if_match = 0;
+  mvalue mval;
+  int eqr = 0;
+
+  if(dir->version_col) 
+    if_match = ap_table_get(r->headers_in, "If-Match");
+  if(if_match && strcmp(if_match, "*")) {   /* "*" matches any row */
+    if(! strncmp(if_match, "W/", 2)) if_match += 2;
+    if(*if_match == '"') 
+      if_match = ap_pstrndup(r->pool, if_match + 1, strlen(if_match) - 2);
+    col = q->tab->getColumn(dir->version_col);
+    if(! col) {
+      log_err(r->server, "VersionColumn %s is not in table %s.", 
+              dir->version_col, dir->table);
+      return ndb_handle_error(r, 500, NULL, "Configuration error.\n");
+    }
+    MySQL::value(mval, r->pool, col, if_match);
+    if(! mval_is_usable(r, mval)) 
+      return ndb_handle_error(r, 412, NULL, NULL);
+    log_debug(r->server, "If-Match: %s = %s", dir->version_col, if_match);
+    eqr = branch_unless(op, NdbIndexScanOperation::BoundEQ, 
+                        col->getColumnNo(), mval, 0);
+  }
+
+  for(NSQL::Expr *cond = dir->conditions ; cond && ! eqr ; cond = cond->next) {
+    const char *val = cond->value;
+    if(cond->vtype == NSQL::Param) {
+      len_string *param = q->source->get_item(cond->value);
+      if(! param) {
+        log_debug(r->server, "Conditional update without parameter %s",
+                  cond->value);
+        return ndb_handle_error(r, 400, NULL, NULL);
+      }
+      val = param->string;
+    }
+    col = q->tab->getColumn(cond->base_col_name);
+    if(! col) {
+      log_err(r->server, "Condition on nonexistent column %s.%s", 
+              dir->table, cond->base_col_name);
+      return ndb_handle_error(r, 500, NULL, "Configuration error.\n");
+    }
+    MySQL::value(mval, r->pool, col, val);
+    if(! mval_is_usable(r, mval)) 
+      return ndb_handle_error(r, 412, NULL, NULL);
+    eqr = branch_unless(op, cond->rel_op, col->getColumnNo(), mval, 0);
+  }
+
+  if(! eqr) eqr = op->branch_label(1);
+  if(! eqr) eqr = op->def_label(0);
+  if(! eqr) eqr = op->interpret_exit_nok(PRECONDITION_FAILED_ERROR);
+  if(! eqr) eqr = op->def_label(1);
+  if(eqr) {
+    log_err(r->server, "Cannot build conditional update: %s",
+            op->getNdbError().message);
+    return ndb_handle_error(r, 500, & op->getNdbError(), 0);
+  }
+  return 0;
+}
+
+
 int Plan::Delete(request_rec *r, config::dir *dir, struct QueryItems *q) {
   log_debug(r->server,"Deleting Row %s","")
   return 0;
 }
 
 
+/* In a set-based update, each row is updated with updateCurrentTuple(),
+   which cannot run an interpreted program -- so there can be no "IF" 
+   conditions, and no values such as "@++" or "@autoinc".
+*/
+int Plan::ScanUpdate(request_rec *r, config::dir *dir, struct QueryItems *q) {
+  for(int n = 0; n < dir->updatable->size() ; n++) {
+    mvalue &mval = q->set_vals[n];
+    if(! mval.ndb_column) continue;
+    if(dir->conditions || mval.use_value == use_interpreted || 
+       mval.use_value == use_autoinc || ! mval_is_usable(r, mval)) {
+      log_debug(r->server, "Cannot use column %s in a set-based update",
+                mval.ndb_column->getName());
+      return ndb_handle_error(r, 400, NULL, NULL);
+    }
+  }
+  return 0;
+}
+
+
+/* Inlined code to commit one batch of a set-based write.
+   Returns 0 on success, or else copies the error and returns 1.
+*/
+inline bool commit_batch(ndb_instance *i, NdbTransaction * &wtx, 
+                         NdbError &error) {
+  bool failed = wtx->execute(NdbTransaction::Commit, TX_ABORT_OPT, 
+                             i->conn->ndb_force_send);
+  if(failed) error = wtx->getNdbError();
+  wtx->close();
+  wtx = 0;
+  return failed;
+}
+
+
+/* scan_write():
+   Run a set-based DELETE or UPDATE, in place of ExecuteAll().  The scan 
+   holds exclusive locks on the rows in its current batch; each row is taken 
+   over by a separate write transaction, which is committed every 
+   dir->set_batch rows, and always before the scan fetches its next batch.
+   Stop after dir->set_max_rows rows, or, between batches, after 
+   dir->set_max_ms milliseconds.  The response is the number of rows 
+   affected, and whether the scan reached the end of its range.
+*/
+int scan_write(request_rec *r, config::dir *dir, struct QueryItems *q) {
+  ndb_instance *i = q->i;
+  NdbIndexScanOperation *scan = q->data->scanop;
+  NdbTransaction *wtx = 0;
+  NdbError error;
+  const char *error_message = 0;
+  const unsigned int max_rows = dir->set_max_rows ? 
+                                dir->set_max_rows : (unsigned int) -1;
+  unsigned int rows = 0, in_batch = 0;
+  int check = 0, response_code = OK;
+  bool complete;
+  struct timeval start, now;
+  result_buffer page;
+  
+  gettimeofday(&start, 0);
+
+  if(i->tx->execute(NdbTransaction::NoCommit, TX_ABORT_OPT, 
+                    i->conn->ndb_force_send)) {
+    error = i->tx->getNdbError();
+    goto failed;
+  }
+  
+  while(rows < max_rows && (check = scan->nextResult(true)) == 0) {
+    do {
+      if(! wtx && ! (wtx = i->db->startTransaction())) {
+        error = i->db->getNdbError();
+        goto failed;
+      }
+      if(! q->set_vals) {
+        if(scan->deleteCurrentTuple(wtx)) {
+          error = scan->getNdbError();
+          goto failed;
+        }
+      }
+      else {
+        if(! (q->data->op = scan->updateCurrentTuple(wtx))) {
+          error = scan->getNdbError();
+          goto failed;
+        }
+        response_code = Plan::Write(r, dir, q);
+        if(response_code) goto done;  /* Plan::Write() sent the error page */
+      }
+      rows++;
+      if(++in_batch == dir->set_batch) {
+        if(commit_batch(i, wtx, error)) goto failed;
+        in_batch = 0;
+      }
+    } while(rows < max_rows && (check = scan->nextResult(false)) == 0);
+    
+    if(in_batch) {
+      if(commit_batch(i, wtx, error)) goto failed;
+      in_batch = 0;
+    }
+    if(check == -1) break;
+    
+    gettimeofday(&now, 0);
+    if(dir->set_max_ms && (unsigned int) ((now.tv_sec - start.tv_sec) * 1000 
+       + (now.tv_usec - start.tv_usec) / 1000) >= dir->set_max_ms) 
+      break;
+  }
+  if(check == -1) {
+    error = scan->getNdbError();
+    goto failed;
+  }
+  complete = (check == 1);
+  
+  log_debug(r->server, "Set-based %s: %u rows (%s)", q->set_vals ? 
+            "update" : "delete", rows, complete ? "complete" : "incomplete");
+  page.init(r, 64);
+  page.out(" { \"affected\":%u , \"complete\":%s }\n", rows,
+           complete ? "true" : "false");
+  ap_set_content_length(r, page.sz);
+  ap_send_http_header(r);
+  ap_rwrite(page.buff, page.sz, r);
+  goto done;
+  
+  failed:
+  if(error.status == NdbError::TemporaryError) {
+    response_code = 503;
+    i->stats.temp_errors++;
+  }
+  else handle_exec_error(r, response_code, error_message, error);
+  log_debug(r->server, "Set-based write failed after %u rows: %s", 
+            rows, error.message);
+  response_code = ndb_handle_error(r, response_code, & error, error_message);
+  
+  done:
+  if(wtx) wtx->close();
+  i->tx->close();
+  i->tx = 0;
+  i->close_tx_groups();
+  i->cleanup();
+  return response_code;
+}
+
+
+/* stream_upload():
+   Write the request body into the endpoint's "BlobUpload" column as it 
+   arrives, rather than buffering the whole body for one setValue().  The 
+   write is executed with NoCommit first, which makes the blob handle 
+   active; upload_blob() then writes the body a part at a time, and 
+   ExecuteAll() commits.
+*/
+int stream_upload(request_rec *r, config::dir *dir, struct QueryItems *q) {
+  ndb_instance *i = q->i;
+  NdbBlob *blob;
+  NdbError error;
+  const char *error_message = 0;
+  int response_code;
+  
+  blob = q->data->op->getBlobHandle(dir->blob_upload);
+  if(! blob) {
+    log_err(r->server, "BlobUpload: cannot get blob handle for %s",
+            dir->blob_upload);
+    error = q->data->op->getNdbError();
+    goto failed;
+  }
+  if(blob->setValue("", 0)) {   /* replace any old value */
+    error = blob->getNdbError();
+    goto failed;
+  }
+  if(i->tx->execute(NdbTransaction::NoCommit, TX_ABORT_OPT, 
+                    i->conn->ndb_force_send)) {
+    error = i->tx->getNdbError();
+    goto failed;
+  }
+  
+  response_code = upload_blob(q->source, i->tx, blob, dir->max_upload, error);
+  if(response_code == OK) 
+    return ExecuteAll(r, i);
+  if(! error.code) {   /* a bad or oversized request body */
+    response_code = ndb_handle_error(r, response_code, NULL, NULL);
+    goto done;
+  }
+
+  failed:
+  if(error.status == NdbError::TemporaryError) {
+    response_code = 503;
+    i->stats.temp_errors++;
+  }
+  else handle_exec_error(r, response_code, error_message, error);
+  response_code = ndb_handle_error(r, response_code, & error, error_message);
+  
+  done:
+  i->tx->close();
+  i->tx = 0;
+  i->close_tx_groups();
+  i->cleanup();
+  return response_code;
+}
+
+
+#ifdef HAVE_NDB_SPJ
+/* A pushed-down join is defined with NdbQueryBuilder when the request 
+   arrives: the endpoint's table is the root operation, and each joined 
+   table is a lookup or an ordered index scan whose key is linked to 
+   columns of its parent.  The data nodes run the whole join in one
+   round trip.
+*/
+int Plan::SetupJoin(request_rec *r, config::dir *dir, struct QueryItems *q) {
+  log_debug(r->server,"setup: This is a pushed-down join.");
+  return 0;
+}
+
+
+/* link_keys() returns the operands for a joined table's key: for each 
+   column of the index, in order, the parent column that the ON clause 
+   links to it.  A lookup needs the whole key, but an ordered index scan 
+   can use a prefix.  Returns 0 if the ON clause does not fit the index.
+*/
+const NdbQueryOperand **link_keys(request_rec *r, NdbQueryBuilder *qb,
+                                  config::join &jn,
+                                  const NdbQueryOperationDef *parent,
+                                  const NdbDictionary::Table *tab,
+                                  const NdbDictionary::Index *idx) {
+  int n_parts = idx ? idx->getNoOfColumns() : tab->getNoOfPrimaryKeys();
+  const NdbQueryOperand **keys = (const NdbQueryOperand **) 
+    ap_pcalloc(r->pool, (n_parts + 1) * sizeof(NdbQueryOperand *));
+  int n, c;
+  
+  for(n = 0 ; n < n_parts ; n++) {
+    const char *col = idx ? idx->getColumn(n)->getName() 
+                          : tab->getPrimaryKey(n);
+    for(c = 0 ; c < jn.child_cols->size() ; c++) 
+      if(! strcmp(col, jn.child_cols->item(c))) break;
+    if(c == jn.child_cols->size()) break;
+    keys[n] = qb->linkedValue(parent, jn.parent_cols->item(c));
+    if(! keys[n]) return 0;
+  }
+  if(n == 0 || (n < n_parts && jn.idx_type != 'O')) 
+    return 0;
+  return keys;
+}
+
+
+/* fetch_join_columns() sets up the result columns of one relation
+*/
+bool fetch_join_columns(data_operation *data, const NdbDictionary::Table *tab,
+                        char **column_list, ndb_instance *i) {
+  const NdbDictionary::Column *col;
+
+  for(unsigned int n = 0 ; n < data->n_result_cols ; n++) {
+    col = data->flag.select_star ? 
+      tab->getColumn(n) : tab->getColumn(column_list[n]);
+    if(! col) return false;
+    data->result_cols[n] = i->results.new_result(data->queryop, col, 
+                                                 & i->blocks);
+  }
+  return true;
+}
+
+
+/* build_join() builds and prepares the NdbQueryDef of an endpoint's join.
+   The root's key values are parameters, so that one NdbQueryDef serves 
+   every request with the same root.  Returns 0 on success.
+*/
+int build_join(request_rec *r, config::dir *dir, struct QueryItems *q, 
+               struct join_def *jdef) {
+  NdbDictionary::Dictionary *dict = q->i->db->getDictionary();
+  int n_joins = dir->joins->size();
+  int n_parts;
+  int n;
+  const NdbQueryOperationDef **defs = (const NdbQueryOperationDef **) 
+    ap_pcalloc(r->pool, (n_joins + 1) * sizeof(NdbQueryOperationDef *));
+  const NdbError *error = 0;
+  int response_code;
+  NdbQueryBuilder *qb = NdbQueryBuilder::create();
+
+  /* The root operation, whose key values are parameters */
+  if(q->plan == Scan)
+    defs[0] = qb->scanTable(q->tab);
+  else {
+    n_parts = (q->plan == PrimaryKey ? q->tab->getNoOfPrimaryKeys() 
+                                     : q->idx->getNoOfColumns());
+    const NdbQueryOperand **keys = (const NdbQueryOperand **) 
+      ap_pcalloc(r->pool, (n_parts + 1) * sizeof(NdbQueryOperand *));
+    for(n = 0 ; n < n_parts ; n++) 
+      keys[n] = qb->paramValue();
+    defs[0] = (q->plan == PrimaryKey ? qb->readTuple(q->tab, keys) 
+                                     : qb->readTuple(q->idx, q->tab, keys));
+  }
+  if(! defs[0]) goto build_error;
+
+  /* The joined tables, each linked to its parent */
+  for(n = 0 ; n < n_joins ; n++) {
+    config::join &jn = dir->joins->item(n);
+    const NdbDictionary::Table *tab;
+    const NdbDictionary::Index *idx = 0;
+    const NdbQueryOperand **keys;
+    NdbQueryOptions options;
+
+    if(jn.database) q->i->db->setDatabaseName(jn.database);
+    tab = dict->getTable(jn.table);
+    if(tab && jn.idx_type != 'P') 
+      idx = dict->getIndex(jn.idx_name, jn.table);
+    if(jn.database) q->i->db->setDatabaseName(dir->database);
+
+    if(! (tab && (idx || jn.idx_type == 'P'))) {
+      log_err(r->server, "JOIN %s at %s: cannot find %s %s: %s", 
+              jn.relation, dir->path, tab ? "index" : "table",
+              tab ? jn.idx_name : jn.table, dict->getNdbError().message);
+      error = & dict->getNdbError();
+      goto abort;
+    }
+    keys = link_keys(r, qb, jn, defs[jn.parent + 1], tab, idx);
+    if(! keys) {
+      log_err(r->server, "JOIN %s at %s: the ON clause does not match %s.",
+              jn.relation, dir->path, idx ? jn.idx_name : "the primary key");
+      goto abort;
+    }
+    if(! jn.flag.outer) 
+      options.setMatchType(NdbQueryOptions::InnerJoin);
+    if(jn.idx_type == 'O') {
+      NdbQueryIndexBound bound(keys);
+      defs[n+1] = qb->scanIndex(idx, tab, & bound, & options);
+    }
+    else if(idx) 
+      defs[n+1] = qb->readTuple(idx, tab, keys, & options);
+    else 
+      defs[n+1] = qb->readTuple(tab, keys, & options);
+    if(! defs[n+1]) goto build_error;
+  }
+  
+  jdef->def = qb->prepare();
+  if(! jdef->def) goto build_error;
+  jdef->root_plan = q->plan;
+  jdef->root_idx = q->idx;
+  qb->destroy();
+  return 0;
+
+  build_error:
+  log_err(r->server, "Cannot build pushed-down join at %s: %s", dir->path,
+          qb->getNdbError().message);
+  error = & qb->getNdbError();
+
+  abort:
+  response_code = ndb_handle_error(r, 500, error, "Configuration error.");
+  qb->destroy();
+  return response_code;
+}
+
+
+int Plan::ReadJoin(request_rec *r, config::dir *dir, struct QueryItems *q) {
+  Pushed_join_object *root = (Pushed_join_object *) q->idxobj;
+  struct join_def *jdef = q->i->join_defs + dir->endpoint;
+  int n_joins = dir->joins->size();
+  int n_parts = 0;
+  int n;
+  int response_code;
+  NdbQueryParamValue *params = 0;
+  data_operation *children;
+
+  /* Build the NdbQueryDef, unless this instance already has it */
+  if(jdef->def && (jdef->root_plan != q->plan || jdef->root_idx != q->idx)) {
+    jdef->def->destroy();
+    jdef->def = 0;
+  }
+  if(! jdef->def) {
+    response_code = build_join(r, dir, q, jdef);
+    if(response_code) return response_code;
+  }
+
+  /* Create the query, with the lookup key as its parameters */
+  if(q->plan != Scan)
+    n_parts = (q->plan == PrimaryKey ? q->tab->getNoOfPrimaryKeys() 
+                                     : q->idx->getNoOfColumns());
+  if(n_parts) {
+    params = (NdbQueryParamValue *) 
+      ap_palloc(r->pool, n_parts * sizeof(NdbQueryParamValue));
+    for(n = 0 ; n < n_parts ; n++) 
+      new(params + n) NdbQueryParamValue(root->params[n]);
+  }
+  q->data->query = root->tx->createQuery(jdef->def, params,
+                                         NdbOperation::LM_CommittedRead);
+  if(! q->data->query) {
+    if(root->tx->getNdbError().classification == NdbError::SchemaError) {
+      jdef->def->destroy();
+      jdef->def = 0;
+    }
+    return ndb_handle_error(r, 500, & root->tx->getNdbError(), 0);
+  }
+  q->i->flag.has_join = 1;
+  
+  /* Result columns of the root */
+  q->data->queryop = q->data->query->getQueryOperation((Uint32) 0);
+  q->data->flag.is_scan = (q->plan == Scan);
+  if(! fetch_join_columns(q->data, q->tab, dir->visible->items(), q->i))
+    goto bad_column;
+  
+  /* Result columns of the joined tables, which are stored (like the 
+     root's) in the instance's slab, and linked into a tree */
+  children = (data_operation *) 
+    q->i->results.alloc(n_joins * sizeof(data_operation));
+  for(n = 0 ; n < n_joins ; n++) {
+    config::join &jn = dir->joins->item(n);
+    data_operation *child = children + n;
+    data_operation *parent = (jn.parent < 0) ? q->data : children + jn.parent;
+    data_operation **link;
+    const NdbDictionary::Table *tab = 
+      jdef->def->getQueryOperation(n + 1)->getTable();
+
+    child->relation = jn.relation;
+    child->queryop = q->data->query->getQueryOperation(n + 1);
+    child->flag.is_scan = (jn.idx_type == 'O');
+    child->flag.select_star = jn.flag.select_star;
+    child->n_result_cols = jn.flag.select_star ? 
+      tab->getNoOfColumns() : jn.visible->size();
+    child->aliases = jn.aliases->items();
+    child->result_cols = q->i->results.new_array(child->n_result_cols);
+    for(link = & parent->child ; *link ; link = & (*link)->sibling);
+    *link = child;
+    if(! fetch_join_columns(child, tab, jn.visible->items(), q->i))
+      goto bad_column;
+  }
+  return 0;
+
+  bad_column:
+  log_err(r->server, "Configuration error at %s: nonexistent column in JOIN "
+          "query.", dir->path);
+  return ndb_handle_error(r, 500, NULL, "Configuration error.");
+}
+
+
+/* release_join_defs():
+   Destroy an instance's prepared joins.  Called after an error that 
+   suggests a stale dictionary, when they will be built again, and from 
+   child_exit.
+*/
+void release_join_defs(ndb_instance *i) {
+  for(int n = 0 ; n < n_endp ; n++) 
+    if(i->join_defs[n].def) {
+      i->join_defs[n].def->destroy();
+      i->join_defs[n].def = 0;
+    }
+}
+
+#else
+
+void release_join_defs(ndb_instance *i) { }
+
+#endif
+
+
+/* ============== Nested resources ("?expand=") ============== */
+
+config::expand *find_expansion(config::dir *dir, const char *name) {
+  for(int n = 0 ; n < dir->expansions->size() ; n++)
+    if(! strcmp(name, dir->expansions->item(n).relation))
+      return & dir->expansions->item(n);
+  return 0;
+}
+
+
+/* Append "name=value" to a query string, %-encoding the value
+*/
+char *add_query_param(ap_pool *p, char *args, const char *name,
+                      const char *val, size_t len) {
+  static const char hex[] = "0123456789ABCDEF";
+  char *enc = (char *) ap_palloc(p, (3 * len) + 1);
+  register char *c = enc;
+
+  for(size_t n = 0 ; n < len ; n++) {
+    register unsigned char ch = val[n];
+    if(isalnum(ch) || ch == '-' || ch == '_' || ch == '.') *c++ = ch;
+    else *c++ = '%', *c++ = hex[ch >> 4], *c++ = hex[ch & 15];
+  }
+  *c = 0;
+  return args ? ap_pstrcat(p, args, "&", name, "=", enc, NULL)
+              : ap_pstrcat(p, name, "=", enc, NULL);
+}
+
+
+/* expand_one():
+   Build the child endpoint's key parameters from the parent row, add the
+   child's read to the open transaction, and link it under the parent.
+   If a key column of the parent row is null, there is no child.
+*/
+int expand_one(request_rec *r, ndb_instance *i, data_operation *parent,
+               config::expand *exp) {
+  request_rec *rr;
+  config::dir *dir;
+  data_operation *child, **link;
+  char *args = 0;
+  int response_code;
+
+  for(child = parent->child ; child ; child = child->sibling)
+    if(child->relation == exp->relation) return OK;   /* e.g. expand=a,a */
+
+  for(int k = 0 ; k < exp->parent_cols->size() ; k++) {
+    const char *col_name = exp->parent_cols->item(k);
+    MySQL::result *val = 0;
+    result_buffer buf;
+
+    for(unsigned int n = 0 ; n < parent->n_result_cols ; n++)
+      if(! strcmp(col_name, parent->result_cols[n]->getColumn()->getName())) {
+        val = parent->result_cols[n];
+        break;
+      }
+    if(! val) {
+      log_err(r->server, "Configuration error at %s: Expand %s uses column %s,"
+              " which is not in the result.", r->uri, exp->relation, col_name);
+      return ndb_handle_error(r, 500, NULL, "Configuration error.\n");
+    }
+    if(val->isNull()) return OK;
+    buf.init(r, 64);
+    val->out(buf, 0);
+    args = add_query_param(r->pool, args, exp->child_params->item(k),
+                           buf.buff, buf.sz);
+  }
+
+  /* The sub-request lookup finds the child's merged configuration, and
+     applies its access controls, but it is never run. */
+  rr = sub_req_lookup_uri(exp->path, r);
+  dir = (config::dir *) ap_get_module_config(rr->per_dir_config, &ndb_module);
+  if(rr->status != HTTP_OK || ! (dir && dir->database && dir->table)) {
+    log_err(r->server, "Configuration error at %s: Expand %s: %s is not an "
+            "NDB endpoint (status %d).", r->uri, exp->relation, exp->path,
+            rr->status);
+    ap_destroy_sub_req(rr);
+    return ndb_handle_error(r, 500, NULL, "Configuration error.\n");
+  }
+
+  /* The merged configuration may live in the sub-request's pool, so copy 
+     it before destroying the sub-request */
+  dir = (config::dir *) memcpy(ap_palloc(r->pool, sizeof(config::dir)), 
+                               dir, sizeof(config::dir));
+  ap_destroy_sub_req(rr);
+
+  log_debug(r->server, "Expanding %s: %s?%s", exp->relation, exp->path, args);
+  response_code = Query(r, dir, i,
+                        * new(r->pool) Expansion_query_source(r, args));
+  if(response_code != OK)
+    return response_code;
+
+  child = i->data + (i->n_read_ops - 1);
+  child->relation = exp->relation;
+#ifdef HAVE_OP_ABORT_OPTION
+  /* A missing child row is not an error */
+  if(! child->scanop)
+    child->op->setAbortOption(NdbOperation::AO_IgnoreError);
+#endif
+  for(link = & parent->child ; *link ; link = & (*link)->sibling);
+  *link = child;
+  return OK;
+}
+
+
+/* expand_all():
+   Called from ExecuteAll() once the parent rows have been read (but not yet
+   committed).  Adds the reads of all the nested resources named in each
+   "?expand=" to the same transaction, which then commits them all in one
+   more round trip.  Returns OK, or an error code; if the transaction was
+   aborted, i->tx is 0.
+*/
+int expand_all(request_rec *r, ndb_instance *i) {
+  int n_parents = i->n_read_ops;
+  int response_code = OK;
+
+  i->flag.expanding = 1;
+  for(int n = 0 ; n < n_parents && response_code == OK ; n++) {
+    data_operation *parent = i->data + n;
+    const char *list = parent->expand;
+    char *name;
+
+    if(! list) continue;
+    while(response_code == OK && *list &&
+          (name = ap_getword(r->pool, &list, ',')))
+      response_code = expand_one(r, i, parent,
+                                 find_expansion(parent->endpoint, name));
+  }
+  i->flag.expanding = 0;
+  return response_code;
+}
+
+
 /* Based on Kernighan's C binsearch from TPOP pg. 31
 */
 short key_col_bin_search(char *name, config::dir *dir) {
@@ -705,3 +1702,86 @@ short key_col_bin_search(char *name, config::dir *dir) {
   return -1;
 }
 
+
+/* pk_hint() builds a transaction hint for a primary key lookup, from the
+   parts of the key that make up the table's distribution key, so that the
+   transaction can start on the data node that holds the row.
+   Returns 0 if a hint cannot be built.
+*/
+Ndb::Key_part_ptr *pk_hint(request_rec *r, config::dir *dir, 
+                           struct QueryItems *q) {
+  int n_parts = q->tab->getNoOfPrimaryKeys();
+  int n_dist = 0;
+  Ndb::Key_part_ptr *hint;
+  short col;
+  
+  if(q->active_index < 0) return 0;
+  hint = (Ndb::Key_part_ptr *) 
+    ap_pcalloc(r->pool, (n_parts + 1) * sizeof(Ndb::Key_part_ptr));
+  col = dir->indexes->item(q->active_index).first_col;
+  
+  for(int n = 0 ; n < n_parts ; n++) {
+    if(col < 0 || ! q->keys[col].value) return 0;
+    const NdbDictionary::Column *ndb_col = 
+      q->tab->getColumn(q->tab->getPrimaryKey(n));
+    if(ndb_col->getPartitionKey()) {
+      mvalue *mval = (mvalue *) ap_pcalloc(r->pool, sizeof(mvalue));
+      MySQL::value(*mval, r->pool, ndb_col, q->keys[col].value);
+      if(mval->use_value < use_char || mval->use_value > use_double) 
+        return 0;
+      if(mval->use_value == use_char) {
+        hint[n_dist].ptr = mval->u.val_char;
+        hint[n_dist].len = mval->col_len;
+      }
+      else {
+        hint[n_dist].ptr = & mval->u;
+        hint[n_dist].len = ndb_col->getSizeInBytes();
+      }
+      n_dist++;
+    }
+    col = dir->key_columns->item(col).next_in_key;
+  }
+  hint[n_dist].ptr = 0;  /* the list is null-terminated */ 
+  
+  return n_dist ? hint : 0;
+}
+
+
+/* read_group_tx() returns the transaction for a read in a batch of 
+   subrequests.  Reads from the same table share one group; a new table 
+   starts a new group, until the server's max_parallel_tx limit is reached.
+   After that, or if a group cannot be started, reads go into the main 
+   transaction.
+*/
+NdbTransaction *read_group_tx(request_rec *r, config::dir *dir, 
+                              struct QueryItems *q) {
+  ndb_instance *i = q->i;
+  Ndb::Key_part_ptr *hint = 0;
+  NdbTransaction *tx;
+  
+  for(int n = 0 ; n < i->n_groups ; n++)
+    if(i->groups[n].tab == q->tab) 
+      return i->groups[n].tx;
+  
+  /* The main transaction counts against the limit */
+  if(i->n_groups >= i->server_config->max_parallel_tx - 1) 
+    return i->tx;
+
+  if(q->plan == PrimaryKey) 
+    hint = pk_hint(r, dir, q);
+  tx = hint ? i->db->startTransaction(q->tab, hint) 
+            : i->db->startTransaction(q->tab);
+  if(! tx) {
+    log_debug(r->server, "Cannot start read group for %s: %s", 
+              dir->table, i->db->getNdbError().message);
+    return i->tx;
+  }
+  
+  log_debug(r->server, "Started read group %d for table %s%s", i->n_groups,
+            dir->table, hint ? " (with key hint)" : "");
+  i->groups[i->n_groups].tab = q->tab;
+  i->groups[i->n_groups].tx = tx;
+  i->n_groups++;
+
+  return tx;
+}
@@ -18,4 +18,20 @@ INSERT INTO ses0 VALUES
  (3,'last_page_visited','index.php'),
  (3,'time_zone','GMT-0400');
 
+/* "ExpireOn" tests: session 1 has expired, and session 3 never expires */
+DROP TABLE IF EXISTS ses1;
+
+CREATE TABLE ses1 (
+  `sess_id` bigint(20) unsigned NOT NULL,
+  `user_name` varchar(20) default NULL,
+  `expires` int unsigned default NULL,
+  PRIMARY KEY (`sess_id`),
+  INDEX (`expires`)
+) ENGINE=ndbcluster DEFAULT CHARSET=latin1;
+
+INSERT INTO ses1 VALUES
+ (1,'jdd',1),
+ (2,'tk',2000000000),
+ (3,'brian',NULL);
+
 
@@ -22,7 +22,8 @@ BEGIN { if(!host) host = "localhost:3080"
      sub(/#.*/, "")  # strip comments
 
      flag_SQL = flag_JR = 0  
-     filter = args = sorter = ""
+     filter = args = sorter = hexer = ""
+     parallel = 0
      
      # Get the flags
      split($2, flags, "|")
@@ -31,6 +32,9 @@ BEGIN { if(!host) host = "localhost:3080"
        else if(flags[i] == "JR") flag_JR = 1
        else if(flags[i] ~ /^f/) filter = "sed -f " flags[i] ".sed"
        else if(flags[i] == "sort") sorter = "| sort -t: -k1n"
+       else if(flags[i] == "hex") 
+         hexer = "| perl -0777 -pe 's/(\\r\\n\\r\\n)(.+)/$1 . unpack(\"H*\", $2) . \"\\n\"/se'"
+       else if(flags[i] == "par") parallel = 32
      }
   
      if(mode == "sql" && flag_SQL) {
@@ -73,9 +77,14 @@ BEGIN { if(!host) host = "localhost:3080"
      if(flag_JR) args = args " -H 'Content-Type: application/jsonrequest' "
 
      cmd = sprintf("curl -isS %s '%s/ndb/test/%s'", args, server, $3)
+     if(parallel) {   # identical requests at once; record just the status
+       cmd = sprintf("curl -sS -Z -w '%%{http_code}\\n' %s", args)
+       for(i = 0; i < parallel; i++) 
+         cmd = cmd sprintf(" -o /dev/null '%s/ndb/test/%s'", server, $3)
+     }
 
      printf("%s '==== %s '\n", echo, $1)
-     printf("%s | %s %s %s \n", cmd, filter, sorter, outfile)
+     printf("%s | %s %s %s %s \n", cmd, filter, hexer, sorter, outfile)
 
      if((diff || mode == "compare") && ! have_source[prefix]) {
        print "source " archive_file
@@ -0,0 +1,431 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "mod_ndb.h"
+#include "ndb_api_compat.h"
+#include "binary_format.h"
+
+/* The Arrow IPC stream format ("Format Arrow").
+   A stream is a Schema message, a RecordBatch message for each batch of
+   rows, and an end-of-stream marker.  Each message is its metadata -- a
+   flatbuffer, as in Arrow's Message.fbs and Schema.fbs -- followed by a
+   body that holds the buffers of the columns: a validity bitmap, then
+   either the fixed-width values, or the offsets and the bytes of
+   variable-length values.  All of it is little-endian.
+
+   A scan writes one record batch from the rows of each batch that
+   nextResult() fetches from the data nodes.  When the operation has
+   flag.stream_rows, each record batch is sent to the client as soon as
+   it is written, so that a long scan is never held in memory.  A lookup
+   is a stream with a single record batch.  Joined tables are not part of
+   an Arrow page.
+*/
+
+#define ARROW_CONTINUATION  0xFFFFFFFF
+#define ARROW_V5            4     /* MetadataVersion */
+
+enum { header_Schema = 1, header_RecordBatch = 3 };  /* MessageHeader */
+
+static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+
+inline void put_le(unsigned char *b, Uint64 v, int n) {
+  for(int i = 0 ; i < n ; i++, v >>= 8) b[i] = (unsigned char) v;
+}
+
+
+/* A flatbuffer is written here from front to back.  Since the offsets in
+   a flatbuffer are unsigned, every object follows the object that refers
+   to it: a slot for the offset is written first, and linked to its
+   target once the target has been written.  The vtable of a table is
+   written just before the table.
+*/
+struct fb_field {
+  int size;                   /* 0 if the field is absent */
+  Uint64 value;               /* an offset is linked later */
+};
+
+class flatbuffer {
+  unsigned char *buf;
+  size_t pos;
+
+public:
+  flatbuffer(unsigned char *b) : buf(b) , pos(0) {}
+  size_t size() const { return pos; }
+
+  void align(size_t n) {
+    while(pos % n) buf[pos++] = 0;
+  }
+  void put(Uint64 v, int n) {
+    put_le(buf + pos, v, n);
+    pos += n;
+  }
+  size_t slot() {
+    align(4);
+    put(0, 4);
+    return pos - 4;
+  }
+  void link(size_t slot, size_t target) {
+    put_le(buf + slot, target - slot, 4);
+  }
+  size_t table(const fb_field *fields, int n, size_t *at);
+  size_t vector(Uint32 n, size_t element_align);
+  size_t string(size_t len, const char *s);
+};
+
+
+/* table(): returns the position of the table, and the position of each
+   field in "at".  The fields are laid out largest first, each aligned to
+   its size, and the table itself is 8-aligned.
+*/
+size_t flatbuffer::table(const fb_field *fields, int n, size_t *at) {
+  size_t offsets[8];
+  size_t table_size = 4;      /* the soffset to the vtable */
+  size_t vtable, start;
+  int i, size;
+
+  for(size = 8 ; size > 0 ; size /= 2)
+    for(i = 0 ; i < n ; i++)
+      if(fields[i].size == size) {
+        offsets[i] = (table_size + size - 1) / size * size;
+        table_size = offsets[i] + size;
+      }
+
+  align(2);
+  vtable = pos;
+  put(4 + 2 * n, 2);
+  put(table_size, 2);
+  for(i = 0 ; i < n ; i++) put(fields[i].size ? offsets[i] : 0, 2);
+
+  align(8);
+  start = pos;
+  put(start - vtable, 4);
+  memset(buf + pos, 0, table_size - 4);
+  pos = start + table_size;
+  for(i = 0 ; i < n ; i++)
+    if(fields[i].size) {
+      at[i] = start + offsets[i];
+      put_le(buf + at[i], fields[i].value, fields[i].size);
+    }
+  return start;
+}
+
+
+/* vector(): write the length of a vector, so that its elements -- which
+   the caller writes next -- are aligned.  Returns the vector's position.
+*/
+size_t flatbuffer::vector(Uint32 n, size_t element_align) {
+  align(4);
+  while((pos + 4) % element_align) put(0, 4);
+  put(n, 4);
+  return pos - 4;
+}
+
+
+size_t flatbuffer::string(size_t len, const char *s) {
+  size_t start;
+
+  align(4);
+  start = pos;
+  put(len, 4);
+  memcpy(buf + pos, s, len);
+  pos += len;
+  buf[pos++] = 0;
+  return start;
+}
+
+
+/* message(): a Message table, with the root offset that precedes it.
+   Returns the position of the header's slot.
+*/
+inline size_t message(flatbuffer &fb, int header_type, Uint64 body_length) {
+  fb_field fields[4] = {
+    { 2, ARROW_V5 }, { 1, (Uint64) header_type }, { 4, 0 }, { 8, body_length }
+  };
+  size_t at[4];
+  size_t root = fb.slot();
+
+  fb.link(root, fb.table(fields, 4, at));
+  return at[2];
+}
+
+
+/* frame(): finish a message whose metadata was built at m + 8.  The
+   continuation marker and the length come first, and the metadata is
+   padded so that the body after it starts on an 8-byte boundary.
+*/
+inline void frame(result_buffer &res, unsigned char *m, flatbuffer &fb) {
+  fb.align(8);
+  put_le(m, ARROW_CONTINUATION, 4);
+  put_le(m + 4, fb.size(), 4);
+  res.sz += 8 + fb.size();
+}
+
+
+/**** The schema ****/
+
+size_t write_type(flatbuffer &fb, const arrow_type &t) {
+  size_t at[2];
+
+  switch(t.id) {
+    case arrow_Int: {
+      fb_field fields[2] = { { 4, (Uint64) t.bit_width }, { 1, t.is_signed } };
+      return fb.table(fields, 2, at);
+    }
+    case arrow_FloatingPoint: {
+      fb_field fields[1] = { { 2, (Uint64) t.precision } };
+      return fb.table(fields, 1, at);
+    }
+    default:                  /* Utf8 and Binary tables have no fields */
+      return fb.table(0, 0, at);
+  }
+}
+
+
+void write_schema(result_buffer &res, arrow_column *cols, unsigned int n) {
+  size_t bound = 128;
+  size_t header, vector, at[6];
+  unsigned int i;
+
+  for(i = 0 ; i < n ; i++) bound += 128 + cols[i].name->len;
+  if(! res.prepare(bound)) return;
+  unsigned char *m = binary_at(res);
+  flatbuffer fb(m + 8);
+
+  /* Message, then Schema { fields } */
+  header = message(fb, header_Schema, 0);
+  {
+    fb_field fields[2] = { { 0, 0 }, { 4, 0 } };
+    fb.link(header, fb.table(fields, 2, at));
+  }
+  vector = fb.vector(n, 4);
+  fb.link(at[1], vector);
+  for(i = 0 ; i < n ; i++) fb.slot();
+
+  /* Field { name, nullable, type_type, type, dictionary, children } */
+  for(i = 0 ; i < n ; i++) {
+    fb_field fields[6] = {
+      { 4, 0 }, { 1, 1 }, { 1, (Uint64) cols[i].type.id }, 
+      { 4, 0 }, { 0, 0 }, { 4, 0 }
+    };
+    fb.link(vector + 4 + 4 * i, fb.table(fields, 6, at));
+    fb.link(at[0], fb.string(cols[i].name->len, cols[i].name->string));
+    fb.link(at[3], write_type(fb, cols[i].type));
+    fb.link(at[5], fb.vector(0, 4));
+  }
+  frame(res, m, fb);
+}
+
+
+/**** Record batches ****/
+
+inline size_t padded(size_t len) {
+  return (len + 7) & ~ (size_t) 7;
+}
+
+
+inline void end_value(arrow_column &a) {
+  Int32 end = (Int32) a.data.sz;
+  a.values.out(4, (const char *) &end);
+}
+
+
+void start_batch(arrow_column *cols, unsigned int n) {
+  for(unsigned int i = 0 ; i < n ; i++) {
+    cols[i].validity.sz = 0;
+    cols[i].values.sz = 0;
+    cols[i].data.sz = 0;
+    cols[i].null_count = 0;
+    if(! cols[i].type.width) end_value(cols[i]);   /* the first offset */
+  }
+}
+
+
+void add_row(arrow_column *cols, unsigned int n, unsigned int row) {
+  for(unsigned int i = 0 ; i < n ; i++) {
+    arrow_column &a = cols[i];
+
+    if(row % 8 == 0) {
+      if(! a.validity.prepare(1)) return;
+      a.validity.putc(0);
+    }
+    if(a.result->isNull()) {
+      a.null_count++;
+      if(a.type.width) a.values.out(a.type.width, zeros);
+      else end_value(a);
+    }
+    else {
+      a.validity.buff[a.validity.sz - 1] |= (1 << (row % 8));
+      a.append(*a.result, a);
+    }
+  }
+}
+
+
+inline void body_buffer(flatbuffer &fb, size_t &offset, size_t len) {
+  fb.put(offset, 8);
+  fb.put(len, 8);
+  offset += padded(len);
+}
+
+
+inline void write_body(result_buffer &res, result_buffer &buffer) {
+  res.out(buffer.sz, buffer.buff);
+  res.out(padded(buffer.sz) - buffer.sz, zeros);
+}
+
+
+void write_batch(result_buffer &res, arrow_column *cols, unsigned int n,
+                 unsigned int rows) {
+  size_t header, body_length = 0, offset = 0, at[3];
+  unsigned int i, n_buffers = 0;
+
+  for(i = 0 ; i < n ; i++) {
+    body_length += padded(cols[i].validity.sz) + padded(cols[i].values.sz);
+    n_buffers += 2;
+    if(! cols[i].type.width) {
+      body_length += padded(cols[i].data.sz);
+      n_buffers++;
+    }
+  }
+  if(! res.prepare(128 + 16 * (n + n_buffers))) return;
+  unsigned char *m = binary_at(res);
+  flatbuffer fb(m + 8);
+
+  /* Message, then RecordBatch { length, nodes, buffers } */
+  header = message(fb, header_RecordBatch, body_length);
+  {
+    fb_field fields[3] = { { 8, rows }, { 4, 0 }, { 4, 0 } };
+    fb.link(header, fb.table(fields, 3, at));
+  }
+  fb.link(at[1], fb.vector(n, 8));
+  for(i = 0 ; i < n ; i++) {          /* FieldNode { length, null_count } */
+    fb.put(rows, 8);
+    fb.put(cols[i].null_count, 8);
+  }
+  fb.link(at[2], fb.vector(n_buffers, 8));
+  for(i = 0 ; i < n ; i++) {          /* Buffer { offset, length } */
+    body_buffer(fb, offset, cols[i].validity.sz);
+    body_buffer(fb, offset, cols[i].values.sz);
+    if(! cols[i].type.width) body_buffer(fb, offset, cols[i].data.sz);
+  }
+  frame(res, m, fb);
+
+  for(i = 0 ; i < n ; i++) {
+    write_body(res, cols[i].validity);
+    write_body(res, cols[i].values);
+    if(! cols[i].type.width) write_body(res, cols[i].data);
+  }
+}
+
+
+/**** Rows ****/
+
+enum { got_row, batch_done, scan_done };
+
+/* next_result(): nextResult(true) fetches a new batch of rows from the
+   data nodes; nextResult(false) returns the next row of the current batch
+   or reports that the batch is done.
+*/
+inline int next_result(data_operation *data, bool fetch) {
+#ifdef HAVE_NDB_SPJ
+  if(data->query)
+    switch(data->query->nextResult(fetch)) {
+      case NdbQuery::NextResult_gotRow:
+        return got_row;
+      case NdbQuery::NextResult_bufferEmpty:
+        return batch_done;
+      default:
+        return scan_done;
+    }
+#endif
+  switch(data->scanop->nextResult(fetch)) {
+    case 0:
+      return got_row;
+    case 2:
+      return batch_done;
+    default:
+      return scan_done;
+  }
+}
+
+
+/* write_arrow(): the page writer of the Arrow format.  Returns 404 if a
+   scan found no rows, before anything is sent.
+*/
+int write_arrow(request_rec *r, data_operation *data, result_buffer &res) {
+  block_pool *blocks = & my_instance(r)->blocks;
+  bool is_scan = data->scanop || data->flag.is_scan;
+  bool stream = data->flag.stream_rows;
+  unsigned int n = data->n_result_cols;
+  unsigned int rows;
+  arrow_column *cols;
+  int row = got_row;
+
+  if(data->scanop || data->query) row = next_result(data, true);
+  if(row != got_row) return 404;
+  if(stream) {
+    ap_send_http_header(r);
+    if(r->header_only) return OK;
+  }
+
+  cols = new arrow_column[n];
+  for(unsigned int i = 0 ; i < n ; i++) {
+    arrow_column &a = cols[i];
+    a.result = data->columns[i].result;
+    a.name = & data->columns[i].name;
+    a.append = MySQL::result::choose_appender(a.result->getColumn()->getType(),
+                                              a.type);
+    a.validity.init(r, ARROW_COLUMN_BUFFER, blocks);
+    a.values.init(r, ARROW_COLUMN_BUFFER, blocks);
+    if(! a.type.width) a.data.init(r, ARROW_COLUMN_BUFFER, blocks);
+  }
+  write_schema(res, cols, n);
+
+  do {
+    start_batch(cols, n);
+    rows = 0;
+    do add_row(cols, n, rows++);
+    while(is_scan && (row = next_result(data, false)) == got_row);
+    write_batch(res, cols, n, rows);
+    if(stream) {
+      res.send(r);
+      res.init(r, blocks);
+    }
+  } while(is_scan && row == batch_done
+          && (row = next_result(data, true)) == got_row);
+
+  /* The end of the stream */
+  res.out(4, "\xFF\xFF\xFF\xFF");
+  res.out(4, zeros);
+  if(stream) res.send(r);
+  delete[] cols;
+  return OK;
+}
+
+
+void write_name_key(ap_pool *, const char *name, len_string &key) {
+  key.string = name;
+  key.len = strlen(name);
+}
+
+
+const struct binary_syntax arrow_syntax = {
+  syntax_arrow, "application/vnd.apache.arrow.stream",
+  write_name_key, write_arrow
+};
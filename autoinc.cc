@@ -0,0 +1,365 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "mod_ndb.h"
+#include "ndb_api_compat.h"
+
+extern struct mod_ndb_process process;      /* from mod_ndb.cc */
+
+/* Auto-increment values ("@autoinc").
+   Left to itself, every Ndb object keeps its own small cache of values
+   for each table, so a process with many threads goes back to the cluster
+   often, and holds many partly-used ranges.  Instead, all of the threads
+   in a process share one range of values per table, and take values from
+   it with an atomic increment.
+
+   Each table has two ranges: the one in use, and a spare.  When the range
+   in use runs out, the spare takes its place, and a refill thread (with
+   its own Ndb object) reserves a new spare from the cluster -- so a request
+   thread only has to wait for the cluster if the refill thread has fallen
+   behind.  The size of each new range follows the rate at which the last
+   one was used, so that a range lasts about AUTOINC_TARGET_MS, within
+   the limits set by "ndb-autoinc-range min max".
+
+   A range that has been used up is "closed" by setting its count of values
+   taken to RANGE_CLOSED, which is larger than any range.  A thread that was
+   about to take a value from it as it was refilled sees that its generation
+   number has changed, and tries again.
+
+   Without threads (Apache 1.3), or with the older auto-increment API, each
+   Ndb object keeps its own cache, with "min" values reserved at a time.
+*/
+
+static int min_range = DEFAULT_AUTOINC_MIN_RANGE;
+static int max_range = DEFAULT_AUTOINC_MAX_RANGE;
+
+#if defined(THIS_IS_APACHE2) && defined(HAVE_AUTOINC_RANGE)
+
+#include "apr_atomic.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_cond.h"
+
+#define RANGE_CLOSED 0x80000000U
+
+struct autoinc_range {
+  volatile Uint64 base;
+  volatile apr_uint32_t size;
+  volatile apr_uint32_t taken;    /* values handed out */
+  volatile apr_uint32_t gen;      /* counts refills */
+};
+
+struct autoinc_table {
+  struct autoinc_table *next;
+  int table_id;
+  int table_version;
+  char *database;
+  char *table;
+  struct autoinc_range range[2];
+  volatile apr_uint32_t current;  /* range[current] is in use */
+  bool spare_ready;               /* range[1 - current] has been filled */
+  bool is_stale;                  /* the table has been altered or dropped */
+  Uint32 range_size;              /* size of the next range */
+  apr_time_t last_swap;
+  unsigned long refills;          /* by the refill thread */
+  unsigned long waits;            /* by a request thread */
+  unsigned long errors;
+};
+
+/* Tables are added at the head of the list, and never removed until the
+   process exits, so the list can be read without a lock.  Everything else
+   that changes -- except the ranges themselves -- is protected by
+   autoinc_lock.
+*/
+static struct autoinc_table * volatile tables = 0;
+static apr_thread_mutex_t *autoinc_lock = 0;
+static apr_thread_cond_t *refill_wanted;
+static apr_thread_t *refill_thread = 0;
+static volatile int refiller_must_stop = 0;
+
+
+/* take_value(): the lock-free part.
+   Returns false if the range has been used up, or refilled meanwhile.
+*/
+inline bool take_value(struct autoinc_range *rng, Uint64 &value) {
+  apr_uint32_t gen = apr_atomic_read32(& rng->gen);
+  Uint64 base = rng->base;
+  apr_uint32_t size = apr_atomic_read32(& rng->size);
+  apr_uint32_t n = apr_atomic_inc32(& rng->taken);
+
+  if(n < size && apr_atomic_read32(& rng->gen) == gen) {
+    value = base + n;
+    return true;
+  }
+  return false;
+}
+
+
+/* Refill a closed range.  The caller holds autoinc_lock.
+*/
+inline void fill_range(struct autoinc_range *rng, Uint64 first, Uint32 count) {
+  rng->base = first;
+  apr_atomic_set32(& rng->size, count);
+  apr_atomic_inc32(& rng->gen);
+  apr_atomic_set32(& rng->taken, 0);
+}
+
+
+/* swap_ranges():
+   Put the spare range into use, close the one that has been used up, and
+   size the next one by the rate at which values were taken from the last.
+   The caller holds autoinc_lock.
+*/
+void swap_ranges(struct autoinc_table *t) {
+  apr_uint32_t c = t->current;
+  apr_time_t now = apr_time_now();
+
+  apr_atomic_set32(& t->current, 1 - c);
+  apr_atomic_set32(& t->range[c].taken, RANGE_CLOSED);
+  t->spare_ready = false;
+
+  if(t->last_swap) {
+    Uint64 ms = (now - t->last_swap) / 1000;
+    Uint64 size = (Uint64) t->range[c].size * AUTOINC_TARGET_MS / (ms ? ms : 1);
+    if(size > 4 * (Uint64) t->range_size) size = 4 * (Uint64) t->range_size;
+    if(size > (Uint64) max_range) size = max_range;
+    if(size < (Uint64) min_range) size = min_range;
+    t->range_size = (Uint32) size;
+  }
+  t->last_swap = now;
+  apr_thread_cond_signal(refill_wanted);
+}
+
+
+/* find_table():
+   Find a table's ranges, or add them (empty) to the list.
+*/
+struct autoinc_table *find_table(Ndb *db, const NdbDictionary::Table *tab) {
+  struct autoinc_table *t;
+  int id = tab->getTableId();
+  int version = tab->getObjectVersion();
+
+  for(t = tables ; t ; t = t->next)
+    if(t->table_id == id && t->table_version == version) return t;
+
+  apr_thread_mutex_lock(autoinc_lock);
+  for(t = tables ; t ; t = t->next)   /* look again, holding the lock */
+    if(t->table_id == id && t->table_version == version) break;
+  if(! t && (t = (struct autoinc_table *)
+                 calloc(1, sizeof(struct autoinc_table))) != 0) {
+    t->table_id = id;
+    t->table_version = version;
+    t->database = strdup(db->getDatabaseName());
+    t->table = strdup(tab->getName());
+    t->range[0].taken = t->range[1].taken = RANGE_CLOSED;
+    t->range_size = min_range;
+    t->next = tables;
+    apr_atomic_casptr((volatile void **) & tables, t, t->next);
+  }
+  apr_thread_mutex_unlock(autoinc_lock);
+  return t;
+}
+
+
+/* next_auto_inc():
+   Get the next auto-increment value for a table, in a request thread.
+*/
+int next_auto_inc(ndb_instance *i, const NdbDictionary::Table *tab,
+                  Uint64 &value) {
+  struct autoinc_table *t;
+  apr_uint32_t c;
+  Uint64 first;
+  Uint32 count;
+
+  if(! (autoinc_lock && (t = find_table(i->db, tab))))
+    return get_auto_inc_value(i->db, tab, value, min_range);
+
+  for(;;) {
+    c = apr_atomic_read32(& t->current);
+    if(take_value(t->range + c, value)) return 0;
+
+    apr_thread_mutex_lock(autoinc_lock);
+    if(apr_atomic_read32(& t->current) == c) {
+      if(! t->spare_ready) {
+        /* The refill thread has not kept up; reserve the range here */
+        count = t->range_size;
+        if(get_auto_inc_range(i->db, tab, first, count)) {
+          t->errors++;
+          apr_thread_mutex_unlock(autoinc_lock);
+          return -1;
+        }
+        fill_range(t->range + (1 - c), first, count);
+        t->waits++;
+      }
+      swap_ranges(t);
+    }
+    apr_thread_mutex_unlock(autoinc_lock);
+  }
+}
+
+
+/* reserve_range():
+   Reserve a new spare range, in the refill thread.
+*/
+bool reserve_range(server_rec *s, Ndb *db, struct autoinc_table *t,
+                   Uint64 &first, Uint32 &count) {
+  NdbDictionary::Dictionary *dict;
+  const NdbDictionary::Table *tab;
+
+  db->setDatabaseName(t->database);
+  dict = db->getDictionary();
+  tab = dict->getTable(t->table);
+  if(tab && tab->getObjectVersion() != t->table_version) {
+    dict->invalidateTable(t->table);    /* perhaps an old cached copy */
+    tab = dict->getTable(t->table);
+  }
+  if(! tab || tab->getObjectVersion() != t->table_version) {
+    t->is_stale = true;
+    return false;
+  }
+  if(get_auto_inc_range(db, tab, first, count)) {
+    if(db->getNdbError().status != NdbError::TemporaryError)
+      log_err(s, "Cannot reserve auto-increment values for %s.%s: [%d] %s",
+              t->database, t->table, db->getNdbError().code,
+              db->getNdbError().message);
+    t->errors++;
+    return false;
+  }
+  return true;
+}
+
+
+void * APR_THREAD_FUNC autoinc_refiller(apr_thread_t *thd, void *v) {
+  server_rec *s = (server_rec *) v;
+  struct autoinc_table *t;
+  Ndb *db = new Ndb(process.conn.connection);
+  Uint64 first;
+  Uint32 count;
+  bool ok;
+  int filled;
+
+  if(db->init(1) == -1) {
+    log_err(s, "Auto-increment refill thread: Ndb::init() failed: %s",
+            db->getNdbError().message);
+    delete db;
+    apr_thread_exit(thd, APR_SUCCESS);
+    return 0;
+  }
+
+  apr_thread_mutex_lock(autoinc_lock);
+  while(! refiller_must_stop) {
+    filled = 0;
+    for(t = tables ; t && ! refiller_must_stop ; t = t->next) {
+      if(t->spare_ready || t->is_stale) continue;
+      count = t->range_size;
+      apr_thread_mutex_unlock(autoinc_lock);
+      ok = reserve_range(s, db, t, first, count);
+      apr_thread_mutex_lock(autoinc_lock);
+      /* A request thread may have filled the spare meanwhile, in which
+         case these values are never used. */
+      if(ok && ! t->spare_ready) {
+        fill_range(t->range + (1 - t->current), first, count);
+        t->spare_ready = true;
+        t->refills++;
+        filled++;
+      }
+    }
+    if(! filled)
+      apr_thread_cond_timedwait(refill_wanted, autoinc_lock, 1000000);
+  }
+  apr_thread_mutex_unlock(autoinc_lock);
+
+  delete db;
+  apr_thread_exit(thd, APR_SUCCESS);
+  return 0;
+}
+
+
+/* start_autoinc_refiller() is called from child_init.
+*/
+void start_autoinc_refiller(server_rec *s, ap_pool *p) {
+  config::srv *srv = (config::srv *)
+    ap_get_module_config(s->module_config, &ndb_module);
+
+  min_range = srv->autoinc_min_range;
+  max_range = srv->autoinc_max_range;
+  apr_thread_mutex_create(& autoinc_lock, APR_THREAD_MUTEX_DEFAULT, p);
+  apr_thread_cond_create(& refill_wanted, p);
+
+  if(! process.conn.connected) return;
+  if(apr_thread_create(& refill_thread, NULL, autoinc_refiller, s, p)
+     != APR_SUCCESS) {
+    log_err(s, "Cannot start the auto-increment refill thread; "
+               "ranges will be reserved in the request thread.");
+    refill_thread = 0;
+  }
+}
+
+
+/* stop_autoinc_refiller() is called from child_exit,
+   before the cluster connection is deleted.
+*/
+void stop_autoinc_refiller() {
+  apr_status_t thread_status;
+
+  if(! refill_thread) return;
+  apr_thread_mutex_lock(autoinc_lock);
+  refiller_must_stop = 1;
+  apr_thread_cond_signal(refill_wanted);
+  apr_thread_mutex_unlock(autoinc_lock);
+  apr_thread_join(& thread_status, refill_thread);
+  refill_thread = 0;
+}
+
+
+/* autoinc_status():
+   Part of the page written by the ndb-status handler.
+*/
+void autoinc_status(request_rec *r) {
+  struct autoinc_table *t;
+
+  if(! tables) return;
+  ap_rprintf(r, "\n");
+  ap_rprintf(r, "Auto-increment ranges (%d to %d values):\n",
+             min_range, max_range);
+  for(t = tables ; t ; t = t->next)
+    ap_rprintf(r, "  .. Table: %s.%s , Next range: %u , Refills: %lu , "
+               "Waits: %lu , Errors: %lu%s\n", t->database, t->table,
+               (unsigned int) t->range_size, t->refills, t->waits, t->errors,
+               t->is_stale ? " (STALE)" : "");
+}
+
+#else
+
+int next_auto_inc(ndb_instance *i, const NdbDictionary::Table *tab,
+                  Uint64 &value) {
+  return get_auto_inc_value(i->db, tab, value, min_range);
+}
+
+void start_autoinc_refiller(server_rec *s, ap_pool *p) {
+  config::srv *srv = (config::srv *)
+    ap_get_module_config(s->module_config, &ndb_module);
+
+  min_range = srv->autoinc_min_range;
+  max_range = srv->autoinc_max_range;
+}
+
+void stop_autoinc_refiller() { }
+
+void autoinc_status(request_rec *r) { }
+
+#endif
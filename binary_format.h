@@ -0,0 +1,236 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA 
+*/
+
+#ifndef _BINARY_FORMAT_H
+#define _BINARY_FORMAT_H
+
+/* The binary output formats, MessagePack and CBOR (RFC 7049).
+   Each syntax is a set of functions that write one item header (or a
+   whole small item) at b, and return the number of bytes written, which
+   is never more than MAX_BINARY_HEAD.  The put_ templates below write
+   them into a result_buffer.
+
+   A row count is not known until a scan ends.  MessagePack writes an
+   array32 header with a zero count and patches it in close_array(); CBOR
+   writes an indefinite-length array, and close_array() ends it.  A value
+   written in text (a date or a decimal) gets a string header with a 
+   1-byte length at b[1], which is filled in when the text is written. 
+   Either way the bytes to patch must not move, which holds for a 
+   segmented result_buffer.
+*/
+
+#define MAX_BINARY_HEAD 9
+
+inline int put_be(unsigned char *b, unsigned long long v, int n) {
+  for(int i = n - 1 ; i >= 0 ; i--, v >>= 8) b[i] = (unsigned char) v;
+  return n;
+}
+
+
+struct MessagePack {
+  static int nil(unsigned char *b) { *b = 0xc0; return 1; }
+  static int uinteger(unsigned char *b, unsigned long long v) {
+    if(v < 128)          { *b = (unsigned char) v; return 1; }
+    if(v < 0x100)        { *b = 0xcc; return 1 + put_be(b + 1, v, 1); }
+    if(v < 0x10000)      { *b = 0xcd; return 1 + put_be(b + 1, v, 2); }
+    if(v < 0x100000000ULL) { *b = 0xce; return 1 + put_be(b + 1, v, 4); }
+    *b = 0xcf; return 1 + put_be(b + 1, v, 8);
+  }
+  static int integer(unsigned char *b, long long v) {
+    if(v >= 0)           return uinteger(b, v);
+    if(v >= -32)         { *b = (unsigned char) v; return 1; }
+    if(v >= -128)        { *b = 0xd0; return 1 + put_be(b + 1, v, 1); }
+    if(v >= -32768)      { *b = 0xd1; return 1 + put_be(b + 1, v, 2); }
+    if(v >= -2147483648LL) { *b = 0xd2; return 1 + put_be(b + 1, v, 4); }
+    *b = 0xd3; return 1 + put_be(b + 1, v, 8);
+  }
+  static int float32(unsigned char *b, float f) {
+    unsigned int u;
+    memcpy(&u, &f, 4);
+    *b = 0xca; return 1 + put_be(b + 1, u, 4);
+  }
+  static int float64(unsigned char *b, double d) {
+    unsigned long long u;
+    memcpy(&u, &d, 8);
+    *b = 0xcb; return 1 + put_be(b + 1, u, 8);
+  }
+  static int str_head(unsigned char *b, size_t len) {
+    if(len < 32)         { *b = 0xa0 | len; return 1; }
+    if(len < 0x100)      { *b = 0xd9; return 1 + put_be(b + 1, len, 1); }
+    if(len < 0x10000)    { *b = 0xda; return 1 + put_be(b + 1, len, 2); }
+    *b = 0xdb; return 1 + put_be(b + 1, len, 4);
+  }
+  static int bin_head(unsigned char *b, size_t len) {
+    if(len < 0x100)      { *b = 0xc4; return 1 + put_be(b + 1, len, 1); }
+    if(len < 0x10000)    { *b = 0xc5; return 1 + put_be(b + 1, len, 2); }
+    *b = 0xc6; return 1 + put_be(b + 1, len, 4);
+  }
+  static int str8_head(unsigned char *b) { b[0] = 0xd9; b[1] = 0; return 2; }
+  static int map_head(unsigned char *b, unsigned int n) {
+    if(n < 16)           { *b = 0x80 | n; return 1; }
+    if(n < 0x10000)      { *b = 0xde; return 1 + put_be(b + 1, n, 2); }
+    *b = 0xdf; return 1 + put_be(b + 1, n, 4);
+  }
+  static int array_head(unsigned char *b, unsigned int n) {
+    if(n < 16)           { *b = 0x90 | n; return 1; }
+    if(n < 0x10000)      { *b = 0xdc; return 1 + put_be(b + 1, n, 2); }
+    *b = 0xdd; return 1 + put_be(b + 1, n, 4);
+  }
+  static int open_array(unsigned char *b) { *b = 0xdd; return 1 + put_be(b + 1, 0, 4); }
+  static int close_array(unsigned char *, unsigned char *opened, unsigned int n) {
+    put_be(opened + 1, n, 4);
+    return 0;
+  }
+};
+
+
+struct CBOR {
+  static int head(unsigned char *b, int major, unsigned long long v) {
+    major <<= 5;
+    if(v < 24)           { *b = major | v; return 1; }
+    if(v < 0x100)        { *b = major | 24; return 1 + put_be(b + 1, v, 1); }
+    if(v < 0x10000)      { *b = major | 25; return 1 + put_be(b + 1, v, 2); }
+    if(v < 0x100000000ULL) { *b = major | 26; return 1 + put_be(b + 1, v, 4); }
+    *b = major | 27; return 1 + put_be(b + 1, v, 8);
+  }
+  static int nil(unsigned char *b) { *b = 0xf6; return 1; }
+  static int uinteger(unsigned char *b, unsigned long long v) {
+    return head(b, 0, v);
+  }
+  static int integer(unsigned char *b, long long v) {  /* -1 - v is ~v */
+    return (v >= 0) ? head(b, 0, v) : head(b, 1, ~ (unsigned long long) v);
+  }
+  static int float32(unsigned char *b, float f) {
+    unsigned int u;
+    memcpy(&u, &f, 4);
+    *b = 0xfa; return 1 + put_be(b + 1, u, 4);
+  }
+  static int float64(unsigned char *b, double d) {
+    unsigned long long u;
+    memcpy(&u, &d, 8);
+    *b = 0xfb; return 1 + put_be(b + 1, u, 8);
+  }
+  static int str_head(unsigned char *b, size_t len) { return head(b, 3, len); }
+  static int bin_head(unsigned char *b, size_t len) { return head(b, 2, len); }
+  static int str8_head(unsigned char *b) { b[0] = 0x78; b[1] = 0; return 2; }
+  static int map_head(unsigned char *b, unsigned int n) { return head(b, 5, n); }
+  static int array_head(unsigned char *b, unsigned int n) { return head(b, 4, n); }
+  static int open_array(unsigned char *b) { *b = 0x9f; return 1; }
+  static int close_array(unsigned char *b, unsigned char *, unsigned int) {
+    *b = 0xff; 
+    return 1;
+  }
+};
+
+
+/* Writing into a result_buffer */
+
+inline unsigned char *binary_at(result_buffer &rb) {
+  return (unsigned char *) rb.buff + rb.sz;
+}
+
+template <class S> inline void put_nil(result_buffer &rb) {
+  if(rb.prepare(MAX_BINARY_HEAD)) rb.sz += S::nil(binary_at(rb));
+}
+template <class S> inline void put_int(result_buffer &rb, long long v) {
+  if(rb.prepare(MAX_BINARY_HEAD)) rb.sz += S::integer(binary_at(rb), v);
+}
+template <class S> inline void put_uint(result_buffer &rb, unsigned long long v) {
+  if(rb.prepare(MAX_BINARY_HEAD)) rb.sz += S::uinteger(binary_at(rb), v);
+}
+template <class S> inline void put_float(result_buffer &rb, float f) {
+  if(rb.prepare(MAX_BINARY_HEAD)) rb.sz += S::float32(binary_at(rb), f);
+}
+template <class S> inline void put_double(result_buffer &rb, double d) {
+  if(rb.prepare(MAX_BINARY_HEAD)) rb.sz += S::float64(binary_at(rb), d);
+}
+template <class S> inline void put_map(result_buffer &rb, unsigned int n) {
+  if(rb.prepare(MAX_BINARY_HEAD)) rb.sz += S::map_head(binary_at(rb), n);
+}
+template <class S> inline void put_array(result_buffer &rb, unsigned int n) {
+  if(rb.prepare(MAX_BINARY_HEAD)) rb.sz += S::array_head(binary_at(rb), n);
+}
+template <class S> inline void put_str(result_buffer &rb, size_t len, 
+                                       const char *s) {
+  if(! rb.prepare(MAX_BINARY_HEAD)) return;
+  rb.sz += S::str_head(binary_at(rb), len);
+  rb.out(len, s);
+}
+template <class S> inline void put_bin(result_buffer &rb, size_t len, 
+                                       const char *s) {
+  if(! rb.prepare(MAX_BINARY_HEAD)) return;
+  rb.sz += S::bin_head(binary_at(rb), len);
+  rb.out(len, s);
+}
+
+/* open_array() and open_str8() return the header to patch, or 0 */
+template <class S> inline unsigned char *open_array(result_buffer &rb) {
+  unsigned char *opened;
+
+  if(! rb.prepare(MAX_BINARY_HEAD)) return 0;
+  opened = binary_at(rb);
+  rb.sz += S::open_array(opened);
+  return opened;
+}
+template <class S> inline void close_array(result_buffer &rb, 
+                                           unsigned char *opened,
+                                           unsigned int n) {
+  if(opened && rb.prepare(1)) 
+    rb.sz += S::close_array(binary_at(rb), opened, n);
+}
+template <class S> inline unsigned char *open_str8(result_buffer &rb) {
+  unsigned char *opened;
+
+  if(! rb.prepare(MAX_BINARY_HEAD)) return 0;
+  opened = binary_at(rb);
+  rb.sz += S::str8_head(opened);
+  return opened;
+}
+
+
+/* Apache Arrow (arrow_format.cc) writes columns, not values.  Each column
+   of a record batch collects a validity bitmap, its values (or, for a 
+   string or binary column, int32 offsets), and the bytes of its strings.
+*/
+enum arrow_type_id {          /* in the Type union of Schema.fbs */
+  arrow_Int = 2,
+  arrow_FloatingPoint = 3,
+  arrow_Binary = 4,
+  arrow_Utf8 = 5
+};
+
+struct arrow_type {
+  arrow_type_id id;
+  int bit_width;              /* Int */
+  bool is_signed;             /* Int */
+  short precision;            /* FloatingPoint: 1 = SINGLE, 2 = DOUBLE */
+  size_t width;               /* bytes per value; 0 for Binary and Utf8 */
+};
+
+struct arrow_column {
+  struct arrow_type type;
+  MySQL::appender append;
+  MySQL::result *result;
+  const len_string *name;
+  result_buffer validity;
+  result_buffer values;
+  result_buffer data;
+  unsigned int null_count;
+};
+
+#endif  /* _BINARY_FORMAT_H */
@@ -0,0 +1,147 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <zlib.h>
+#include <ctype.h>
+#include "mod_ndb.h"
+
+/* Compressed BLOB and TEXT columns ("Compress column ...").
+   Plan::Write() compresses each new value with zlib and stores it behind
+   an 8-byte frame: the 4 bytes FRAME_MAGIC, then the uncompressed length
+   (big-endian).  A value without the frame -- one that was stored before
+   the column was compressed, or that zlib could not shrink -- is used as
+   it is.  The frame is checked when the blob is read, and the value is
+   inflated in its result buffer.
+
+   The compressed data is an RFC 1950 zlib stream, which is exactly what
+   HTTP calls the "deflate" content-coding.  So a raw endpoint sends the
+   stored bytes, less the frame, to a client that accepts deflate, and
+   neither side inflates them.
+*/
+
+#define FRAME_SIZE 8
+static const char FRAME_MAGIC[4] = { '\0', 'N', 'Z', '1' };
+
+
+inline bool is_framed(const char *buf, size_t len, uLongf &plain_len) {
+  const unsigned char *b = (const unsigned char *) buf;
+
+  if(len < FRAME_SIZE || memcmp(buf, FRAME_MAGIC, 4)) return false;
+  plain_len = (b[4] << 24) | (b[5] << 16) | (b[6] << 8) | b[7];
+  return true;
+}
+
+
+bool is_compressed_column(config::dir *dir, const char *col) {
+  if(dir->compressed)
+    for(int n = 0 ; n < dir->compressed->size() ; n++)
+      if(! strcmp(col, dir->compressed->item(n))) return true;
+  return false;
+}
+
+
+/* deflate_value():
+   Returns the framed, compressed value, or the original value if that is
+   shorter (but never an unframed value that looks framed).
+*/
+len_string *deflate_value(ap_pool *p, len_string *val) {
+  uLongf out_len = compressBound(val->len);
+  uLongf plain_len;
+  bool looks_framed = is_framed(val->string, val->len, plain_len);
+  unsigned char *buf;
+
+  if(val->len < BLOB_COMPRESS_MIN && ! looks_framed) return val;
+
+  buf = (unsigned char *) ap_palloc(p, FRAME_SIZE + out_len);
+  if(compress2(buf + FRAME_SIZE, &out_len, (const Bytef *) val->string,
+               val->len, BLOB_COMPRESS_LEVEL) != Z_OK)
+    return val;
+  if(FRAME_SIZE + out_len >= val->len && ! looks_framed) return val;
+
+  memcpy(buf, FRAME_MAGIC, 4);
+  buf[4] = (val->len >> 24) & 0xFF;
+  buf[5] = (val->len >> 16) & 0xFF;
+  buf[6] = (val->len >> 8) & 0xFF;
+  buf[7] = val->len & 0xFF;
+  return new(p) len_string(FRAME_SIZE + out_len, (const char *) buf);
+}
+
+
+/* result_buffer::inflate() is defined here so that only this file needs
+   zlib.h.  It replaces a framed value with the uncompressed value.
+*/
+bool result_buffer::inflate() {
+  uLongf plain_len;
+  result_buffer plain;
+
+  if(! is_framed(buff, sz, plain_len)) return true;
+  if(! (pool ? plain.init(0, plain_len + 1, pool) 
+              : plain.init(0, plain_len + 1))) return false;
+  if(uncompress((Bytef *) plain.buff, &plain_len,
+                (const Bytef *) buff + FRAME_SIZE, sz - FRAME_SIZE) != Z_OK)
+    return false;
+  plain.sz = plain_len;
+  overlay(& plain);
+  return true;
+}
+
+
+/* accepts_deflate():
+   Whether Accept-Encoding lists deflate, or else "*", with a q-value 
+   above zero.  "deflate;q=0" refuses deflate.
+*/
+bool accepts_deflate(request_rec *r) {
+  const char *accept = ap_table_get(r->headers_in, "Accept-Encoding");
+  int deflate = -1, star = -1;      /* -1 if not listed */
+  const char *params;
+  char *coding, *param;
+  double q;
+
+  if(! accept) return false;
+  while(*accept && (params = ap_getword(r->pool, &accept, ','))) {
+    coding = ap_getword(r->pool, &params, ';');
+    while(isspace(*coding)) coding++;
+    for(param = coding ; *param && ! isspace(*param) ; param++);
+    *param = 0;
+    q = 1.0;
+    while(*params && (param = ap_getword(r->pool, &params, ';'))) {
+      while(isspace(*param)) param++;
+      if((*param == 'q' || *param == 'Q') && param[1] == '=') 
+        q = atof(param + 2);
+    }
+    if(! strcasecmp(coding, "deflate")) deflate = (q > 0);
+    else if(! strcmp(coding, "*")) star = (q > 0);
+  }
+  return (deflate >= 0) ? deflate : (star > 0);
+}
+
+
+/* send_deflated():
+   Prepare a raw result for a client that accepts deflate.  If the value
+   is compressed, remove its frame and set Content-Encoding.
+*/
+void send_deflated(request_rec *r, result_buffer &res) {
+  uLongf plain_len;
+
+  ap_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
+  if(is_framed(res.buff, res.sz, plain_len)) {
+    res.sz -= FRAME_SIZE;
+    memmove(res.buff, res.buff + FRAME_SIZE, res.sz);
+    ap_table_setn(r->headers_out, "Content-Encoding", "deflate");
+  }
+}
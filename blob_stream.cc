@@ -0,0 +1,171 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <ctype.h>
+#include "mod_ndb.h"
+#include "ndb_api_compat.h"
+
+/* Streamed BLOB reads ("StreamBlobs On", with "Format raw").
+   The raw format normally reads the whole blob into a result_buffer when
+   the transaction commits, and sends that buffer as the page.  A streamed
+   read instead executes the lookup with NoCommit, which leaves the blob
+   handle active, and then reads the blob with readData() a chunk at a
+   time, writing each chunk to the client before reading the next.  Only
+   one chunk is ever held in memory.
+
+   A single byte range in a Range header is honored with a 206 response,
+   and then only the parts of the blob within the range are read.  Since
+   a streamed response has no ETag, a request with If-Range always gets
+   the whole blob, and so does one with several ranges.
+*/
+
+
+/* parse_range():
+   Returns 1 and sets first and last (inclusive) for a usable range,
+   0 if the whole blob should be sent, or -1 if the range is not
+   satisfiable.
+*/
+int parse_range(const char *spec, Uint64 length, Uint64 &first, Uint64 &last) {
+  char *end;
+  Uint64 n;
+
+  if(! spec || strncasecmp(spec, "bytes=", 6)) return 0;
+  spec += 6;
+  if(strchr(spec, ',')) return 0;
+  while(*spec == ' ') spec++;
+
+  if(*spec == '-') {              /* "bytes=-N": the last N bytes */
+    if(! isdigit(spec[1])) return 0;
+    n = strtoull(spec + 1, &end, 10);
+    if(n == 0) return -1;
+    first = (n < length) ? length - n : 0;
+    last = length - 1;
+    return 1;
+  }
+
+  if(! isdigit(*spec)) return 0;
+  first = strtoull(spec, &end, 10);
+  if(*end++ != '-') return 0;
+  if(isdigit(*end)) {             /* "bytes=M-N" */
+    last = strtoull(end, 0, 10);
+    if(last < first) return 0;
+    if(last >= length) last = length - 1;
+  }
+  else last = length - 1;         /* "bytes=M-" */
+
+  return (first < length) ? 1 : -1;
+}
+
+
+/* stream_blob():
+   Used in place of ExecuteAll() for a lookup whose single result column
+   is a streamed blob.
+*/
+int stream_blob(request_rec *r, ndb_instance *i) {
+  struct data_operation *data = i->data;
+  NdbBlob *blob = data->blob;
+  const NdbError *tx_error = 0;
+  const char *error_message = 0;
+  int response_code = OK;
+  int is_null = 0, range = 0;
+  Uint64 length = 0, first, last, pos, next;
+  Uint32 chunk, part, inline_size, n;
+  char *buffer;
+
+  /* A read that finds no row need not fail the whole execute() */
+  if(i->tx->execute(NdbTransaction::NoCommit, TX_ABORT_OPT,
+                    i->conn->ndb_force_send) || data->op->getNdbError().code) {
+    tx_error = data->op->getNdbError().code ?
+               & data->op->getNdbError() : & i->tx->getNdbError();
+    if(tx_error->status == NdbError::TemporaryError) {
+      response_code = 503;
+      i->stats.temp_errors++;
+    }
+    else handle_exec_error(r, response_code, error_message, *tx_error);
+    goto done;
+  }
+  if(data->expiry && row_has_expired(data->expiry, time(0))) {
+    response_code = 404;
+    goto done;
+  }
+
+  blob->getNull(is_null);
+  if(! is_null) blob->getLength(length);
+  if(length == 0) {
+    ap_set_content_length(r, 0);
+    response_code = 204;  // No content
+    goto done;
+  }
+
+  first = 0;
+  last = length - 1;
+  ap_table_setn(r->headers_out, "Accept-Ranges", "bytes");
+  if(! ap_table_get(r->headers_in, "If-Range"))
+    range = parse_range(ap_table_get(r->headers_in, "Range"),
+                        length, first, last);
+  if(range < 0) {
+    response_code = 416;
+    ap_table_setn(r->headers_out, "Content-Range",
+                  ap_psprintf(r->pool, "bytes */%lu", (unsigned long) length));
+    goto done;
+  }
+  if(range) {
+    r->status = 206;      // Partial content
+    ap_table_setn(r->headers_out, "Content-Range",
+                  ap_psprintf(r->pool, "bytes %lu-%lu/%lu",
+                              (unsigned long) first, (unsigned long) last,
+                              (unsigned long) length));
+    log_debug(r->server, "Blob range %lu-%lu", (unsigned long) first,
+              (unsigned long) last);
+  }
+  ap_set_content_length(r, last - first + 1);
+  ap_send_http_header(r);
+  if(r->header_only) goto done;
+
+  /* Every read after the first one starts on a part boundary, and reads
+     whole parts, so that no part is fetched from the data nodes twice */
+  inline_size = blob->getColumn()->getInlineSize();
+  part = blob->getColumn()->getPartSize();
+  chunk = BLOB_STREAM_CHUNK;
+  if(part) chunk = (chunk > part) ? chunk - (chunk % part) : part;
+  buffer = (char *) ap_palloc(r->pool, chunk + inline_size);
+
+  for(pos = first ; pos <= last ; pos += n) {
+    if(pos < inline_size) next = inline_size + chunk;
+    else next = inline_size + ((pos - inline_size) / chunk + 1) * chunk;
+    if(next > last + 1) next = last + 1;
+    n = next - pos;
+    if(blob->setPos(pos) || blob->readData(buffer, n)) {
+      /* The headers are gone, so the client sees a short response */
+      log_err(r->server, "Blob read failed at %s (offset %lu): %s",
+              r->uri, (unsigned long) pos, blob->getNdbError().message);
+      break;
+    }
+    if(n == 0 || ap_rwrite(buffer, n, r) < 0) break;
+  }
+
+  done:
+  if(response_code > 399)
+    response_code = ndb_handle_error(r, response_code,
+                                     tx_error, error_message);
+  i->tx->close();
+  i->tx = 0;
+  i->close_tx_groups();
+  i->cleanup();
+  return response_code;
+}
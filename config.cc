@@ -17,6 +17,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 #include "N-SQL/Parser.h"
+#include "ndb_api_compat.h"
 
 config::dir *all_endpoints[MAX_ENDPOINTS];
 int n_endp = 0;
@@ -91,8 +92,12 @@ namespace config {
     dir->fmt = get_format_by_name("JSON");
     dir->flag.use_etags = 1;
     dir->default_key = -1;
+    dir->set_max_rows = DEFAULT_SET_MAX_ROWS;
+    dir->set_max_ms = DEFAULT_SET_MAX_MS;
+    dir->set_batch = DEFAULT_SET_BATCH;
     dir->magic_number = 0xBABECAFE ;
   
+    dir->endpoint = n_endp;
     all_endpoints[n_endp++] = dir;
   
     return (void *) dir;
@@ -106,8 +111,13 @@ namespace config {
 
     srv->connect_string = 0;
     srv->max_read_operations = DEFAULT_MAX_READ_OPERATIONS;
+    srv->max_parallel_tx = DEFAULT_MAX_PARALLEL_TX;
     srv->max_retry_ms = DEFAULT_MAX_RETRY_MS ;
     srv->force_restart = DEFAULT_FORCE_RESTART ;
+    srv->expiry_rate = DEFAULT_EXPIRY_RATE ;
+    srv->expiry_batch = DEFAULT_EXPIRY_BATCH ;
+    srv->autoinc_min_range = DEFAULT_AUTOINC_MIN_RANGE ;
+    srv->autoinc_max_range = DEFAULT_AUTOINC_MAX_RANGE ;
     srv->magic_number = 0xCAFEBABE ;
 
     initialize_output_formats(p);
@@ -134,6 +144,7 @@ namespace config {
     if(! d2->table)     dir->table     = d1->table;
     if(! d2->fmt)       dir->fmt       = d1->fmt;
     if(! d2->incr_prefetch) dir->incr_prefetch = d1->incr_prefetch;
+    if(! d2->max_body)  dir->max_body  = d1->max_body;
  
     return (void *) dir;
   }
@@ -151,6 +162,8 @@ namespace config {
     if(! s2->connect_string)    srv->connect_string = s1->connect_string ;
     if(! s2->max_read_operations)
         srv->max_read_operations = s1->max_read_operations;
+    if(! s2->max_parallel_tx)
+        srv->max_parallel_tx = s1->max_parallel_tx;
     
     return (void *) srv;    
   }
@@ -180,6 +193,49 @@ namespace config {
        srv->max_read_operations = atoi(arg);
     else if(!strcmp(cmd->cmd->name, "ndb-retry-ms"))
        srv->max_retry_ms = atoi(arg);
+    else if(!strcmp(cmd->cmd->name, "ndb-max-parallel-tx")) {
+       srv->max_parallel_tx = atoi(arg);
+       if(srv->max_parallel_tx < 1) 
+         return "ndb-max-parallel-tx must be at least 1";
+    }
+    else if(!strcmp(cmd->cmd->name, "ndb-expiry-rate")) {
+       srv->expiry_rate = atoi(arg);
+       if(srv->expiry_rate < 1) return "ndb-expiry-rate must be at least 1";
+    }
+    else if(!strcmp(cmd->cmd->name, "ndb-expiry-batch")) {
+       srv->expiry_batch = atoi(arg);
+       if(srv->expiry_batch < 1) return "ndb-expiry-batch must be at least 1";
+    }
+    else assert(0);
+    
+    return 0;
+  }
+
+
+  /* "ndb-autoinc-range min [max]"
+  */
+  const char *srv_autoinc_range(cmd_parms *cmd, void *m, char *min, 
+                                char *max) {
+    config::srv *srv = (config::srv *) 
+      ap_get_module_config(cmd->server->module_config, &ndb_module);
+
+    srv->autoinc_min_range = atoi(min);
+    if(max) srv->autoinc_max_range = atoi(max);
+    if(srv->autoinc_min_range < 1) 
+      return "ndb-autoinc-range: the minimum must be at least 1";
+    if(srv->autoinc_max_range < srv->autoinc_min_range)
+      return "ndb-autoinc-range: the maximum is less than the minimum";
+    return 0;
+  }
+
+
+  const char *srv_set_flag(cmd_parms *cmd, void *m, int flag) {
+    config::srv *srv = (config::srv *) 
+    ap_get_module_config(cmd->server->module_config, &ndb_module);
+    
+    assert(srv->magic_number == 0xCAFEBABE);
+    if(!strcmp(cmd->cmd->name, "ndb-async-execute"))
+      srv->async_execute = flag;
     else assert(0);
     
     return 0;
@@ -215,6 +271,12 @@ namespace config {
       dir->flag.allow_delete = flag;
     else if(!strcmp(cmd->cmd->name, "ETags"))
       dir->flag.use_etags = flag;
+    else if(!strcmp(cmd->cmd->name, "SingleFlight"))
+      dir->flag.single_flight = flag;
+    else if(!strcmp(cmd->cmd->name, "ReturnUpdates"))
+      dir->flag.return_updates = flag;
+    else if(!strcmp(cmd->cmd->name, "StreamBlobs"))
+      dir->flag.stream_blobs = flag;
     else assert(0);
 
     return 0;
@@ -372,7 +434,7 @@ namespace config {
   }
   
   
-  /* Process a "Columns" or "AllowUpdates" directive
+  /* Process a "Columns", "AllowUpdates", or "Compress" directive
   */
   const char *non_key_column(cmd_parms *cmd, void *m, char *arg) {
     char *which = (char *) cmd->cmd->cmd_data;
@@ -388,6 +450,11 @@ namespace config {
         break;
       case 'W':
         *dir->updatable->new_item() = ap_pstrdup(cmd->pool, arg);
+        break;
+      case 'Z':
+        if(! dir->compressed) 
+          dir->compressed = new(cmd->pool, 2) apache_array<char *>;
+        *dir->compressed->new_item() = ap_pstrdup(cmd->pool, arg);
     }
     return 0;
   }    
@@ -452,6 +519,72 @@ namespace config {
   }
   
   
+  /* "SetLimit rows [milliseconds [batch]]"
+     Allow DELETE and UPDATE requests that use a scan plan, and limit the 
+     number of rows and the time that one such request can take.  
+  */
+  const char *set_limit(cmd_parms *cmd, void *m, char *rows, char *ms,
+                        char *batch) {
+    config::dir *dir = (config::dir *) m;
+    int n_rows = atoi(rows);
+    int n_ms = ms ? atoi(ms) : (int) dir->set_max_ms;
+    int n_batch = batch ? atoi(batch) : (int) dir->set_batch;
+
+    if(n_rows < 1) 
+      return "SetLimit: the row limit must be at least 1";
+    if(n_ms < 0) 
+      return "SetLimit: the time limit cannot be negative";
+    if(n_batch < 1) 
+      return "SetLimit: batch size must be at least 1";
+    dir->set_max_rows = n_rows;
+    dir->set_max_ms = n_ms;
+    dir->set_batch = n_batch;
+    dir->flag.set_ops = 1;
+    return 0;
+  }
+  
+  
+  /* "ExpireOn column [index]"
+     The column holds each row's expiry time.  The reaper scans the ordered
+     index on it, which by default has the same name as the column.
+  */
+  const char *expire_on(cmd_parms *cmd, void *m, char *col, char *idx) {
+    config::dir *dir = (config::dir *) m;
+
+    dir->expire_col = ap_pstrdup(cmd->pool, col);
+    dir->expire_index = ap_pstrdup(cmd->pool, idx ? idx : col);
+    return 0;
+  }
+  
+  
+  /* "MaxRequestBody bytes"
+     A larger request body, chunked or not, is refused with 413.
+  */
+  const char *max_request_body(cmd_parms *cmd, void *m, char *arg) {
+    config::dir *dir = (config::dir *) m;
+
+    dir->max_body = strtoul(arg, 0, 10);
+    if(dir->max_body < 1) 
+      return "MaxRequestBody must be at least 1";
+    return 0;
+  }
+  
+  
+  /* "BlobUpload column [bytes]"
+     A POST whose body is not a form is written, as it arrives, into this
+     BLOB or TEXT column of the row named by the key.
+  */
+  const char *blob_upload(cmd_parms *cmd, void *m, char *col, char *max) {
+    config::dir *dir = (config::dir *) m;
+
+    dir->blob_upload = ap_pstrdup(cmd->pool, col);
+    dir->max_upload = max ? strtoul(max, 0, 10) : DEFAULT_MAX_BLOB_UPLOAD;
+    if(dir->max_upload < 1) 
+      return "BlobUpload: the size limit must be at least 1";
+    return 0;
+  }
+  
+  
   /* "Filter column operator pseudocolumn"
      To do: How to handle "real_column IS [not] NULL" filters?
   */
@@ -550,6 +683,30 @@ namespace config {
     
     return 0;
   }
+
+
+  /* write_condition() is called from the SQL parser for each condition in
+     "UPDATE ... IF column op value".  An update is applied only if all of
+     them hold.
+  */
+  const char *write_condition(cmd_parms *cmd, config::dir *dir, 
+                              NSQL::Expr *in_expr) 
+  {
+    NSQL::Expr *expr = new(cmd->pool) NSQL::Expr;
+
+    expr->type  = NSQL::Relation;
+    expr->vtype = in_expr->vtype;
+    expr->base_col_name = in_expr->base_col_name;
+    expr->value = (* (in_expr->value) == '"') ? 
+        unquote_qstring(cmd, in_expr->value) : in_expr->value;
+    expr->rel_op= in_expr->rel_op;
+
+    /* Linked list: */
+    expr->next = dir->conditions;
+    dir->conditions = expr;
+
+    return 0;
+  }
  
     
   void sort_scan(config::dir *dir, int bounded, const char *idxname, int sort_order) {
@@ -566,8 +723,180 @@ namespace config {
     if(sort_order == NSQL::Desc)
       index_rec->flag.descending = 1;
   }
+
+
+  /* The join functions are called from the SQL parser.  
+     join_table() starts a new join record for "JOIN table [AS relation]";
+     join_index() and join_link() fill in the "USING" and "ON" clauses.
+     Relation names must be unique, because they name the nested rows in 
+     the result and qualify the columns in the "ON" clause.
+  */
+  const char *join_table(cmd_parms *cmd, config::dir *dir, char *db, 
+                         char *table, char *rel, int outer) 
+  {
+#ifdef HAVE_NDB_SPJ
+    if(! dir->joins) dir->joins = new(cmd->pool, 2) apache_array<config::join>;
+
+    if(dir->table && ! strcmp(rel, dir->table))
+      return ap_psprintf(cmd->pool, "JOIN %s: use AS to give the relation "
+                         "another name.", rel);
+    for(int n = 0 ; n < dir->joins->size() ; n++)
+      if(! strcmp(rel, dir->joins->item(n).relation))
+        return ap_psprintf(cmd->pool, "Relation %s is already joined.", rel);
     
+    config::join *jn = dir->joins->new_item();
+    bzero(jn, dir->joins->elt_size);
+    jn->relation = rel;
+    jn->database = db;
+    jn->table    = table;
+    jn->parent   = -2;      /* not yet known */
+    jn->idx_type = 'P';
+    jn->flag.outer       = outer;
+    jn->flag.select_star = 1;
+    jn->child_cols  = new(cmd->pool, 2) apache_array<char *>;
+    jn->parent_cols = new(cmd->pool, 2) apache_array<char *>;
+    jn->visible     = new(cmd->pool, 4) apache_array<char *>;
+    jn->aliases     = new(cmd->pool, 4) apache_array<char *>;
+    
+    log_conf_debug(cmd->server,"Joining table %s as \"%s\"", table, rel);
+    return 0;
+#else
+    return "N-SQL JOIN requires MySQL Cluster 7.2 or later.";
+#endif
+  }
+
+
+  const char *join_index(cmd_parms *cmd, config::dir *dir, 
+                         char *idxtype, char *name) 
+  {
+    config::join &jn = dir->joins->item(dir->joins->size() - 1);
+    jn.idx_type = *idxtype;
+    jn.idx_name = name;
+    return 0;
+  }
+
+
+  /* join_link() handles one "ON child_col = parent_col" condition.  
+     Either side can come first.  The new table's side can be qualified 
+     with its relation name; the parent's side can be qualified with the 
+     name of the endpoint's table or of an earlier join, and defaults to 
+     the endpoint's table.
+  */
+  const char *join_link(cmd_parms *cmd, config::dir *dir, 
+                        char *q1, char *c1, char *q2, char *c2)
+  {
+    short parent = -1;
+    config::join &jn = dir->joins->item(dir->joins->size() - 1);
     
+    if(q2 && ! strcmp(q2, jn.relation)) {  /* swap */
+      char *q = q1, *c = c1;
+      q1 = q2; c1 = c2; 
+      q2 = q;  c2 = c;
+    }
+    if(q1 && strcmp(q1, jn.relation))
+      return ap_psprintf(cmd->pool, "JOIN %s ON: one side of each condition "
+                         "must be a column of %s.", jn.relation, jn.relation);
+
+    if(q2 && ! (dir->table && ! strcmp(q2, dir->table))) {
+      for(parent = 0 ; parent < dir->joins->size() - 1 ; parent++)
+        if(! strcmp(q2, dir->joins->item(parent).relation)) break;
+      if(parent == dir->joins->size() - 1)
+        return ap_psprintf(cmd->pool, "JOIN %s ON: unknown relation %s.", 
+                           jn.relation, q2);
+    }
+    if(jn.parent != -2 && jn.parent != parent)
+      return ap_psprintf(cmd->pool, "JOIN %s ON: all conditions must refer to "
+                         "the same parent relation.", jn.relation);
+
+    jn.parent = parent;
+    *jn.child_cols->new_item()  = c1;
+    *jn.parent_cols->new_item() = c2;
+    return 0;
+  }
+
+
+  /* join_columns() assigns the qualified columns from the select list,
+     which the parser saves as (relation, column, alias) triples.
+     A joined table returns all of its columns unless some are listed.
+  */
+  const char *join_columns(cmd_parms *cmd, config::dir *dir, 
+                           apache_array<char *> *cols) 
+  {
+    for(int n = 0 ; n < cols->size() ; n += 3) {
+      char *rel     = cols->item(n);
+      char *c_name  = cols->item(n + 1);
+      char *c_alias = cols->item(n + 2);
+      apache_array<char *> *visible = 0, *aliases = 0;
+
+      if(dir->table && ! strcmp(rel, dir->table)) {
+        if(*c_name == '*') dir->flag.select_star = 1;
+        else visible = dir->visible, aliases = dir->aliases;
+      }
+      else {
+        int j;
+        for(j = 0 ; dir->joins && j < dir->joins->size() ; j++) 
+          if(! strcmp(rel, dir->joins->item(j).relation)) break;
+        if(! dir->joins || j == dir->joins->size())
+          return ap_psprintf(cmd->pool, "Column %s.%s: unknown relation %s.",
+                             rel, c_name, rel);
+        config::join &jn = dir->joins->item(j);
+        if(*c_name != '*') {
+          jn.flag.select_star = 0;
+          visible = jn.visible, aliases = jn.aliases;
+        }
+      }
+      if(visible) {
+        *visible->new_item() = c_name;
+        *aliases->new_item() = c_alias;
+      }
+    }
+    return 0;
+  }
+
+
+  /* expansion():  process Expand directives.
+     Expand relation /child/endpoint parent-column=child-param [ ... ]
+  */
+  const char *expansion(cmd_parms *cmd, void *m, char *args) {
+    config::dir *dir = (config::dir *) m;
+    const char *c = args;
+    char *word, *param;
+
+    assert(dir->magic_number == 0xBABECAFE);
+
+    if(! dir->expansions)
+      dir->expansions = new(cmd->pool, 2) apache_array<config::expand>;
+    config::expand *exp = dir->expansions->new_item();
+
+    exp->relation = ap_getword_conf(cmd->pool, &c);
+    exp->path = ap_getword_conf(cmd->pool, &c);
+    if(! (*exp->relation && *exp->path == '/'))
+      return "Usage: Expand relation /child/path column=param [column=param ...]";
+    for(int n = 0 ; n < dir->expansions->size() - 1 ; n++)
+      if(! strcmp(exp->relation, dir->expansions->item(n).relation))
+        return ap_psprintf(cmd->pool, "Expand %s: relation is already "
+                           "defined.", exp->relation);
+
+    exp->parent_cols  = new(cmd->pool, 2) apache_array<char *>;
+    exp->child_params = new(cmd->pool, 2) apache_array<char *>;
+    while(*c && *(word = ap_getword_conf(cmd->pool, &c))) {
+      param = strchr(word, '=');
+      if(! param || param == word || ! *(param + 1))
+        return ap_psprintf(cmd->pool, "Expand %s: expected column=param, "
+                           "found \"%s\".", exp->relation, word);
+      *param++ = 0;
+      *exp->parent_cols->new_item() = word;
+      *exp->child_params->new_item() = param;
+    }
+    if(! exp->parent_cols->size())
+      return ap_psprintf(cmd->pool, "Expand %s: no key parameters.",
+                         exp->relation);
+
+    log_conf_debug(cmd->server, "Expand %s from %s", exp->relation, exp->path);
+    return 0;
+  }
+
+
   /* named_index():  process Index directives.
      UniqueIndex index-name column [column ... ]
      OrderedIndex index-name column [column ... ]
@@ -712,6 +1041,9 @@ namespace config {
       else if(!strcasecmp(word1,"Row")) {
         fmt->symbol(word2, cmd->pool, new(cmd->pool) RowLoop(word4));
       }
+      else if(!strcasecmp(word1,"Join")) {
+        fmt->symbol(word2, cmd->pool, new(cmd->pool) JoinLoop(word4));
+      }
       else if(!strcasecmp(word1,"Record")) {
         const char *word5 = ap_getword_conf(cmd->pool, &pos);
         const char *word6 = ap_getword_conf(cmd->pool, &pos);
@@ -877,6 +1209,13 @@ extern "C" {
     RSRC_CONF,     TAKE1,
     "Milliseconds to spend re-trying a transaction before returning 503 error."
   },  
+  {   // Per-server
+    "ndb-max-parallel-tx",
+    (CMD_HAND_TYPE) config::srv_set_int,
+    NULL,
+    RSRC_CONF,     TAKE1,
+    "Limit to number of transactions run in parallel for one batch of subrequests"
+  },  
   {   // Per-server
     "ndb-force-restart",
     (CMD_HAND_TYPE) config::force_restart,
@@ -884,6 +1223,34 @@ extern "C" {
     RSRC_CONF,     FLAG,
     "Whether to force an apache graceful restart after ALTER TABLE."
   }, 
+  {   // Per-server
+    "ndb-async-execute",
+    (CMD_HAND_TYPE) config::srv_set_flag,
+    NULL,
+    RSRC_CONF,     FLAG,
+    "Execute transactions with the asynchronous NDB API."
+  }, 
+  {   // Per-server
+    "ndb-expiry-rate",
+    (CMD_HAND_TYPE) config::srv_set_int,
+    NULL,
+    RSRC_CONF,     TAKE1,
+    "Maximum number of expired rows deleted per second"
+  },  
+  {   // Per-server
+    "ndb-expiry-batch",
+    (CMD_HAND_TYPE) config::srv_set_int,
+    NULL,
+    RSRC_CONF,     TAKE1,
+    "Number of expired rows deleted in each transaction"
+  },  
+  {   // Per-server
+    "ndb-autoinc-range",
+    (CMD_HAND_TYPE) config::srv_autoinc_range,
+    NULL,
+    RSRC_CONF,     TAKE12,
+    "Minimum and maximum number of auto-increment values reserved at once"
+  },  
   {
     "<ResultFormat",  // Define a result format 
     (CMD_HAND_TYPE) config::result_fmt_container,
@@ -898,6 +1265,13 @@ extern "C" {
     ACCESS_CONF,    TAKE1, 
     "MySQL database schema" 
   },
+  {
+    "VersionColumn",    // NOT inheritable
+    (CMD_HAND_TYPE) ap_set_string_slot,
+    (void *)XtOffsetOf(config::dir, version_col),
+    ACCESS_CONF,    TAKE1,
+    "Column compared with the If-Match header on updates"
+  },
   {
     "Table",            // NOT inheritable
     (CMD_HAND_TYPE) config::table,
@@ -912,6 +1286,34 @@ extern "C" {
     ACCESS_CONF,     FLAG,
     "Allow DELETE over HTTP"
   },
+  {
+    "SetLimit",         // NOT inheritable
+    (CMD_HAND_TYPE) config::set_limit,
+    NULL,
+    ACCESS_CONF,    TAKE123,
+    "Allow set-based DELETE and UPDATE: max. rows, milliseconds, batch size"
+  },
+  {
+    "ExpireOn",         // NOT inheritable
+    (CMD_HAND_TYPE) config::expire_on,
+    NULL,
+    ACCESS_CONF,    TAKE12,
+    "Expiry time column (and its ordered index): hide and delete old rows"
+  },
+  {
+    "MaxRequestBody",   // inheritable
+    (CMD_HAND_TYPE) config::max_request_body,
+    NULL,
+    ACCESS_CONF,    TAKE1,
+    "Largest request body accepted, in bytes"
+  },
+  {
+    "BlobUpload",       // NOT inheritable
+    (CMD_HAND_TYPE) config::blob_upload,
+    NULL,
+    ACCESS_CONF,    TAKE12,
+    "BLOB column written from a raw request body (and its max. size)"
+  },
   {
     "ETags",          // Inheritable, defaults to 1
     (CMD_HAND_TYPE) config::dir_set_flag,
@@ -919,6 +1321,27 @@ extern "C" {
     ACCESS_CONF,     FLAG,
     "Compute and set ETag header in response"
   },    
+  {
+    "SingleFlight",   // NOT inheritable, defaults to 0
+    (CMD_HAND_TYPE) config::dir_set_flag,
+    NULL,
+    ACCESS_CONF,     FLAG,
+    "Share one read among identical concurrent GET requests"
+  },    
+  {
+    "ReturnUpdates",  // NOT inheritable, defaults to 0
+    (CMD_HAND_TYPE) config::dir_set_flag,
+    NULL,
+    ACCESS_CONF,     FLAG,
+    "Return the new values of updated columns"
+  },    
+  {
+    "StreamBlobs",    // NOT inheritable, defaults to 0
+    (CMD_HAND_TYPE) config::dir_set_flag,
+    NULL,
+    ACCESS_CONF,     FLAG,
+    "Send a raw BLOB in chunks as it is read, and honor Range requests"
+  },    
   {
     "Format",           // inheritable
     (CMD_HAND_TYPE) config::result_format,
@@ -940,6 +1363,13 @@ extern "C" {
     ACCESS_CONF,    ITERATE,
     "List of attributes that can be updated using HTTP"
   },
+  {
+    "Compress",         // NOT inheritable
+    (CMD_HAND_TYPE) config::non_key_column,
+    (void *) "Z",
+    ACCESS_CONF,    ITERATE,
+    "BLOB and TEXT columns stored compressed with zlib"
+  },
   {
     "PrimaryKey",      // NOT inheritable
     (CMD_HAND_TYPE) config::primary_key,
@@ -974,7 +1404,14 @@ extern "C" {
     NULL,
     ACCESS_CONF,    TAKE3, 
     "Result Filter"
-  }, 
+  },
+  {                     // NOT inheritable
+    "Expand",  // Expand relation /child/path col=param [col=param ...]
+    (CMD_HAND_TYPE) config::expansion,
+    NULL,
+    ACCESS_CONF,    RAW_ARGS,
+    "Nested resource, read when the request has ?expand=relation"
+  },
   { 
     "SELECT",  // N-SQL statement
     (CMD_HAND_TYPE) config::sql_container,
@@ -982,6 +1419,13 @@ extern "C" {
     ACCESS_CONF ,      RAW_ARGS,
     "N-SQL SELECT Query"    
   },
+  { 
+    "UPDATE",  // N-SQL statement
+    (CMD_HAND_TYPE) config::sql_container,
+    (void *) "UPDATE ",
+    ACCESS_CONF,      RAW_ARGS,
+    "N-SQL UPDATE Query"    
+  },    
   { 
     "DELETE",  // N-SQL statement
     (CMD_HAND_TYPE) config::sql_container,
@@ -27,11 +27,66 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 /* Other Defaults */
 #define DEFAULT_MAX_READ_OPERATIONS 20
+#define DEFAULT_MAX_PARALLEL_TX     4
 #define DEFAULT_MAX_RETRY_MS        50
 #define DEFAULT_FORCE_RESTART       0
 
 #define MAX_ENDPOINTS 500
 
+/* Limits on one set-based DELETE or UPDATE: rows, elapsed time, and the 
+   number of rows committed in each batch */
+#define DEFAULT_SET_MAX_ROWS  10000
+#define DEFAULT_SET_MAX_MS    5000
+#define DEFAULT_SET_BATCH     256
+
+/* The largest request body that an endpoint will read (in bytes) */
+#define DEFAULT_MAX_REQUEST_BODY  (1024 * 1024)
+
+/* A streamed BLOB upload ("BlobUpload"): the largest body accepted, and how
+   many bytes are written to the blob between NoCommit executes */
+#define DEFAULT_MAX_BLOB_UPLOAD   (64 * 1024 * 1024)
+#define BLOB_UPLOAD_FLUSH         (256 * 1024)
+
+/* A streamed BLOB read ("StreamBlobs"): bytes read from NDB at a time */
+#define BLOB_STREAM_CHUNK         (64 * 1024)
+
+/* Result pages are written into blocks of this size.  Each thread keeps
+   free blocks for its next request -- enough for twice its average page,
+   but never more than RESULT_BLOCKS_KEPT -- and keeps up to 
+   RESULT_BUFFER_BYTES_KEPT of other buffers, such as those of blob values */
+#define RESULT_BLOCK_SIZE         (32 * 1024)
+#define RESULT_BLOCKS_KEPT        32
+#define RESULT_BUFFER_BYTES_KEPT  (1024 * 1024)
+
+/* Each thread carves its result objects from a slab sized for 
+   max_read_operations of the widest endpoint.  An endpoint that selects
+   "*" is counted as SLAB_STAR_COLUMNS wide; the slab grows if needed */
+#define SLAB_STAR_COLUMNS         32
+
+/* The starting size of each column buffer of an Arrow record batch */
+#define ARROW_COLUMN_BUFFER       4096
+
+/* Compressed BLOB and TEXT columns ("Compress"): the zlib level, and the 
+   smallest value worth compressing */
+#define BLOB_COMPRESS_LEVEL   6
+#define BLOB_COMPRESS_MIN     128
+
+/* The expiry reaper ("ExpireOn"): rows deleted per second, rows per 
+   transaction, and how long to wait when there is nothing to delete */
+#define DEFAULT_EXPIRY_RATE   200
+#define DEFAULT_EXPIRY_BATCH  20
+#define EXPIRY_IDLE_MS        5000
+
+/* Auto-increment ranges: the smallest and largest number of values 
+   reserved at once for one table, and how long a range should last */
+#define DEFAULT_AUTOINC_MIN_RANGE  10
+#define DEFAULT_AUTOINC_MAX_RANGE  10000
+#define AUTOINC_TARGET_MS          1000
+
+/* How long a single-flight follower waits for the leader's result 
+   before running the query itself */
+#define SINGLE_FLIGHT_WAIT_MS 1000
+
 /* Release Name. */
 /* In the subversion sources, this is __SVN_DEV__ */
 /* The Build-source-release.sh script fills in an actual release name */
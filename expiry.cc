@@ -0,0 +1,405 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "mod_ndb.h"
+#include "ndb_api_compat.h"
+
+extern struct mod_ndb_process process;      /* from mod_ndb.cc */
+extern config::dir *all_endpoints[MAX_ENDPOINTS];
+extern int n_endp;
+
+/* Row expiry ("ExpireOn column [index]").
+   The expiry column holds the time after which a row is no longer valid:
+   a TIMESTAMP, DATETIME, or integer (seconds since the epoch).  A NULL
+   value never expires.
+
+   Reads at an expiring endpoint do not return expired rows: a scan has
+   an extra scan filter, and a lookup reads the expiry column, which
+   ExecuteAll() checks before it builds the result.
+
+   The rows themselves are deleted by a background "reaper" thread.  Every
+   Apache child process has one, but only the process that holds the reaper
+   lock does any work; the others try to take over the lock from time to
+   time, in case that process has exited.  The reaper scans the ordered
+   index on the expiry column, from the oldest rows up to the current time,
+   and deletes at most ndb-expiry-batch rows per endpoint in each
+   transaction, pausing between batches so that it deletes no more than
+   ndb-expiry-rate rows per second.
+*/
+
+struct expiring_endpoint {
+  config::dir *dir;
+  const char *database;
+  unsigned long rows;       /* deleted by this process */
+  unsigned long batches;
+  time_t last_pass;         /* last time a batch reached the current time */
+  bool disabled;            /* after a configuration error */
+};
+
+static struct {
+  struct expiring_endpoint *endpoints;
+  int n_endpoints;
+  int is_reaper;            /* this process holds the reaper lock */
+  unsigned long errors;
+} expiry;
+
+
+/* expiry_now():
+   The time now, as a string that MySQL::value() will read as a value
+   of the expiry column's type.
+*/
+const char *expiry_now(ap_pool *p, const NdbDictionary::Column *col,
+                       time_t now) {
+  if(col->getType() == NdbDictionary::Column::Datetime) {
+    char buf[32];
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    return ap_pstrdup(p, buf);
+  }
+  return ap_psprintf(p, "%ld", (long) now);
+}
+
+
+/* row_has_expired():
+   Test the expiry column of a row that has been read by a lookup.
+*/
+bool row_has_expired(const NdbRecAttr *rec, time_t now) {
+  if(rec->isNULL()) return false;
+
+  switch(rec->getType()) {
+    case NdbDictionary::Column::Timestamp:
+    case NdbDictionary::Column::Unsigned:
+      return rec->u_32_value() < (Uint32) now;
+    case NdbDictionary::Column::Int:
+      return rec->int32_value() < (Int32) now;
+    case NdbDictionary::Column::Bigint:
+      return rec->int64_value() < (Int64) now;
+    case NdbDictionary::Column::Bigunsigned:
+      return rec->u_64_value() < (Uint64) now;
+    case NdbDictionary::Column::Datetime: {
+      /* A DATETIME is stored as the decimal number YYYYMMDDhhmmss */
+      struct tm tm;
+      localtime_r(&now, &tm);
+      Uint64 packed = (Uint64) (tm.tm_year + 1900) * 10000000000ULL
+                    + (Uint64) (tm.tm_mon + 1) * 100000000ULL
+                    + tm.tm_mday * 1000000ULL + tm.tm_hour * 10000ULL
+                    + tm.tm_min * 100 + tm.tm_sec;
+      return rec->u_64_value() < packed;
+    }
+    default:
+      return false;
+  }
+}
+
+
+/* The smallest non-null value of the expiry column, used as the lower
+   bound of the reaper's scan, so that it skips over rows with NULLs.
+*/
+inline const char *lowest_value(const NdbDictionary::Column *col) {
+  switch(col->getType()) {
+    case NdbDictionary::Column::Int:
+      return "-2147483648";
+    case NdbDictionary::Column::Bigint:
+      return "-9223372036854775808";
+    default:
+      return "0";
+  }
+}
+
+
+/* find_expiring_endpoints():
+   Build the list of endpoints with "ExpireOn".  An endpoint that does not
+   name its own database inherits it, as in merge_dir(), from the nearest
+   enclosing endpoint that does.
+*/
+void find_expiring_endpoints(ap_pool *p) {
+  int n, m;
+
+  expiry.endpoints = (struct expiring_endpoint *)
+    ap_pcalloc(p, n_endp * sizeof(struct expiring_endpoint));
+  expiry.n_endpoints = 0;
+
+  for(n = 0 ; n < n_endp ; n++) {
+    config::dir *dir = all_endpoints[n];
+    if(! (dir->expire_col && dir->table)) continue;
+    struct expiring_endpoint *e = expiry.endpoints + expiry.n_endpoints++;
+    e->dir = dir;
+    e->database = dir->database;
+    for(m = n - 1 ; m >= 0 && ! e->database ; m--)
+      if(all_endpoints[m]->database && ! strncmp(dir->path,
+         all_endpoints[m]->path, strlen(all_endpoints[m]->path)))
+        e->database = all_endpoints[m]->database;
+  }
+}
+
+
+/* expiry_status():
+   Part of the page written by the ndb-status handler.
+*/
+void expiry_status(request_rec *r, config::srv *srv) {
+  if(! expiry.n_endpoints) return;
+
+  ap_rprintf(r, "\n");
+  ap_rprintf(r, "Expiry reaper: %s\n", expiry.is_reaper ?
+             "running in this process" : "not in this process");
+  ap_rprintf(r, "  Rate: %d rows/sec , Batch size: %d rows , Errors: %lu\n",
+             srv->expiry_rate, srv->expiry_batch, expiry.errors);
+  for(int n = 0 ; n < expiry.n_endpoints ; n++) {
+    struct expiring_endpoint *e = expiry.endpoints + n;
+    ap_rprintf(r, "  .. Path: %s , Column: %s , Deleted: %lu rows in %lu "
+               "batches , Last caught up: %ld s ago%s\n",
+               e->dir->path, e->dir->expire_col, e->rows, e->batches,
+               e->last_pass ? (long) (time(0) - e->last_pass) : -1L,
+               e->disabled ? " (DISABLED)" : "");
+  }
+}
+
+
+#ifdef THIS_IS_APACHE2
+
+#include "apr_thread_proc.h"
+#include "apr_proc_mutex.h"
+
+static apr_proc_mutex_t *reaper_lock = 0;
+static const char *reaper_lock_file;
+static apr_thread_t *reaper_thread;
+static apr_pool_t *reaper_pool;
+static volatile int reaper_must_stop = 0;
+
+
+/* A dictionary lookup that failed because the table or index does not 
+   exist disables the endpoint.  Any other failure is retried on the next
+   pass.
+*/
+static bool no_such_object(const NdbError &err) {
+  switch(err.code) {
+    case 709:   /* No such table existed */
+    case 723:   /* No such table existed */
+    case 4243:  /* Index not found */
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+/* reap_batch():
+   Delete up to "batch" expired rows at one endpoint, in one transaction.
+   Returns the number of rows deleted.
+*/
+int reap_batch(server_rec *s, Ndb *db, struct expiring_endpoint *e,
+               int batch) {
+  config::dir *dir = e->dir;
+  const NdbDictionary::Dictionary *dict;
+  const NdbDictionary::Table *tab;
+  const NdbDictionary::Index *idx;
+  const NdbDictionary::Column *col;
+  NdbTransaction *tx = 0;
+  NdbIndexScanOperation *scan;
+  mvalue now, low;
+  int n = 0, check = 0;
+
+  db->setDatabaseName(e->database);
+  dict = db->getDictionary();
+  tab = dict->getTable(dir->table);
+  idx = tab ? dict->getIndex(dir->expire_index, dir->table) : 0;
+  if(! (tab && idx) && ! no_such_object(dict->getNdbError())) {
+    expiry.errors++;          /* e.g. during a node restart; try again */
+    return 0;
+  }
+  col = tab ? tab->getColumn(dir->expire_col) : 0;
+  if(! (tab && idx && col)) {
+    log_err(s, "ExpireOn at %s: cannot find table %s, ordered index %s, "
+            "and column %s.", dir->path, dir->table, dir->expire_index,
+            dir->expire_col);
+    e->disabled = 1;
+    return 0;
+  }
+  MySQL::value(now, reaper_pool, col, expiry_now(reaper_pool, col, time(0)));
+  MySQL::value(low, reaper_pool, col, lowest_value(col));
+  if(now.use_value <= mvalue_is_good || low.use_value <= mvalue_is_good) {
+    log_err(s, "ExpireOn at %s: column %s is not a date or an integer.",
+            dir->path, dir->expire_col);
+    e->disabled = 1;
+    return 0;
+  }
+
+  if(! (tx = db->startTransaction())) {
+    expiry.errors++;
+    return 0;
+  }
+  scan = tx->getNdbIndexScanOperation(idx);
+  if(! scan || scan->readTuples(NdbOperation::LM_Exclusive)
+     || scan->setBound(dir->expire_col, NdbIndexScanOperation::BoundLE,
+                       & low.u.val_char)
+     || scan->setBound(dir->expire_col, NdbIndexScanOperation::BoundGT,
+                       & now.u.val_char)
+     || tx->execute(NdbTransaction::NoCommit, TX_ABORT_OPT, 1))
+    goto failed;
+
+  while(n < batch && (check = scan->nextResult(true)) == 0) {
+    do {
+      if(scan->deleteCurrentTuple()) goto failed;
+      n++;
+    } while(n < batch && (check = scan->nextResult(false)) == 0);
+    if(check == -1) break;
+    if(n < batch && tx->execute(NdbTransaction::NoCommit, TX_ABORT_OPT, 1))
+      goto failed;
+  }
+  if(check == -1 || tx->execute(NdbTransaction::Commit, TX_ABORT_OPT, 1))
+    goto failed;
+  tx->close();
+
+  if(n < batch) e->last_pass = time(0);
+  if(n) {
+    e->rows += n;
+    e->batches++;
+  }
+  return n;
+
+  failed:
+  if(tx->getNdbError().status != NdbError::TemporaryError)
+    log_err(s, "Expiry reaper at %s: [%d] %s", dir->path,
+            tx->getNdbError().code, tx->getNdbError().message);
+  expiry.errors++;
+  tx->close();
+  return 0;
+}
+
+
+/* Sleep for up to ms milliseconds, but wake up to stop. */
+inline void reaper_sleep(unsigned int ms) {
+  for( ; ms > 0 && ! reaper_must_stop ; ms -= (ms > 100 ? 100 : ms))
+    apr_sleep((ms > 100 ? 100 : ms) * 1000);
+}
+
+
+void * APR_THREAD_FUNC expiry_reaper(apr_thread_t *t, void *v) {
+  server_rec *s = (server_rec *) v;
+  config::srv *srv = (config::srv *)
+    ap_get_module_config(s->module_config, &ndb_module);
+  Ndb *db = 0;
+  int n, deleted;
+
+  while(! reaper_must_stop) {
+    if(! expiry.is_reaper) {
+      if(apr_proc_mutex_trylock(reaper_lock) != APR_SUCCESS) {
+        reaper_sleep(EXPIRY_IDLE_MS);
+        continue;
+      }
+      expiry.is_reaper = 1;
+      log_err(s, "PID %d is now the expiry reaper.", (int) getpid());
+    }
+    if(! db) {
+      db = new Ndb(process.conn.connection);
+      if(db->init(1) == -1) {
+        log_err(s, "Expiry reaper: Ndb::init() failed: %s",
+                db->getNdbError().message);
+        delete db;
+        db = 0;
+        reaper_sleep(EXPIRY_IDLE_MS);
+        continue;
+      }
+    }
+
+    deleted = 0;
+    for(n = 0 ; n < expiry.n_endpoints && ! reaper_must_stop ; n++)
+      if(! expiry.endpoints[n].disabled)
+        deleted += reap_batch(s, db, expiry.endpoints + n, srv->expiry_batch);
+    apr_pool_clear(reaper_pool);
+
+    /* Keep to the configured rate; or, when there is nothing left to
+       delete, wait a while before looking again. */
+    if(deleted) reaper_sleep(deleted * 1000 / srv->expiry_rate);
+    else reaper_sleep(EXPIRY_IDLE_MS);
+  }
+
+  if(db) delete db;
+  if(expiry.is_reaper) apr_proc_mutex_unlock(reaper_lock);
+  apr_thread_exit(t, APR_SUCCESS);
+  return 0;
+}
+
+
+/* create_expiry_lock() is called from post_config, in the Apache parent
+   process.  The lock uses fcntl(), so that it is released if the child
+   that holds it exits.
+*/
+void create_expiry_lock(ap_pool *p, server_rec *s) {
+  find_expiring_endpoints(p);
+  if(! expiry.n_endpoints) return;
+
+  reaper_lock_file = ap_server_root_relative(p, DEFAULT_REL_RUNTIMEDIR
+                                             "/mod_ndb_expiry.lock");
+  if(apr_proc_mutex_create(& reaper_lock, reaper_lock_file,
+                           APR_LOCK_FCNTL, p) != APR_SUCCESS) {
+    log_err(s, "Cannot create lock file %s; expired rows will not be "
+            "deleted.", reaper_lock_file);
+    reaper_lock = 0;
+  }
+}
+
+
+/* start_expiry_reaper() is called from child_init.
+*/
+void start_expiry_reaper(server_rec *s, ap_pool *p) {
+  find_expiring_endpoints(p);
+  if(! (expiry.n_endpoints && reaper_lock)) return;
+
+  if(apr_proc_mutex_child_init(& reaper_lock, reaper_lock_file, p)
+     != APR_SUCCESS) {
+    log_err(s, "Cannot open lock file %s; this process will not delete "
+            "expired rows.", reaper_lock_file);
+    return;
+  }
+  apr_pool_create(& reaper_pool, p);
+  if(apr_thread_create(& reaper_thread, NULL, expiry_reaper, s, p)
+     != APR_SUCCESS) {
+    log_err(s, "Cannot start the expiry reaper thread.");
+    reaper_thread = 0;
+  }
+}
+
+
+/* stop_expiry_reaper() is called from child_exit,
+   before the cluster connection is deleted.
+*/
+void stop_expiry_reaper() {
+  apr_status_t thread_status;
+
+  if(! reaper_thread) return;
+  reaper_must_stop = 1;
+  apr_thread_join(& thread_status, reaper_thread);
+  reaper_thread = 0;
+}
+
+#else
+
+void create_expiry_lock(ap_pool *p, server_rec *s) { }
+
+void start_expiry_reaper(server_rec *s, ap_pool *p) {
+  find_expiring_endpoints(p);
+  if(expiry.n_endpoints)
+    log_err(s, "This build of mod_ndb has no expiry reaper thread; expired "
+               "rows are hidden from reads, but not deleted.");
+}
+
+void stop_expiry_reaper() { }
+
+#endif
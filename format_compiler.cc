@@ -38,7 +38,8 @@ Cell the_null_cell(0, "");
 Node the_null_node("the_null_node", &the_null_cell);
 
 
-/*  Find each node in the symbol table and compile it 
+/*  Find each node in the symbol table and compile it,
+    then assemble the format's program
 */
 const char * output_format::compile(ap_pool *pool)  {
   struct symbol *sym;
@@ -48,6 +49,7 @@ const char * output_format::compile(ap_pool *pool)  {
     for(unsigned int h = 0 ; h < SYM_TAB_SZ ; h++)
       for(sym = symbol_table[h]; sym != 0 ; sym = sym->next_sym)
         sym->node->compile(this);
+    Assembler(pool).assemble(this);
   }
   catch(ParserError P) {
     if(sym && sym->node && sym->node->name) 
@@ -308,6 +310,30 @@ void Loop::compile(output_format *o) {
 }
 
 
+/* A RowLoop is a Loop, plus the format's "join" node, if it has one.
+*/
+void RowLoop::compile(output_format *o) {
+  Loop::compile(o);
+  nested = o->symbol("join");
+  if(nested && nested->type != nested_node) 
+    throw ParserError("The \"join\" object in a Format must be a Join object.");
+}
+
+
+/* A JoinLoop is a Loop over the rows of a joined table.  Its begin text
+   is written before the rows, and is the only place where $name$ is
+   allowed.
+*/
+void JoinLoop::compile(output_format *o) {
+  Loop::compile(o);
+  if(core == &the_null_node)
+    throw ParserError("A Join object must contain a Row object.");
+  for(Cell *c = begin; c != 0 ; c = c->next) 
+    if(c->elem_type == item_value) 
+      throw ParserError("A Join object cannot contain $value$.");
+}
+
+
 /* A MainLoop has start text, a core node, and end text.
 */
 void MainLoop::compile(output_format *o) {
@@ -324,3 +350,251 @@ void MainLoop::compile(output_format *o) {
   parser.the_end(pars_required);
 }
 
+
+/**** The Assembler ****/
+
+int Assembler::emit(opcode op, int jump, int jump2) {
+  int at = code->size();
+  instruction *ins = code->new_item();
+
+  ins->op = op;
+  ins->quote = no_quot;
+  ins->escapes = 0;
+  ins->text.len = 0;
+  ins->text.string = "";
+  ins->col = 0;
+  ins->jump = jump;
+  ins->jump2 = jump2;
+  return at;
+}
+
+
+void Assembler::text(len_string &str) {
+  int last = code->size() - 1;
+
+  if(str.len == 0) return;
+  if(last >= label && last >= 0 && code->item(last).op == op_text) {
+    len_string &prev = code->item(last).text;
+    char *merged = (char *) ap_palloc(pool, prev.len + str.len + 1);
+    memcpy(merged, prev.string, prev.len);
+    memcpy(merged + prev.len, str.string, str.len);
+    merged[prev.len + str.len] = 0;
+    prev.string = merged;
+    prev.len += str.len;
+  }
+  else code->item(emit(op_text)).text = str;
+}
+
+
+/* Cells outside of a row write only their text */
+void Assembler::literals(Cell *c) {
+  for( ; c != 0 ; c = c->next) 
+    if(c->elem_type == const_string) text(*c);
+}
+
+
+/* In the begin and end text of a row, $1$ is the value of a column by 
+   number, and $name$ and $value$ have no meaning */
+void Assembler::row_cells(Cell *c) {
+  for( ; c != 0 ; c = c->next) {
+    if(c->elem_type == const_string) text(*c);
+    else if(c->i) {
+      instruction &ins = code->item(emit(op_column_value));
+      ins.quote = c->elem_quote;
+      ins.escapes = c->escapes;
+      ins.col = c->i;
+    }
+  }
+}
+
+
+/* In a Record, $name$ and $value$ refer to the current column */
+void Assembler::column_cells(Cell *c) {
+  for( ; c != 0 ; c = c->next) {
+    if(c->elem_type == const_string) text(*c);
+    else {
+      instruction &ins = code->item(emit(c->elem_type == item_name ?
+                                         op_name : op_value));
+      ins.quote = c->elem_quote;
+      ins.escapes = c->escapes;
+    }
+  }
+}
+
+
+/* In a Join, $name$ is the name of the relation */
+void Assembler::relation(Cell *c) {
+  for( ; c != 0 ; c = c->next) {
+    if(c->elem_type == item_name) 
+      code->item(emit(op_relation)).quote = c->elem_quote;
+    else if(c->elem_type == const_string) text(*c);
+  }
+}
+
+
+void Assembler::nested(Node *join_node, len_string &sep) {
+  int at = emit(op_nested);
+
+  code->item(at).text = sep;
+  * join_calls->new_item() = at;
+  join = join_node;
+}
+
+
+/* assemble(): the main program, followed by the join subroutine */
+void Assembler::assemble(output_format *f) {
+  int entry;
+
+  f->top_node->emit(*this);
+  emit(op_return);
+  if(join) {
+    entry = here();
+    ((JoinLoop *) join)->emit_subroutine(*this);
+    for(int n = 0 ; n < join_calls->size() ; n++) 
+      patch(join_calls->item(n), entry);
+  }
+  f->program = code->items();
+  f->program_size = code->size();
+}
+
+
+/**** Node::emit() methods ****/
+
+void Node::emit(Assembler &a) {
+  a.row_cells(cell);
+}
+
+
+void Node::emit_column(Assembler &a) {
+  a.column_cells(cell);
+}
+
+
+void RecAttr::emit(Assembler &) {
+  throw ParserError("A Record object can only be the core of a Row object.");
+}
+
+
+/* A Record writes its "or" chain for a null value */
+void RecAttr::emit_column(Assembler &a) {
+  int test, skip;
+
+  test = a.emit(op_if_null);
+  a.column_cells(fmt);
+  skip = a.emit(op_goto);
+  a.patch(test, a.here());
+  a.column_cells(null_fmt);
+  a.patch(skip, a.here());
+}
+
+
+void Loop::emit_column(Assembler &) {
+  throw ParserError("The core of a Row object must be a Record object.");
+}
+
+
+/*    text
+      scan          -> done if there are no rows, -> row if not a scan
+      begin
+      goto row
+  sep:  sep
+  row:  (row)
+      next_row      -> sep if there is another row, -> done if not a scan
+      end
+  done:
+*/
+void ScanLoop::emit(Assembler &a) {
+  int scan, skip = -1, sep_at, row, next;
+
+  scan = a.emit(op_scan);
+  a.literals(begin);
+  if(sep->len) {
+    skip = a.emit(op_goto);
+    sep_at = a.here();
+    a.text(*sep);
+  }
+  row = a.here();
+  if(skip >= 0) a.patch(skip, row);
+  else sep_at = row;
+  core->emit(a);
+  next = a.emit(op_next_row, sep_at);
+  a.literals(end);
+  a.patch(scan, a.here());
+  a.patch2(scan, row);
+  a.patch2(next, a.here());
+}
+
+
+/*    begin
+      columns       -> cols_done if there are none
+      goto col
+  sep:  sep
+  col:  (record)
+      next_column   -> sep
+  cols_done:
+      nested        (if the format has a join)
+      end
+*/
+void RowLoop::emit(Assembler &a) {
+  int columns, skip = -1, sep_at, col;
+
+  a.row_cells(begin);
+  if(core != &the_null_node) {
+    columns = a.emit(op_columns);
+    if(sep->len) {
+      skip = a.emit(op_goto);
+      sep_at = a.here();
+      a.text(*sep);
+    }
+    col = a.here();
+    if(skip >= 0) a.patch(skip, col);
+    else sep_at = col;
+    core->emit_column(a);
+    a.emit(op_next_column, sep_at);
+    a.patch(columns, a.here());
+  }
+  if(nested) a.nested(nested, *sep);
+  a.row_cells(end);
+}
+
+
+void JoinLoop::emit(Assembler &) {
+  throw ParserError("A Join object can only be used as the format's \"join\".");
+}
+
+
+/*    begin
+      join          -> end if there are no rows
+      goto row
+  sep:  sep
+  row:  (row)
+      next_join_row -> sep
+  end:  end
+      return
+*/
+void JoinLoop::emit_subroutine(Assembler &a) {
+  int first, skip = -1, sep_at, row;
+
+  a.relation(begin);
+  first = a.emit(op_join);
+  if(sep->len) {
+    skip = a.emit(op_goto);
+    sep_at = a.here();
+    a.text(*sep);
+  }
+  row = a.here();
+  if(skip >= 0) a.patch(skip, row);
+  else sep_at = row;
+  core->emit(a);
+  a.emit(op_next_join_row, sep_at);
+  a.patch(first, a.here());
+  a.literals(end);
+  a.emit(op_return);
+}
+
+
+void MainLoop::emit(Assembler &a) {
+  a.literals(begin);
+  if(core) core->emit(a);
+  a.literals(end);
+}
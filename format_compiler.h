@@ -57,3 +57,32 @@ public:
   const char *get_error();
 };
 
+
+/* The Assembler lays out a format's program.  Adjacent text is merged 
+   into one op_text, except where a jump lands between the two.
+*/
+class Assembler {
+  ap_pool *pool;
+  apache_array<instruction> *code;
+  apache_array<int> *join_calls;
+  int label;           /* the last jump target */
+  Node *join;
+  
+public:
+  Assembler(ap_pool *p) : pool(p), label(0), join(0) {
+    code = new(p, 32) apache_array<instruction>;
+    join_calls = new(p, 4) apache_array<int>;
+  }
+  int here()  { return (label = code->size()); }
+  int emit(opcode, int jump = 0, int jump2 = 0);
+  void patch(int at, int jump)  { code->item(at).jump = jump;  }
+  void patch2(int at, int jump) { code->item(at).jump2 = jump; }
+  void text(len_string &);
+  void literals(Cell *);
+  void row_cells(Cell *);
+  void column_cells(Cell *);
+  void relation(Cell *);
+  void nested(Node *, len_string &);
+  void assemble(output_format *);
+};
+
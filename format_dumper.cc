@@ -47,7 +47,7 @@ inline void escape_conf_str(result_buffer &res, const char *str) {
 void output_format::dump_source(ap_pool *pool, result_buffer &res) {
   struct symbol *sym;
 
-  if (flag.is_raw) return;
+  if (flag.is_raw || binary) return;
   res.out("<ResultFormat \"%s\">\n", name);
   top_node->dump_source(pool, res, name);
   for(unsigned int h = 0 ; h < SYM_TAB_SZ ; h++)
@@ -75,6 +75,12 @@ void RowLoop::dump_source(ap_pool *pool, result_buffer &res, const char *fmt) {
   res.out("\n");
 }
 
+void JoinLoop::dump_source(ap_pool *pool, result_buffer &res, const char *fmt) {
+  res.out("    Join  %s = ", name);
+  escape_conf_str(res, unresolved);
+  res.out("\n");
+}
+
 void RecAttr::dump_source(ap_pool *pool, result_buffer &res, const char *fmt) {
   res.out("    Record  %s = ", name);
   escape_conf_str(res, unresolved);  
@@ -91,7 +97,8 @@ void output_format::dump(ap_pool *pool, result_buffer &res) {
           "  { \"is_internal\": %s, \"can_override\": %s, \"is_raw\": %s \n",
            name, flag.is_internal ? "true" : "false", 
            flag.can_override ? "true":"false", flag.is_raw ? "true":"false ,");
-  if(! (flag.is_raw)) top_node->dump(pool, res, 0);
+  if(binary) res.out("    \"binary\": \"%s\"\n", binary->content_type);
+  else if(! (flag.is_raw)) top_node->dump(pool, res, 0);
   res.out("  }\n}\n");
 }
 
@@ -138,6 +145,21 @@ void RecAttr::dump(ap_pool *p, result_buffer &res, int indent) {
 }
 
 
+inline void value_flags(char *flags, re_quot quote, const char **escapes) {
+  int f = 1;
+
+  flags[0] = flags[1] = flags[2] = flags[3] = 0;
+  if(escapes || (quote != no_quot)) {
+    flags[0] = '/';
+    if(quote == quote_char)                   flags[f++] = 'q';
+    else if(quote == quote_all)               flags[f++] = 'Q';
+    if(escapes == escape_leaning_toothpicks)  flags[f++] = 'j';
+    else if(escapes == escape_xml_entities)   flags[f++] = 'x';
+    else if(escapes == escape_xml_plus_json)  flags[f++] = 'k';
+  }
+}
+
+
 void Cell::dump(ap_pool *p, result_buffer &res) {
   int n = 0;
   const char *val;
@@ -158,17 +180,9 @@ void Cell::dump(ap_pool *p, result_buffer &res) {
         break;
       case item_value:
       {
-        char flags[4] = { 0, 0, 0, 0 };
-        int f = 1;
+        char flags[4];
         char *item;
-        if(c->escapes || ( c->elem_quote != no_quot)) {
-          flags[0] = '/';
-          if(c->elem_quote == quote_char)             flags[f++] = 'q';
-          else if(c->elem_quote == quote_all)         flags[f++] = 'Q';
-          if(c->escapes == escape_leaning_toothpicks) flags[f++] = 'j';
-          else if(c->escapes == escape_xml_entities)  flags[f++] = 'x';
-          else if(c->escapes == escape_xml_plus_json) flags[f++] = 'k';
-        }
+        value_flags(flags, c->elem_quote, c->escapes);
         if(c->i > 0) item = ap_psprintf(p, "$%d", c->i);
         else item = "$value";
         res.out("\"%s%s$\"", item, flags);
@@ -182,6 +196,67 @@ void Cell::dump(ap_pool *p, result_buffer &res) {
 }
 
 
+static const char *opcode_names[] = {
+  "text", "name", "value", "column_value", "relation", "scan", "next_row", 
+  "join", "next_join_row", "columns", "if_null", "next_column", "nested", 
+  "goto", "return"
+};
+
+
+/* dump_program(): list the format's compiled program, one instruction
+   per line, with its operands written as they would be in the source.
+*/
+void output_format::dump_program(ap_pool *pool, result_buffer &res) {
+  char flags[4];
+
+  if (flag.is_raw || binary) return;
+  res.out("Program \"%s\": %d instructions\n", name, program_size);
+  for(int pc = 0 ; pc < program_size ; pc++) {
+    instruction &ins = program[pc];
+    if(ins.op == op_return) {
+      res.out("%4d  %s\n", pc, opcode_names[ins.op]);
+      continue;
+    }
+    res.out("%4d  %-14s", pc, opcode_names[ins.op]);
+    value_flags(flags, ins.quote, ins.escapes);
+    switch(ins.op) {
+      case op_text:
+        res.out("\"%s\"", json_str(pool, ins.text));
+        break;
+      case op_name:
+      case op_relation:
+        value_flags(flags, ins.quote, 0);
+        res.out("$name%s$", flags);
+        break;
+      case op_value:
+        res.out("$value%s$", flags);
+        break;
+      case op_column_value:
+        res.out("$%d%s$", ins.col, flags);
+        break;
+      case op_scan:
+      case op_next_row:
+        res.out("-> %d / %d", ins.jump, ins.jump2);
+        break;
+      case op_nested:
+        res.out("\"%s\" -> %d", json_str(pool, ins.text), ins.jump);
+        break;
+      case op_join:
+      case op_next_join_row:
+      case op_columns:
+      case op_if_null:
+      case op_next_column:
+      case op_goto:
+        res.out("-> %d", ins.jump);
+        break;
+      default:
+        break;
+    }
+    res.out("\n");
+  }
+}
+
+
 const char *escape_string(ap_pool *pool, const char **escapes, len_string &str) {  
   size_t escaped_size = 0;
   register const char *esc;
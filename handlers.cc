@@ -104,9 +104,12 @@ extern "C" {
     if(!fmt)
       return ndb_handle_error(r, 404, 0, "Unknown format.\n");
  
-    /* If the request path ends in "/source", dump source */
+    /* If the request path ends in "/source", dump source; 
+       if it ends in "/program", dump the compiled program */
     if((r->path_info) && (! ap_fnmatch("*/source",r->path_info,0)))
         fmt->dump_source(r->pool, res);
+    else if((r->path_info) && (! ap_fnmatch("*/program",r->path_info,0)))
+        fmt->dump_program(r->pool, res);
     else /* dump parse tree */
       fmt->dump(r->pool, res);  
  
@@ -139,6 +142,9 @@ extern "C" {
     ap_rprintf(r, "Force restart on stale dictionary: %s\n",  
                srv->force_restart ? "Yes" : "No");
     ap_rprintf(r, "Max retry time on temporary errors: %d ms\n", srv->max_retry_ms);
+    ap_rprintf(r, "Max parallel transactions in a batch: %d\n", srv->max_parallel_tx);
+    ap_rprintf(r, "Asynchronous execution: %s\n", 
+               srv->async_execute ? "Yes" : "No");
 
     ndb_instance *i = my_instance(r);
     if(i == (ndb_instance *) 0) {
@@ -153,6 +159,12 @@ extern "C" {
     ap_rprintf(r,"Temporary Errors:   %u\n", i->stats.temp_errors);
     ap_rprintf(r,"Total retry time:   %u ms\n", i->stats.total_retry_ms);
     ap_rprintf(r,"Retry timeouts hit: %u\n", i->stats.temp_timeouts);
+    ap_rprintf(r,"Single-flight hits: %u\n", i->stats.shared_reads);
+    /* A follower counts its hit in its own thread, so also show the total */
+    unsigned int all_shared_reads = 0;
+    for(int n = 0 ; n < process.n_threads ; n++)
+      all_shared_reads += process.conn.instances[n]->stats.shared_reads;
+    ap_rprintf(r,"Single-flight hits in process: %u\n", all_shared_reads);
     
     ap_rprintf(r,"\n");
     ap_rprintf(r,"Endpoints:     %d\n", n_endp);
@@ -162,6 +174,8 @@ extern "C" {
       ap_rprintf(r,"  .. DB: %s , Table: %s , Path: %s\n",
                  dir->database, dir->table, dir->path);
     }
+    expiry_status(r, srv);
+    autoinc_status(r);
     
     return OK;
   }
@@ -173,8 +187,8 @@ extern "C" {
 */
 int ndb_handle_error(request_rec *r, int status, 
                      const NdbError *error, const char *msg) {
-  result_buffer page;
-  page.init(r, 4096);
+  /* The page is built in the request pool */
+  const char *page = "";
 
   if(error) log_debug(r->server, "Error %d %s",error->code, error->message);
   
@@ -187,32 +201,43 @@ int ndb_handle_error(request_rec *r, int status,
 
   switch(status) {
     case 400:
-      page.out("Bad request.\n");
+      page = "Bad request.\n";
       break;
     case 403:
-      page.out(msg);
+      page = msg;
       break;
     case 404:
-      page.out(msg ? msg : "No data could be found.\n");
+      page = msg ? msg : "No data could be found.\n";
       break;
     case 405:
     case 406: 
       break;  // no message
     case 409:
-      page.out("%s.\n", error->message);
+      if(msg) page = msg;
+      else page = ap_psprintf(r->pool, "%s.\n", error->message);
+      break;
+    case 412:
+      page = "Precondition failed.\n";
+      break;
+    case 413:
+      page = "Request body too large.\n";
+      break;
+    case 416:
+      page = "Requested range not satisfiable.\n";
       break;
     case 500:
-      if(msg) page.out(msg);
+      if(msg) page = msg;
       break;
     case 503:
       break;
     default:
-      page.out("HTTP return code %d.\n", status);
+      page = ap_psprintf(r->pool, "HTTP return code %d.\n", status);
   }
+  if(! page) page = "";
 
-  ap_set_content_length(r, page.sz);
+  ap_set_content_length(r, strlen(page));
   ap_send_http_header(r);
-  ap_rwrite(page.buff, page.sz, r);
+  ap_rputs(page, r);
 
   return DONE; 
 }
@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
     rules, it puts the vtable and object code in Query.o
 */
 
+#include "ndb_api_compat.h"
+
 class index_object {
   protected:
     int key_part;
@@ -163,3 +165,50 @@ public:
 };
 
 
+
+
+#ifdef HAVE_NDB_SPJ
+/* The root of a pushed-down join is a primary key or unique index lookup, 
+   or a table scan.  Rather than setting key parts on an NdbOperation, it 
+   collects them as parameters for NdbTransaction::createQuery(), in the 
+   order of the index's columns.
+*/
+class Pushed_join_object : public index_object {
+  private:
+    ap_pool *pool;
+  public:
+    NdbTransaction *tx;
+    const void **params;
+    
+    Pushed_join_object(struct QueryItems *queryitems, request_rec *r) :
+      index_object(queryitems, r) { pool = r->pool; } ;
+    
+    NdbOperation *get_ndb_operation(NdbTransaction *t) {
+      log_debug(server, "Using pushed-down join");
+      tx = t;
+      if(q->plan == PrimaryKey) n_parts = q->tab->getNoOfPrimaryKeys();
+      else if(q->plan == UniqueIndexAccess) n_parts = q->idx->getNoOfColumns();
+      else n_parts = 0;
+      params = (const void **) ap_pcalloc(pool, (n_parts + 1) * sizeof(void *));
+      return 0;
+    };
+
+    const NdbDictionary::Column *get_column(base_expr &) {
+      return (q->plan == PrimaryKey ? 
+              q->tab->getColumn(q->tab->getPrimaryKey(key_part)) :
+              q->idx->getColumn(key_part));
+    };
+
+    /* The mvalue is reused for the next key part, so keep a copy */
+    int set_key_part(int, mvalue &mval) {
+      if(mval.use_value == use_char) 
+        params[key_part] = mval.u.val_char;
+      else {
+        void *v = ap_palloc(pool, sizeof(mval.u));
+        memcpy(v, & mval.u, sizeof(mval.u));
+        params[key_part] = v;
+      }
+      return 0;
+    };
+};
+#endif
@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "httpd.h"
 #include "http_config.h"
 #include "http_protocol.h"
+#include "http_request.h"
 #include "http_main.h"
 #include "util_script.h"
 #include "ap_config.h"
@@ -67,6 +68,8 @@ namespace log {
 namespace config {
   class key_col;
   class index;
+  struct join;
+  struct expand;
 };
  
 
@@ -108,21 +111,109 @@ enum AccessPlan {  /* Ways of executing an NDB query */
 */
 
 
-/* An operation */
+class NdbQueryDef;        // Pushed-down joins (MySQL Cluster 7.2)
+class NdbQuery;
+class NdbQueryOperation;
+
+/* The prepared NdbQueryDef of an endpoint's pushed-down join.  Each 
+   ndb_instance keeps one per endpoint, built by the first request and 
+   reused after that; it is built again if a request's root is a different
+   lookup (a different plan or index), and dropped after a dictionary error.
+*/
+struct join_def {
+  const NdbQueryDef *def;
+  AccessPlan root_plan;
+  const NdbDictionary::Index *root_idx;
+};
+
+/* One entry in the column table of an operation.  Before its results are
+   written, each result column gets its encoder, whether "/q" quotes it, 
+   and its name already in double quotes.
+*/
+struct column_encoder {
+  MySQL::result *result;
+  MySQL::encoder encode;
+  bool is_char_type;
+  len_string name;
+};
+
+
+/* An operation.  
+   In a pushed-down join, the endpoint's table is the root data_operation,
+   which holds the NdbQuery, and each joined table is a child data_operation, 
+   linked into a tree under its parent.
+   An expanded nested resource ("?expand=") is also a child data_operation,
+   read in the same transaction after its parent.
+*/
 struct data_operation {
   NdbOperation *op;
   NdbIndexScanOperation *scanop;
   unsigned int n_result_cols;
   MySQL::result **result_cols;
+  struct column_encoder *columns;
   char **aliases;
   output_format *fmt;
+  NdbQuery *query;
+  NdbQueryOperation *queryop;
+  const char *relation;
+  struct data_operation *child;
+  struct data_operation *sibling;
+  const char *expand;           // "?expand=" list, read after this op
+  config::dir *endpoint;        // (set only along with expand)
+  NdbRecAttr *expiry;           // "ExpireOn" column, read by a lookup
+  NdbBlob *blob;                // "StreamBlobs", read by stream_blob()
   struct {
     unsigned int has_blob    : 1;
     unsigned int select_star : 1;
+    unsigned int is_scan     : 1;
+    unsigned int stream_blob : 1;
+    unsigned int deflated    : 1;   // raw "Compress" blob sent as deflate
+    unsigned int stream_rows : 1;   // Arrow scan sent a batch at a time
   } flag;
 };
 
 
+/* An independent read transaction within a batch of subrequests */
+struct tx_group {
+  const NdbDictionary::Table *tab;
+  NdbTransaction *tx;
+};
+
+
+struct flight;      // single-flight read, defined in single_flight.cc
+class ndb_instance;
+void single_flight_abandon(ndb_instance *);
+void release_join_defs(ndb_instance *);
+
+
+/* The result objects of an ndb_instance, the arrays that point to them, 
+   and the data_operations of joined tables are carved from its slab 
+   (result_slab.cc), which cleanup() rewinds all at once.  Only results
+   that hold a blob buffer need to be destroyed one by one.
+*/
+struct slab_chunk;
+struct slab_blob;
+
+class result_slab {
+  struct slab_chunk *first;
+  struct slab_chunk *current;
+  struct slab_blob *blobs;
+  public:
+  void init(ap_pool *, int max_read_operations);
+  void *alloc(size_t);
+  MySQL::result **new_array(unsigned int n) {
+    return (MySQL::result **) alloc(n * sizeof(MySQL::result *));
+  }
+  MySQL::result *new_result(NdbOperation *, const NdbDictionary::Column *,
+                            block_pool *);
+  MySQL::result *new_result(NdbQueryOperation *, 
+                            const NdbDictionary::Column *, block_pool *);
+  void reset();
+  private:
+  MySQL::result *keep(MySQL::result *);
+};
+
+
 /* An "NDB Instance" is a private per-thread data structure
    that manages an Ndb object, a transaction, an array of 
    operations, and some statistics.
@@ -132,13 +223,23 @@ class ndb_instance {
   struct mod_ndb_connection *conn;  
   Ndb *db;
   NdbTransaction *tx;
+  struct tx_group *groups;
+  int n_groups;
   int n_read_ops;
   config::srv *server_config;
   struct data_operation *data;
+  struct flight *flight;
+  struct join_def *join_defs;       // by endpoint (config::dir::endpoint)
+  struct block_pool blocks;        // free blocks for result pages
+  result_slab results;             // result objects of the current request
   struct {
     unsigned int aborted     : 1 ;
     unsigned int use_etag    : 1 ;
     unsigned int jsonrequest : 1 ;
+    unsigned int has_writes  : 1 ;
+    unsigned int has_join    : 1 ;
+    unsigned int has_expand  : 1 ;
+    unsigned int expanding   : 1 ;
   } flag;
   struct {
     unsigned int requests;
@@ -146,15 +247,25 @@ class ndb_instance {
     unsigned int temp_errors; 
     unsigned int total_retry_ms;
     unsigned int temp_timeouts;
+    unsigned int shared_reads;
   } stats;
   void cleanup() {
-    for(unsigned n = 0 ; n < data->n_result_cols ; n++) 
-      delete data->result_cols[n];
+    if(flight) single_flight_abandon(this);
+    results.reset();
     bzero(data, n_read_ops * sizeof(struct data_operation));
     n_read_ops    =    0;
     flag.aborted  =    0;
     flag.use_etag =    0;
     flag.jsonrequest = 0;
+    flag.has_writes  = 0;
+    flag.has_join    = 0;
+    flag.has_expand  = 0;
+    flag.expanding   = 0;
+  }
+  void close_tx_groups() {
+    for(int n = 0 ; n < n_groups ; n++) 
+      groups[n].tx->close();
+    n_groups = 0;
   }
 };
 
@@ -192,15 +303,44 @@ Ndb * init_instance(ndb_connection *, ndb_instance *, server_rec *,
 int print_all_params(void *v, const char *key, const char *val);
 apr_table_t *http_param_table(request_rec *r, const char *c);
 int ExecuteAll(request_rec *, ndb_instance *);
+int stream_blob(request_rec *, ndb_instance *);
+bool is_compressed_column(config::dir *, const char *);
+len_string *deflate_value(ap_pool *, len_string *);
+bool accepts_deflate(request_rec *);
+void send_deflated(request_rec *, result_buffer &);
+bool handle_exec_error(request_rec *, int &, const char * &, const NdbError &);
+int expand_all(request_rec *, ndb_instance *);
 int read_request_body(request_rec *, apr_table_t **, const char *);
 void initialize_output_formats(ap_pool *);
 char *register_format(ap_pool *, output_format *);
 output_format *get_format_by_name(const char *);
+output_format *choose_format(request_rec *, output_format *);
 void register_built_in_formatters(ap_pool *);
 int build_results(request_rec *, data_operation *, result_buffer &);
 int ndb_handle_error(request_rec *, int, const NdbError *, const char *);
 const char * allowed_methods(request_rec *, config::dir *);
 void module_must_restart(void);
+void initialize_single_flight(ap_pool *);
+int single_flight_wait(request_rec *, ndb_instance *, const char *);
+void single_flight_land(ndb_instance *, int, result_buffer *, const char *);
+void create_expiry_lock(ap_pool *, server_rec *);
+void start_expiry_reaper(server_rec *, ap_pool *);
+void stop_expiry_reaper(void);
+void expiry_status(request_rec *, config::srv *);
+const char *expiry_now(ap_pool *, const NdbDictionary::Column *, time_t);
+bool row_has_expired(const NdbRecAttr *, time_t);
+int next_auto_inc(ndb_instance *, const NdbDictionary::Table *, Uint64 &);
+void start_autoinc_refiller(server_rec *, ap_pool *);
+void stop_autoinc_refiller(void);
+void autoinc_status(request_rec *);
+
+/* The error code of an update whose If-Match or N-SQL "IF" condition fails
+   (interpret_exit_nok(), in the range reserved for application errors) */
+#define PRECONDITION_FAILED_ERROR 6412
+
+/* The error code of an arithmetic update ("@+N,max=M") that would pass 
+   its bound */
+#define GUARD_FAILED_ERROR 6409
 
 extern "C" int cmp_swap_int(int *, int, int);
 extern "C" int cmp_swap_ptr(void *, void *, void *);
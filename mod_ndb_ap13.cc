@@ -25,6 +25,7 @@ ndb_instance *instance1;
 struct mod_ndb_process process;
 int ndb_force_send = 1;
 int will_restart = 0;
+extern int n_endp;                          /* from config.cc */
 
 //
 // INITIALIZATION & CLEAN-UP FUNCTIONS:
@@ -53,6 +54,12 @@ void mod_ndb_child_init(server_rec *s, pool *p) {
   /* Create an ndb instance */
   instance1 = (ndb_instance *) ap_pcalloc(p, sizeof(ndb_instance));
   init_instance(& process.conn, instance1, s, srv, p);
+
+  /* ExpireOn can hide expired rows, but not delete them, in Apache 1.3 */
+  start_expiry_reaper(s, p);
+
+  /* Size of the Ndb object's auto-increment cache */
+  start_autoinc_refiller(s, p);
 }
 
 
@@ -71,8 +78,10 @@ void mod_ndb_child_exit(server_rec *s, pool *p) {
       /* These were allocated by the C++ runtime, so let C++ free them,
          e.g. during "apachectl graceful"
       */    
-      for(i = c->instances[n] ; n < process.n_threads ; n++)
+      for(i = c->instances[n] ; n < process.n_threads ; n++) {
+          release_join_defs(i);
           delete i->db;
+      }
       delete c->connection;
 
       if(c->connected)
@@ -143,7 +152,7 @@ Ndb *init_instance(ndb_connection *c, ndb_instance *i, server_rec *s,
   
   if(i->db) {
     /* init(n) where n is max no. of active transactions; default is 4 */
-    i->db->init();
+    i->db->init(srv_config->max_parallel_tx + 1);
   }
   
   /* i->conn is a pointer back to the parent connection */
@@ -159,6 +168,18 @@ Ndb *init_instance(ndb_connection *c, ndb_instance *i, server_rec *s,
   /* i->data is an array of data_operations */
   i->data = (struct data_operation *) 
     ap_pcalloc(p, srv_config->max_read_operations * sizeof(struct data_operation));
+
+  /* i->results is the slab for result objects */
+  i->results.init(p, srv_config->max_read_operations);
+
+  /* i->join_defs holds each endpoint's prepared pushed-down join */
+  i->join_defs = (struct join_def *) 
+    ap_pcalloc(p, n_endp * sizeof(struct join_def));
+
+  /* i->groups is an array of independent read transactions */
+  i->groups = (struct tx_group *) 
+    ap_pcalloc(p, srv_config->max_parallel_tx * sizeof(struct tx_group));
+  i->n_groups = 0;
   
   return i->db;
 }
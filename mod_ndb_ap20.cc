@@ -27,6 +27,7 @@ apr_status_t mod_ndb_child_exit(void *);
 
 int will_restart = 0;
 apr_thread_mutex_t *restart_lock;
+extern int n_endp;                          /* from config.cc */
 
 
 //
@@ -48,6 +49,7 @@ int mod_ndb_post_config(apr_pool_t* conf_pool, apr_pool_t* log_pool,
 
   ndb_init();    
   connect_to_cluster(& process.conn, s, srv, temp_pool, true);
+  create_expiry_lock(conf_pool, s);
 
   if( process.conn.connected) {    
     log_err(s, "Connnection test OK: succesfully connected to NDB Cluster."); 
@@ -118,11 +120,22 @@ void mod_ndb_child_init(ap_pool *p, server_rec *s) {
     log_err(s, "mod_ndb cannot connect to cluster.");
   
   
+  /* Start the expiry reaper thread */
+  if(process.conn.connected)
+    start_expiry_reaper(s, p);
+
+  /* Start the auto-increment refill thread */
+  start_autoinc_refiller(s, p);
+
   /* Register the exit handler */
   apr_pool_cleanup_register(p, (const void *) s, 
                             mod_ndb_child_exit, mod_ndb_child_exit);
                             
 
+  /* Threads in this process can share identical reads */
+  if(apache_is_threaded) 
+    initialize_single_flight(p);
+
   /* We have one mutex, used when forcing the module to restart. */
   apr_thread_mutex_create(&restart_lock, APR_THREAD_MUTEX_UNNESTED, p);
 
@@ -141,6 +154,8 @@ apr_status_t mod_ndb_child_exit(void *v) {
   
   if(c->connection != 0) {
     id = c->connection->node_id();
+    stop_expiry_reaper();
+    stop_autoinc_refiller();
       
     /* These were allocated by the C++ runtime, so let C++ free them,
         e.g. during "apachectl graceful"
@@ -148,6 +163,7 @@ apr_status_t mod_ndb_child_exit(void *v) {
     for(int n = 0; n < process.n_threads ; n++) {
       ndb_instance *i = process.conn.instances[n];
       if(i && i->db) {
+        release_join_defs(i);
         delete i->db;
         n_destroyed++;
       }
@@ -234,8 +250,9 @@ Ndb *init_instance(ndb_connection *c, ndb_instance *i, server_rec *s,
   i->db = new Ndb(c->connection);
 
   if(i->db) {
-    /* init(n) where n is max no. of active transactions; default is 4 */
-    if(i->db->init(2) == -1) {  // Error 
+    /* init(n) where n is max no. of active transactions; default is 4.
+       A batch can use up to max_parallel_tx at once, plus one spare. */
+    if(i->db->init(srv->max_parallel_tx + 1) == -1) {  // Error 
       ap_log_error(APLOG_MARK, log::err, 0, s, "Ndb::init() failed: %d %s", 
       i->db->getNdbError().code, i->db->getNdbError().message);
 
@@ -255,6 +272,18 @@ Ndb *init_instance(ndb_connection *c, ndb_instance *i, server_rec *s,
   /* i->data is an array of operations */
   i->data = (struct data_operation *) 
     ap_pcalloc(p, srv->max_read_operations * sizeof(struct data_operation));
+
+  /* i->results is the slab for result objects */
+  i->results.init(p, srv->max_read_operations);
+
+  /* i->join_defs holds each endpoint's prepared pushed-down join */
+  i->join_defs = (struct join_def *) 
+    ap_pcalloc(p, n_endp * sizeof(struct join_def));
+
+  /* i->groups is an array of independent read transactions */
+  i->groups = (struct tx_group *) 
+    ap_pcalloc(p, srv->max_parallel_tx * sizeof(struct tx_group));
+  i->n_groups = 0;
     
   return i->db;
 }
@@ -68,6 +68,9 @@ typedef apr_array_header_t array_header;
 
 #define ap_fnmatch apr_fnmatch
 
+/* Sub-requests take an output filter */
+#define sub_req_lookup_uri(u,r) ap_sub_req_lookup_uri(u,r,NULL)
+
 /* The timeout functions are gone, because of a new I/O model */
 #define ap_hard_timeout(a,b) ;
 #define ap_reset_timeout(a) ;
@@ -88,6 +91,8 @@ typedef table apr_table_t;
 
 #include "fnmatch.h"
 
+#define sub_req_lookup_uri(u,r) ap_sub_req_lookup_uri(u,r)
+
 /* Apache 1.3 logging defines */
 #define my_ap_log_error(l,s,fmt,arg) ap_log_error(APLOG_MARK,l,s,fmt,arg);
 #define log_err(s, ... ) ap_log_error(APLOG_MARK, log::err, s, __VA_ARGS__ );
@@ -77,8 +77,14 @@ namespace config {
   struct srv {
     char *connect_string;
     int max_read_operations;
+    int max_parallel_tx;
     unsigned int max_retry_ms;
     unsigned int force_restart;
+    unsigned int async_execute;
+    int expiry_rate;
+    int expiry_batch;
+    int autoinc_min_range;
+    int autoinc_max_range;
     unsigned int magic_number;
   };
     
@@ -90,7 +96,18 @@ namespace config {
     int pathinfo_size;
     short *pathinfo;
     output_format *fmt;
+    char *version_col;
+    char *expire_col;            // "ExpireOn"
+    char *expire_index;
     int incr_prefetch;
+    unsigned long max_body;      // "MaxRequestBody"
+    char *blob_upload;           // "BlobUpload"
+    unsigned long max_upload;
+    apache_array<char*> *compressed;  // "Compress"
+    unsigned int set_max_rows;   // set-based DELETE and UPDATE ("SetLimit")
+    unsigned int set_max_ms;
+    unsigned int set_batch;
+    int endpoint;                // its index in all_endpoints
     short default_key;
     struct {
       unsigned pathinfo_always  : 1;
@@ -99,6 +116,10 @@ namespace config {
       unsigned use_etags        : 1;
       unsigned allow_delete     : 1;
       unsigned select_star      : 1;
+      unsigned single_flight    : 1;
+      unsigned return_updates   : 1;
+      unsigned stream_blobs     : 1; // raw format reads blobs in chunks
+      unsigned set_ops          : 1; // writes can use a scan plan
       unsigned is_resolved      : 1; // basic optimizer has run 
     } flag;
     struct index *index_scan;
@@ -107,6 +128,9 @@ namespace config {
     apache_array<char*> *aliases;
     apache_array<config::index> *indexes;
     apache_array<config::key_col> *key_columns;
+    apache_array<config::join> *joins;
+    apache_array<config::expand> *expansions;
+    NSQL::Expr *conditions;      // N-SQL "UPDATE ... IF"
     unsigned int magic_number;
   };
   
@@ -123,6 +147,35 @@ namespace config {
     } flag;
     NSQL::Expr *constants;
   };
+
+  /* A table joined to an endpoint with N-SQL "JOIN ... ON".
+     The join is pushed down to the data nodes as one NdbQuery.  */
+  struct join {
+    char *relation;      // name of the nested rows in the result
+    char *database;
+    char *table;
+    short parent;        // index in dir->joins, or -1 for the endpoint's table
+    char idx_type;       // 'P', 'U', or 'O', as in build_index_record()
+    char *idx_name;
+    struct {
+      unsigned outer       : 1;
+      unsigned select_star : 1;
+    } flag;
+    apache_array<char*> *child_cols;   // ON child_col = parent_col
+    apache_array<char*> *parent_cols;
+    apache_array<char*> *visible;
+    apache_array<char*> *aliases;
+  };
+
+  /* A nested resource, declared with "Expand".  A GET with "?expand=name"
+     reads the child endpoint at path, using the parent row's values of
+     parent_cols as the child's key parameters child_params.  */
+  struct expand {
+    char *relation;
+    char *path;
+    apache_array<char*> *parent_cols;
+    apache_array<char*> *child_params;
+  };
   
   void * init_dir(ap_pool *, char *);
   void * init_srv(ap_pool *, server_rec *);
@@ -135,6 +188,10 @@ namespace config {
   const char * result_format(cmd_parms *, void *, char *);
   const char * pathinfo(cmd_parms *, void *, char *, char *);
   const char * table(cmd_parms *, void *, char *, char *, char *);
+  const char * set_limit(cmd_parms *, void *, char *, char *, char *);
+  const char * expire_on(cmd_parms *, void *, char *, char *);
+  const char * max_request_body(cmd_parms *, void *, char *);
+  const char * blob_upload(cmd_parms *, void *, char *, char *);
   const char * filter(cmd_parms *, void *, char *, char *, char *);
   const char * primary_key(cmd_parms *, void *, char *);
   const char * connectstring(cmd_parms *, void *, char *);
@@ -142,6 +199,12 @@ namespace config {
   const char * result_fmt_container(cmd_parms *, void *, char *);
   const char * sql_container(cmd_parms *, void *, char *);
   const char * index_constant(cmd_parms*,config::dir*, char *, NSQL::Expr *);
+  const char * write_condition(cmd_parms *, config::dir *, NSQL::Expr *);
   short get_index_by_name(config::dir *, const char *);
   short build_index_record(cmd_parms*,config::dir*, char *, const char*);
+  const char * join_table(cmd_parms *, config::dir *, char *, char *, char *, int);
+  const char * join_index(cmd_parms *, config::dir *, char *, char *);
+  const char * join_link(cmd_parms *, config::dir *, char *, char *, char *, char *);
+  const char * join_columns(cmd_parms *, config::dir *, apache_array<char*> *);
+  const char * expansion(cmd_parms *, void *, char *);
 }
@@ -17,6 +17,9 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA 
 */
 
+#ifndef _NDB_API_COMPAT_H
+#define _NDB_API_COMPAT_H
+
 /* There are two versions of Ndb::getAutoIncrementValue().
    If this version of mysql uses the old API, wrap the new one
    around the call. 
@@ -29,8 +32,12 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define AUTOINC_V2
 #endif
 
+/* From 5.1.16, each operation can have its own AbortOption, so that
+   (for instance) one lookup that finds no row does not abort the others.
+*/
 #if MYSQL_VERSION_ID > 50115 
 #define TX_ABORT_OPT NdbOperation::DefaultAbortOption
+#define HAVE_OP_ABORT_OPTION
 #else
 #define TX_ABORT_OPT NdbTransaction::AbortOnError
 #endif
@@ -48,4 +55,32 @@ inline int get_auto_inc_value(Ndb *ndb,
                               Uint64 &next_value, Uint32 prefetch) {
   return ndb->getAutoIncrementValue(tab, next_value, prefetch);
 }
+
+/* The new API can also reserve a range of values that belongs to the 
+   caller, rather than to the Ndb object's own cache.  On success, 
+   the range is [first, first + count - 1].
+*/
+#define HAVE_AUTOINC_RANGE
+inline int get_auto_inc_range(Ndb *ndb,
+                              const NdbDictionary::Table *tab,
+                              Uint64 &first, Uint32 &count) {
+  Ndb::TupleIdRange range;
+  range.reset();
+  if(ndb->getAutoIncrementValue(tab, range, first, count))
+    return -1;
+  count = (range.m_last_tuple_id > first) ?
+          (Uint32) (range.m_last_tuple_id - first + 1) : 1;
+  return 0;
+}
 #endif
+
+#include "ndb_version.h"
+
+/* Pushed-down joins (NdbQueryBuilder and NdbQuery, which the data nodes
+   run in the SPJ block) are available from MySQL Cluster 7.2.
+*/
+#if NDB_VERSION_D >= NDB_MAKE_VERSION(7,2,0)
+#define HAVE_NDB_SPJ
+#endif
+
+#endif  /* _NDB_API_COMPAT_H */
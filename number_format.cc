@@ -0,0 +1,366 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "mod_ndb.h"
+
+/* Numeric values in result pages.
+   These result_buffer methods replace out("%d", ...) and the other printf 
+   formats for every integer and floating point column, and write the 
+   number straight into the buffer.  
+
+   Integers are written two digits at a time from a table.  So are the
+   fixed-width fields of dates, times, and decimals, with put_digits().
+
+   Floats and doubles are written with the fewest digits that will read 
+   back as the same value, found with Florian Loitsch's Grisu2 algorithm
+   ("Printing Floating-Point Numbers Quickly and Accurately with Integers",
+   PLDI 2010).  The layout is the one "%G" uses -- plain decimal, unless 
+   the exponent is below -4 or too large, and then "1.5E+20" -- but no 
+   digits are lost to %G's default precision of six.
+*/
+
+static const char DIGIT_PAIRS[201] = 
+  "00010203040506070809" "10111213141516171819"
+  "20212223242526272829" "30313233343536373839"
+  "40414243444546474849" "50515253545556575859"
+  "60616263646566676869" "70717273747576777879"
+  "80818283848586878889" "90919293949596979899";
+
+static const Uint64 POW10[20] = { 
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 
+  10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL, 
+  100000000000ULL, 1000000000000ULL, 10000000000000ULL, 
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 
+  100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+
+inline int count_digits(Uint64 n) {
+  int d = 1;
+  
+  for(;;) {
+    if(n < 10) return d;
+    if(n < 100) return d + 1;
+    if(n < 1000) return d + 2;
+    if(n < 10000) return d + 3;
+    n /= 10000;
+    d += 4;
+  }
+}
+
+
+/* write_digits(): write n so that its last digit is just before end */
+inline void write_digits(char *end, Uint64 n) {
+  unsigned int i;
+
+  while(n >= 100) {
+    i = (unsigned int) (n % 100) * 2;
+    n /= 100;
+    *--end = DIGIT_PAIRS[i + 1];
+    *--end = DIGIT_PAIRS[i];
+  }
+  if(n >= 10) {
+    i = (unsigned int) n * 2;
+    *--end = DIGIT_PAIRS[i + 1];
+    *--end = DIGIT_PAIRS[i];
+  }
+  else *--end = '0' + (char) n;
+}
+
+
+void result_buffer::out_uint(unsigned long long n) {
+  int len = count_digits(n);
+
+  if(! prepare(len)) return;
+  write_digits(buff + sz + len, n);
+  sz += len;
+}
+
+
+/* put_digits(): like putc(), expects space that has already been 
+   prepare()d.  Writes n with at least width digits, padded with zeros;
+   a width of 0 writes just the digits of n.
+*/
+void result_buffer::put_digits(unsigned int n, int width) {
+  int digits = count_digits(n);
+  char *p = buff + sz;
+
+  while(width-- > digits) *p++ = '0';
+  p += digits;
+  write_digits(p, n);
+  sz = p - buff;
+}
+
+
+void result_buffer::out_int(long long n) {
+  Uint64 u = (Uint64) n;
+
+  if(n < 0) {
+    if(! prepare(1)) return;
+    putc('-');
+    u = 0 - u;
+  }
+  out_uint(u);
+}
+
+
+/**** Grisu2 ****/
+
+namespace {
+  /* A "do-it-yourself floating point" number: f * 2^e */
+  struct diy_fp {
+    Uint64 f;
+    int e;
+    diy_fp() {}
+    diy_fp(Uint64 _f, int _e) : f(_f) , e(_e) {}
+  };
+
+  inline diy_fp normalize(diy_fp x) {
+    while(! (x.f & 0xFFFFFFFF00000000ULL)) { x.f <<= 32; x.e -= 32; }
+    while(! (x.f & 0xFF00000000000000ULL)) { x.f <<= 8;  x.e -= 8;  }
+    while(! (x.f & 0x8000000000000000ULL)) { x.f <<= 1;  x.e -= 1;  }
+    return x;
+  }
+
+  /* The upper 64 bits of the product, rounded */
+  inline diy_fp multiply(const diy_fp &x, const diy_fp &y) {
+    const Uint64 M32 = 0xFFFFFFFFULL;
+    Uint64 a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+    Uint64 ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    Uint64 tmp = (bd >> 32) + (ad & M32) + (bc & M32) + (1ULL << 31);
+    return diy_fp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64);
+  }
+
+  /* Powers of ten, 10^-348 to 10^340 in steps of 8, 
+     normalized to 64-bit significands */
+  const Uint64 CACHED_POWERS_F[87] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+  0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+  0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+  0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+  0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+  0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+  0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+  0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+  0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+  0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+  0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+  0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+  0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+  0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+  0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+  0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+  0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+  0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+  0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+  0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+  0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+  0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+  };
+
+  const short CACHED_POWERS_E[87] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066
+  };
+
+  /* cached_power(): find a power of ten 10^-K that brings a number with
+     binary exponent e into the range where digit_gen() can work on it 
+  */
+  inline diy_fp cached_power(int e, int &K) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int) dk;
+    if(dk - k > 0.0) k++;
+    unsigned int index = (unsigned int) ((k >> 3) + 1);
+    K = - (-348 + (int) (index << 3));
+    return diy_fp(CACHED_POWERS_F[index], CACHED_POWERS_E[index]);
+  }
+
+  inline void grisu_round(char *digits, int len, Uint64 delta, Uint64 rest,
+                          Uint64 ten_kappa, Uint64 wp_w) {
+    while(rest < wp_w && delta - rest >= ten_kappa &&
+          (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+      digits[len - 1]--;
+      rest += ten_kappa;
+    }
+  }
+
+  void digit_gen(const diy_fp &W, const diy_fp &Mp, Uint64 delta,
+                 char *digits, int &len, int &K) {
+    const diy_fp one(1ULL << -Mp.e, Mp.e);
+    const Uint64 wp_w = Mp.f - W.f;
+    Uint32 p1 = (Uint32) (Mp.f >> -one.e);
+    Uint64 p2 = Mp.f & (one.f - 1);
+    int kappa = count_digits(p1);
+    Uint32 d;
+
+    len = 0;
+    while(kappa > 0) {
+      d = p1 / (Uint32) POW10[kappa - 1];
+      p1 %= (Uint32) POW10[kappa - 1];
+      if(d || len) digits[len++] = '0' + (char) d;
+      kappa--;
+      Uint64 rest = ((Uint64) p1 << -one.e) + p2;
+      if(rest <= delta) {
+        K += kappa;
+        grisu_round(digits, len, delta, rest, POW10[kappa] << -one.e, wp_w);
+        return;
+      }
+    }
+
+    for(;;) {
+      p2 *= 10;
+      delta *= 10;
+      d = (Uint32) (p2 >> -one.e);
+      if(d || len) digits[len++] = '0' + (char) d;
+      p2 &= one.f - 1;
+      kappa--;
+      if(p2 < delta) {
+        K += kappa;
+        grisu_round(digits, len, delta, p2, one.f,
+                    wp_w * (-kappa < 20 ? POW10[-kappa] : 0));
+        return;
+      }
+    }
+  }
+
+  /* grisu2(): the shortest digits for f * 2^e, which has the rounding 
+     interval of a float or double.  The value is digits * 10^K.  
+  */
+  void grisu2(Uint64 f, int e, bool lower_closer, char *digits, int &len, int &K) {
+    diy_fp plus = normalize(diy_fp((f << 1) + 1, e - 1));
+    diy_fp minus = lower_closer ? diy_fp((f << 2) - 1, e - 2) 
+                                : diy_fp((f << 1) - 1, e - 1);
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    diy_fp c_mk = cached_power(plus.e, K);
+    diy_fp W  = multiply(normalize(diy_fp(f, e)), c_mk);
+    diy_fp Wp = multiply(plus, c_mk);
+    diy_fp Wm = multiply(minus, c_mk);
+    Wm.f++;
+    Wp.f--;
+    digit_gen(W, Wp, Wp.f - Wm.f, digits, len, K);
+  }
+
+  /* layout(): write digits * 10^K, as "%G" would lay it out, at dst.
+     Returns the length.
+  */
+  int layout(char *dst, const char *digits, int len, int K) {
+    char *p = dst;
+    int exp10 = len + K - 1;   /* exponent of the first digit */
+    
+    if(exp10 >= -4 && exp10 < 17) {
+      if(K >= 0) {                          /* 1500 */
+        memcpy(p, digits, len);  p += len;
+        memset(p, '0', K);       p += K;
+      }
+      else if(exp10 >= 0) {                 /* 1.5 */
+        memcpy(p, digits, exp10 + 1);  p += exp10 + 1;
+        *p++ = '.';
+        memcpy(p, digits + exp10 + 1, len - exp10 - 1);  p += len - exp10 - 1;
+      }
+      else {                                /* 0.0015 */
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -exp10 - 1);  p += -exp10 - 1;
+        memcpy(p, digits, len);      p += len;
+      }
+    }
+    else {                                  /* 1.5E+20 */
+      *p++ = digits[0];
+      if(len > 1) {
+        *p++ = '.';
+        memcpy(p, digits + 1, len - 1);  p += len - 1;
+      }
+      *p++ = 'E';
+      *p++ = exp10 < 0 ? '-' : '+';
+      if(exp10 < 0) exp10 = - exp10;
+      if(exp10 < 10) *p++ = '0';
+      p += count_digits(exp10);
+      write_digits(p, exp10);
+    }
+    return p - dst;
+  }
+}
+
+
+/* out_fp(): the common part of out_float() and out_double().  
+   The value is (-1)^neg * f * 2^e.
+*/
+inline void out_fp(result_buffer &rbuf, bool neg, Uint64 f, int e, 
+                   bool lower_closer) {
+  char digits[24];
+  int len, K;
+
+  if(! rbuf.prepare(32)) return;
+  if(neg) rbuf.putc('-');
+  if(f == 0) {
+    rbuf.putc('0');
+    return;
+  }
+  grisu2(f, e, lower_closer, digits, len, K);
+  rbuf.sz += layout(rbuf.buff + rbuf.sz, digits, len, K);
+}
+
+
+void result_buffer::out_double(double d) {
+  Uint64 bits;
+  memcpy(&bits, &d, sizeof(bits));
+  int biased_e = (int) (bits >> 52) & 0x7FF;
+  Uint64 frac = bits & 0x000FFFFFFFFFFFFFULL;
+  bool neg = bits >> 63;
+
+  if(biased_e == 0x7FF)
+    return out(frac ? "NAN" : neg ? "-INF" : "INF");
+  if(biased_e)
+    out_fp(*this, neg, frac | (1ULL << 52), biased_e - 1075, 
+           frac == 0 && biased_e > 1);
+  else 
+    out_fp(*this, neg, frac, -1074, false);
+}
+
+
+void result_buffer::out_float(float v) {
+  Uint32 bits;
+  memcpy(&bits, &v, sizeof(bits));
+  int biased_e = (int) (bits >> 23) & 0xFF;
+  Uint32 frac = bits & 0x007FFFFF;
+  bool neg = bits >> 31;
+
+  if(biased_e == 0xFF)
+    return out(frac ? "NAN" : neg ? "-INF" : "INF");
+  if(biased_e)
+    out_fp(*this, neg, frac | (1 << 23), biased_e - 150, 
+           frac == 0 && biased_e > 1);
+  else 
+    out_fp(*this, neg, frac, -149, false);
+}
@@ -17,6 +17,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 #include "mod_ndb.h"
+#include "ndb_api_compat.h"
+#include "binary_format.h"
 
 
 /* Globals */
@@ -28,6 +30,7 @@ apr_table_t *global_format_names = 0;
 apache_array<struct output_format *> *global_output_formats = 0;
 
 extern Node the_null_node;  /* from format_compiler.cc */
+extern const struct binary_syntax msgpack_syntax, cbor_syntax, arrow_syntax;
 
 
 void initialize_output_formats(ap_pool *p) {
@@ -127,6 +130,9 @@ void register_built_in_formatters(ap_pool *p) {
   output_format *json_format = new(p) output_format("JSON");
   output_format *raw_format  = new(p) output_format("raw");
   output_format *xml_format  = new(p) output_format("XML");
+  output_format *msgpack_format = new(p) output_format("MessagePack");
+  output_format *cbor_format = new(p) output_format("CBOR");
+  output_format *arrow_format = new(p) output_format("Arrow");
   const char *err;
   
   /* Define the raw format */
@@ -144,6 +150,7 @@ void register_built_in_formatters(ap_pool *p) {
   json_format->symbol("row",  p, new(p) RowLoop(" { $item$ , ... }"));
   json_format->symbol("item", p, new(p) RecAttr(
                                        "$name/Q$:$value/qj$","$name/Q$:null"));
+  json_format->symbol("join", p, new(p) JoinLoop("$name/Q$:[ $row$ , ... ]"));
   json_format->top_node = Main;
   err = json_format->compile(p);
   if(err) {
@@ -162,6 +169,8 @@ void register_built_in_formatters(ap_pool *p) {
   xml_format->symbol("attr", p, new(p) RecAttr(
                                     "<Attr name=$name/Q$ value=$value/Qx$ />",
                                     "<Attr name=$name/Q$ isNull=\"1\" />"));
+  xml_format->symbol("join", p, new(p) JoinLoop(
+                                    "<NDBJoin name=$name/Q$>\n$row$\n...\n</NDBJoin>"));
   xml_format->top_node = Main;
   err = xml_format->compile(p);
   if(err) {
@@ -169,9 +178,46 @@ void register_built_in_formatters(ap_pool *p) {
     exit(1);
   }  
   
+  /* Define the binary formats */
+  msgpack_format->flag.is_internal = 1;
+  msgpack_format->binary = & msgpack_syntax;
+  cbor_format->flag.is_internal = 1;
+  cbor_format->binary = & cbor_syntax;
+  arrow_format->flag.is_internal = 1;
+  arrow_format->binary = & arrow_syntax;
+  
   register_format(p, raw_format);
   register_format(p, json_format);
   register_format(p, xml_format);
+  register_format(p, msgpack_format);
+  register_format(p, cbor_format);
+  register_format(p, arrow_format);
+}
+
+
+/* choose_format(): A client can ask for a binary format in the Accept 
+   header, in place of an endpoint's text format.  Set the Content-Type
+   of a binary format.
+*/
+output_format *choose_format(request_rec *r, output_format *fmt) {
+  const char *accept = ap_table_get(r->headers_in, "Accept");
+  const char *wanted = 0;
+  
+  if(accept && ! (fmt->flag.is_raw || fmt->binary)) {
+    if(ap_strcasestr(accept, "application/msgpack") 
+       || ap_strcasestr(accept, "application/x-msgpack"))
+      wanted = "MessagePack";
+    else if(ap_strcasestr(accept, "application/cbor"))
+      wanted = "CBOR";
+    else if(ap_strcasestr(accept, "application/vnd.apache.arrow.stream"))
+      wanted = "Arrow";
+    if(wanted) {
+      fmt = get_format_by_name(wanted);
+      ap_table_mergen(r->headers_out, "Vary", "Accept");
+    }
+  }
+  if(fmt->binary) r->content_type = fmt->binary->content_type;
+  return fmt;
 }
 
 
@@ -181,8 +227,10 @@ int Results_raw(request_rec *r, data_operation *data,
                 result_buffer &res) {
   const MySQL::result *result = data->result_cols[0];  
 
-  if(result && result->contents) 
+  if(result && result->contents) {
     res.overlay(result->contents);  
+    if(data->flag.deflated) send_deflated(r, res);
+  }
   else {
     log_err(r->server, "Cannot use raw output format at %s", r->uri);
     return 500;
@@ -191,115 +239,328 @@ int Results_raw(request_rec *r, data_operation *data,
 }
 
 
-int build_results(request_rec *r, data_operation *data, result_buffer &res) {
-  output_format *fmt = data->fmt;
-  int result_code;
-  
-  if(fmt->flag.is_raw) return Results_raw(r, data, res);
-  res.init(r, 8192);
-  for(Node *N = fmt->top_node; N != 0 ; N=N->next_node) {
-    result_code = N->Run(data, res);
-    if(result_code != OK) return result_code;
-  }
-  return OK;
+/**** The interpreter ****/
+
+inline void write_name(const char *name, re_quot quote, result_buffer &res) {
+  size_t len = strlen(name);
+
+  if(quote == no_quot) return res.out(len, name);
+  if(! res.prepare(len + 2)) return;
+  res.putc('"');
+  res.out(len, name);
+  res.putc('"');
 }
- 
 
-void Cell::out(struct data_operation *data, result_buffer &res) {
-  if(elem_type == const_string) 
-    return this->out(res);
-  if(i > data->n_result_cols) return; //error?
-  this->out(data, i-1, res);
-  return;
+
+/* A column name is stored with its quotes */
+inline void write_name(const len_string &quoted, re_quot quote, 
+                       result_buffer &res) {
+  if(quote == no_quot) res.out(quoted.len - 2, quoted.string + 1);
+  else res.out(quoted.len, quoted.string);
 }
 
 
-void Cell::out(data_operation *data, unsigned int n, result_buffer &res) {
-  if(elem_type == const_string) {
-    res.out(len, string);
-    return;
+inline void write_value(const column_encoder &c, const instruction *ins,
+                        result_buffer &res) {
+  if(ins->quote == quote_all || (ins->quote == quote_char && c.is_char_type)) {
+    res.out(1, "\"");
+    c.encode(*c.result, res, ins->escapes);
+    res.out(1, "\"");
   }
+  else c.encode(*c.result, res, ins->escapes);
+}
+
 
-  MySQL::result *result = data->result_cols[n];  
-  const char *col_name = data->flag.select_star ? 
-    result->getColumn()->getName() : data->aliases[n] ;
-    
-  NdbDictionary::Column::Type col_type = result->getColumn()->getType();
-  switch(elem_type) {
-    case item_name:
-      if(elem_quote == no_quot) 
-        res.out(strlen(col_name), col_name);
-      else
-        res.out("\"%s\"",col_name);
-      break;
-    case item_value:          
-      if((elem_quote == quote_all) || 
-         ((elem_quote == quote_char)
-          && (col_type == NdbDictionary::Column::Char        ||
-              col_type == NdbDictionary::Column::Varchar     ||
-              col_type == NdbDictionary::Column::Longvarchar ||
-              col_type == NdbDictionary::Column::Date        ||
-              col_type == NdbDictionary::Column::Time        ||
-              col_type == NdbDictionary::Column::Datetime    ||
-              col_type == NdbDictionary::Column::Text 
-              ))) {
-        /* Quoted Value */
-        res.out(1,"\"");
-        result->out(res, escapes);
-        res.out(1,"\"");            
-      }
-      else result->out(res, escapes);  /* No Quotes */
-      break;
+/* With "/q", only character and temporal values are quoted */
+inline bool quote_char_type(NdbDictionary::Column::Type col_type) {
+  switch(col_type) {
+    case NdbDictionary::Column::Char:
+    case NdbDictionary::Column::Varchar:
+    case NdbDictionary::Column::Longvarchar:
+    case NdbDictionary::Column::Date:
+    case NdbDictionary::Column::Time:
+    case NdbDictionary::Column::Datetime:
+    case NdbDictionary::Column::Text:
+      return true;
     default:
-      assert(0);      
-  } /* end of switch statement */      
+      return false;
+  }
+}
+
+
+/* build_column_table(): set up the column table of an operation and of 
+   its joined tables, so that writing a value needs no lookups.  For a 
+   binary format, each column gets a packer and its name as a map key.
+   Arrow has no packers; its writer chooses an appender for each column.
+*/
+void build_column_table(ap_pool *p, data_operation *data, 
+                        const binary_syntax *binary) {
+  data->columns = (column_encoder *) 
+    ap_palloc(p, data->n_result_cols * sizeof(column_encoder));
+
+  for(unsigned int n = 0 ; n < data->n_result_cols ; n++) {
+    column_encoder &c = data->columns[n];
+    MySQL::result *result = data->result_cols[n];
+    const char *name = data->flag.select_star ? 
+      result->getColumn()->getName() : data->aliases[n];
+    size_t len = strlen(name);
+    char *quoted;
+
+    c.result = result;
+    if(binary) {
+      c.encode = MySQL::result::choose_packer(result->getColumn()->getType(),
+                                              binary->id);
+      binary->key(p, name, c.name);
+      continue;
+    }
+    quoted = (char *) ap_palloc(p, len + 3);
+    quoted[0] = '"';
+    memcpy(quoted + 1, name, len);
+    quoted[len + 1] = '"';
+    quoted[len + 2] = 0;
+    c.encode = result->encode;
+    c.is_char_type = quote_char_type(result->getColumn()->getType());
+    c.name.string = quoted;
+    c.name.len = len + 2;
+  }
+  for(data_operation *child = data->child; child ; child = child->sibling)
+    build_column_table(p, child, binary);
 }
 
 
-void RecAttr::out(data_operation *data, unsigned int n, result_buffer &res) {
-  Cell *c = data->result_cols[n]->isNull() ?  null_fmt : fmt;
-  for( ; c != 0 ; c=c->next) 
-    c->out(data, n, res);
+/* Rows of the main query.  nextResult(true) fetches rows from NDB into 
+   cache; nextResult(false) uses rows already cached.
+*/
+enum { no_rows, got_row, not_a_scan };
+
+inline int first_row(data_operation *data) {
+#ifdef HAVE_NDB_SPJ
+  if(data->query) {   /* a pushed-down join */
+    if(data->query->nextResult(true) != NdbQuery::NextResult_gotRow)
+      return no_rows;
+    return data->flag.is_scan ? got_row : not_a_scan;
+  }
+#endif
+  if(data->scanop) 
+    return (data->scanop->nextResult(true) == 0) ? got_row : no_rows;
+  return not_a_scan;   /* just a single result row */
 }
 
 
-int MainLoop::Run(data_operation *data, result_buffer &res) {
-  int status = OK;
-  if(begin) begin->out(res);
-  if(core)  status = core->Run(data, res);
-  if(end)   end->out(res);
-  return status;
+inline bool next_row(data_operation *data) {
+#ifdef HAVE_NDB_SPJ
+  if(data->query)
+    return data->query->nextResult(false) == NdbQuery::NextResult_gotRow
+        || data->query->nextResult(true) == NdbQuery::NextResult_gotRow;
+#endif
+  return data->scanop->nextResult(false) == 0 
+      || data->scanop->nextResult(true) == 0;
 }
 
 
-int ScanLoop::Run(data_operation *data, result_buffer &res) {
-  register int nrows = 0;
+/* Rows of a joined table or an expanded nested resource that belong to 
+   the current row of its parent: any number of rows from a scan, or at
+   most one from a lookup.
+*/
+inline bool first_join_row(data_operation *data) {
+  if(data->scanop)            /* nested resource: a scan */
+    return data->scanop->nextResult(true) == 0;
+  if(data->op)                /* nested resource: a lookup */
+    return data->op->getNdbError().classification == NdbError::NoError;
+#ifdef HAVE_NDB_SPJ
+  if(data->flag.is_scan) 
+    return data->queryop->firstResult() == NdbQuery::NextResult_gotRow;
+  return ! data->queryop->isRowNULL();
+#endif
+  return false;
+}
+
+
+inline bool next_join_row(data_operation *data) {
+  if(data->scanop) 
+    return data->scanop->nextResult(false) == 0 
+        || data->scanop->nextResult(true) == 0;
+#ifdef HAVE_NDB_SPJ
+  if(! data->op && data->flag.is_scan)
+    return data->queryop->nextResult() == NdbQuery::NextResult_gotRow;
+#endif
+  return false;
+}
+
+
+/* run_program(): run a format's program from pc until op_return.
+   Returns 404 if a scan found no rows.
+*/
+int run_program(const instruction *program, int pc, data_operation *data,
+                result_buffer &res) {
+  const instruction *ins;
+  unsigned int n = 0;      /* the current column */
+  unsigned int m;
+  bool scanning = false;
+  int status = OK;
   
-  if(data->scanop) {
-    /* nextResult(true) fetches rows from NDB into cache ;
-       nextResult(false) uses rows already cached */ 
-    while((data->scanop->nextResult(true)) == 0) {
-      do {
-        if(nrows++) res.out(*sep);    /* comma */
-          else begin->chain_out(res); /* open bracket */
-        core->Run(data, res);
-      } while((data->scanop->nextResult(false)) == 0);      
+  for(;;) {
+    ins = program + pc++;
+    switch(ins->op) {
+      case op_text:
+        res.out(ins->text.len, ins->text.string);
+        break;
+      case op_name:
+        write_name(data->columns[n].name, ins->quote, res);
+        break;
+      case op_value:
+        write_value(data->columns[n], ins, res);
+        break;
+      case op_column_value:
+        if(ins->col && ins->col <= data->n_result_cols) 
+          write_value(data->columns[ins->col - 1], ins, res);
+        break;
+      case op_relation:
+        write_name(data->relation, ins->quote, res);
+        break;
+      case op_scan:
+        switch(first_row(data)) {
+          case got_row:
+            scanning = true;
+            break;
+          case no_rows:
+            status = 404;
+            pc = ins->jump;
+            break;
+          case not_a_scan:
+            scanning = false;
+            pc = ins->jump2;
+        }
+        break;
+      case op_next_row:
+        if(! scanning) pc = ins->jump2;
+        else if(next_row(data)) pc = ins->jump;
+        break;
+      case op_join:
+        if(! first_join_row(data)) pc = ins->jump;
+        break;
+      case op_next_join_row:
+        if(next_join_row(data)) pc = ins->jump;
+        break;
+      case op_columns:
+        n = 0;
+        if(! data->n_result_cols) pc = ins->jump;
+        break;
+      case op_if_null:
+        if(data->columns[n].result->isNull()) pc = ins->jump;
+        break;
+      case op_next_column:
+        if(++n < data->n_result_cols) pc = ins->jump;
+        break;
+      case op_nested:
+        m = data->n_result_cols;
+        for(data_operation *child = data->child; child ; child = child->sibling) {
+          if(m++) res.out(ins->text.len, ins->text.string);
+          run_program(program, ins->jump, child, res);
+        }
+        break;
+      case op_goto:
+        pc = ins->jump;
+        break;
+      case op_return:
+        return status;
     }
-    if(nrows) end->chain_out(res);   /* close bracket */
-    return (nrows ? OK : 404);
   }
-  else {  /* not a scan, just a single result row */
-    return core->Run(data, res);
+}
+
+
+/**** The binary formats ****/
+
+/* A row is a map from column names to values, followed by the name of
+   each joined table with an array of its rows.  A scan is an array of 
+   rows; a single-row result is just the row.
+*/
+template <class S> void write_row(data_operation *, result_buffer &);
+
+template <class S> void write_join(data_operation *data, result_buffer &res) {
+  unsigned char *rows;
+  unsigned int n = 0;
+
+  put_str<S>(res, strlen(data->relation), data->relation);
+  rows = open_array<S>(res);
+  if(first_join_row(data)) 
+    do {
+      write_row<S>(data, res);
+      n++;
+    } while(next_join_row(data));
+  close_array<S>(res, rows, n);
+}
+
+
+template <class S> void write_row(data_operation *data, result_buffer &res) {
+  unsigned int n, n_joins = 0;
+  data_operation *child;
+  
+  for(child = data->child; child ; child = child->sibling) n_joins++;
+  put_map<S>(res, data->n_result_cols + n_joins);
+  for(n = 0 ; n < data->n_result_cols ; n++) {
+    column_encoder &c = data->columns[n];
+    res.out(c.name);
+    if(c.result->isNull()) put_nil<S>(res);
+    else c.encode(*c.result, res, 0);
   }
+  for(child = data->child; child ; child = child->sibling) 
+    write_join<S>(child, res);
 }
 
 
-int RowLoop::Run(data_operation *data, result_buffer &res) {
-  begin->chain_out(data, res);
-  for(unsigned int n = 0; n < data->n_result_cols ; n++) {
-    if(n) res.out(*sep);
-    core->out(data, n, res);
+template <class S> int write_page(request_rec *, data_operation *data, 
+                                  result_buffer &res) {
+  unsigned char *rows;
+  unsigned int n = 0;
+
+  switch(first_row(data)) {
+    case not_a_scan:
+      write_row<S>(data, res);
+      return OK;
+    case no_rows:
+      put_array<S>(res, 0);
+      return 404;
   }
-  end->chain_out(data, res);
+  rows = open_array<S>(res);
+  do {
+    write_row<S>(data, res);
+    n++;
+  } while(next_row(data));
+  close_array<S>(res, rows, n);
   return OK;
 }
+
+
+template <class S> void write_key(ap_pool *p, const char *name, 
+                                  len_string &key) {
+  size_t len = strlen(name);
+  unsigned char *k = (unsigned char *) ap_palloc(p, len + MAX_BINARY_HEAD);
+  int head = S::str_head(k, len);
+
+  memcpy(k + head, name, len);
+  key.string = (const char *) k;
+  key.len = head + len;
+}
+
+
+const struct binary_syntax msgpack_syntax = { 
+  syntax_msgpack, "application/msgpack", 
+  write_key<MessagePack>, write_page<MessagePack> 
+};
+
+const struct binary_syntax cbor_syntax = { 
+  syntax_cbor, "application/cbor", 
+  write_key<CBOR>, write_page<CBOR> 
+};
+
+
+int build_results(request_rec *r, data_operation *data, result_buffer &res) {
+  output_format *fmt = data->fmt;
+  
+  if(fmt->flag.is_raw) return Results_raw(r, data, res);
+  res.init(r, & my_instance(r)->blocks);
+  build_column_table(r->pool, data, fmt->binary);
+  if(fmt->binary) return fmt->binary->write_page(r, data, res);
+  return run_program(fmt->program, 0, data, res);
+}
@@ -19,13 +19,66 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 enum re_type { const_string, item_name, item_value };
 enum re_esc  { no_esc, esc_xml, esc_json, esc_xmljson };
 enum re_quot { no_quot, quote_char, quote_all };
-enum node_type { top_node, loop_node, simple_node };
+enum node_type { top_node, loop_node, simple_node, nested_node };
 
 const char **get_escapes(re_esc);
+#define MAX_ESCAPE_LEN 6   /* the longest escape sequence, e.g. "&quot;" */
 const char *json_str(ap_pool *, len_string &);
 
 class Node;
 class RecAttr;
+class Assembler;
+struct data_operation;
+
+
+/* The binary formats, "MessagePack", "CBOR", and "Arrow", are built in.
+   They have no format description and no program; build_results() calls
+   the format's page writer instead.  The key of each column -- its name,
+   encoded for the format -- is made once, when the column table is built.
+*/
+enum binary_syntax_id { syntax_msgpack, syntax_cbor, syntax_arrow };
+
+struct binary_syntax {
+  binary_syntax_id id;
+  const char *content_type;
+  void (*key)(ap_pool *, const char *, len_string &);
+  int (*write_page)(request_rec *, data_operation *, result_buffer &);
+};
+
+
+/* output_format::compile() also assembles the format into a flat program,
+   which build_results() runs once for each result page.  An instruction
+   with a "jump" goes there when its condition holds; op_scan and 
+   op_next_row go to "jump2" when the query is not a scan.
+*/
+enum opcode { 
+  op_text,            /* write text */
+  op_name,            /* the name of the current column */
+  op_value,           /* the value of the current column */
+  op_column_value,    /* the value of column "col", counting from 1 */
+  op_relation,        /* the name of a joined table */
+  op_scan,            /* fetch the first row; jump if there is none */
+  op_next_row,        /* fetch the next row; jump if there is one */
+  op_join,            /* the first row of a joined table; jump if none */
+  op_next_join_row,   /* the next row of a joined table; jump if any */
+  op_columns,         /* go to the first column; jump if there are none */
+  op_if_null,         /* jump if the current column is null */
+  op_next_column,     /* go to the next column; jump if there is one */
+  op_nested,          /* for each joined table, write text (but not 
+                         before the first item), and call jump */
+  op_goto,
+  op_return
+};
+
+struct instruction {
+  opcode op;
+  re_quot quote;
+  const char **escapes;
+  len_string text;
+  unsigned int col;
+  int jump;
+  int jump2;
+};
 
 struct symbol {
   Node *node;
@@ -46,11 +99,15 @@ public:
   Node *top_node;
   struct symbol *symbol_table[SYM_TAB_SZ];
   int charset_id;
+  instruction *program;
+  int program_size;
+  const struct binary_syntax *binary;
   output_format(const char *n) : name(n) {}
   Node * symbol(const char *, ap_pool *, Node *);
   const char *compile(ap_pool *);
   void dump(ap_pool *, result_buffer &);
   void dump_source(ap_pool *, result_buffer &);
+  void dump_program(ap_pool *, result_buffer &);
 };
 
 
@@ -69,15 +126,6 @@ class Cell : public len_string {
   Cell(size_t size, const char *txt) : len_string(size,txt) {
     elem_type = const_string; 
   }
-  void out(result_buffer &res) { res.out(len,string); }
-  void out(struct data_operation *, result_buffer &);
-  void out(struct data_operation *, unsigned int, result_buffer &); 
-  void chain_out(struct data_operation *data, result_buffer &res) {
-    for(Cell *c = this; c != 0 ; c = c->next) c->out(data,res);
-  }
-  void chain_out(result_buffer &res) {
-    for(Cell *c = this; c != 0 ; c = c->next)  c->out(res);    
-  }
   void dump(ap_pool *, result_buffer &);
 };
 
@@ -94,10 +142,8 @@ class Node : public apache_object {
   Node(const char *n, Cell *cell) : name(n), cell(cell), next_node(0) {}
   virtual ~Node() {}
   virtual void compile(output_format *);
-  virtual int  Run(struct data_operation *d, result_buffer &b) { 
-    cell->out(d,b); return OK; }
-  virtual void out(struct data_operation *d, unsigned int n, result_buffer &b) {
-    cell->out(d, n, b); }
+  virtual void emit(Assembler &);
+  virtual void emit_column(Assembler &);
   virtual void dump(ap_pool *, result_buffer &, int);
   virtual void dump_source(ap_pool *, result_buffer &, const char *) {};
 };
@@ -109,8 +155,9 @@ class RecAttr : public Node {
 
   public:
   RecAttr(const char *str1, const char *str2) : Node(str1, simple_node), unresolved2(str2) {}
-  void out(struct data_operation *, unsigned int, result_buffer &);
   void compile(output_format *);
+  void emit(Assembler &);
+  void emit_column(Assembler &);
   void dump(ap_pool *, result_buffer &, int);
   void dump_source(ap_pool *, result_buffer &, const char *);
 };
@@ -126,17 +173,18 @@ class Loop : public Node {
   public:
   Loop(const char *c, node_type t = loop_node) : Node(c, t) {}
   void compile(output_format *);
+  void emit_column(Assembler &);
   void dump(ap_pool *, result_buffer &, int);
   void dump_source(ap_pool *, result_buffer &, int) { assert(0); };
 };
 
 
 class RowLoop : public Loop {
+  Node *nested;
 public: 
-  RowLoop(const char *c) : Loop(c) {}
-  int Run(struct data_operation *, result_buffer &);
-  void compile(output_format *o) { return Loop::compile(o); }
-  void out(const NdbRecAttr &, result_buffer &) { assert(0); }
+  RowLoop(const char *c) : Loop(c), nested(0) {}
+  void compile(output_format *);
+  void emit(Assembler &);
   void dump(ap_pool *p, result_buffer &r, int i) { Loop::dump(p,r,i); }
   void dump_source(ap_pool *, result_buffer &, const char *);
 };
@@ -145,10 +193,27 @@ public:
 class ScanLoop : public Loop {  
 public:
   ScanLoop(const char *c) : Loop(c) {}
-  int Run(struct data_operation *, result_buffer &);
   void compile(output_format *o) { return Loop::compile(o); }
+  void emit(Assembler &);
+  void dump(ap_pool *p, result_buffer &r, int i) { Loop::dump(p,r,i); }
+  void dump_source(ap_pool *, result_buffer &, const char *);
+};
+
+
+/* A JoinLoop writes the rows of one joined table (or one expanded nested
+   resource) inside its parent row.
+   Its begin text can contain $name$, which is the name of the relation.
+   Every Row node nests the rows of its joined tables, using the format's
+   JoinLoop named "join", if there is one.  The join is assembled once, as
+   a subroutine that each Row calls with the data_operation of the table.
+*/
+class JoinLoop : public Loop {
+public:
+  JoinLoop(const char *c) : Loop(c, nested_node) {}
+  void compile(output_format *);
+  void emit(Assembler &);
+  void emit_subroutine(Assembler &);
   void dump(ap_pool *p, result_buffer &r, int i) { Loop::dump(p,r,i); }
-  void out(const NdbRecAttr &, result_buffer &) { assert(0); } 
   void dump_source(ap_pool *, result_buffer &, const char *);
 };
 
@@ -156,9 +221,8 @@ public:
 class MainLoop : public Loop {
   public: 
   MainLoop(const char *c) : Loop(c, top_node) {}
-  int Run(struct data_operation *, result_buffer &);
   void compile(output_format *);
+  void emit(Assembler &);
   void dump(ap_pool *, result_buffer &r, int i);
-  void out(const NdbRecAttr &, result_buffer &) { assert(0); }
   void dump_source(ap_pool *, result_buffer &, const char *);
 };  
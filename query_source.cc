@@ -65,6 +65,10 @@ Apache_subrequest_query_source::Apache_subrequest_query_source(request_rec *req)
 {
   r = req;
   keep_tx_open = true;
+  is_upload = false;
+  suspended = 0;
+  args = r->args;
+  path_info = r->path_info;
   const char *note = ap_table_get(r->main->notes,"ndb_request_method");
   if(note)  {
     if(!strcmp(note,"POST")) req_method = M_POST;
@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #define FORM_TABLE_SIZE 16
 
 class BLOB;   // forward declaration
+struct body_reader;
 
 class query_source : public apache_object {
  protected:
@@ -29,7 +30,10 @@ class query_source : public apache_object {
   int req_method;
   const char *content_type;
   bool keep_tx_open;
-  const unsigned char *databuffer;
+  bool is_upload;        // the body is left unread, for "BlobUpload"
+  body_reader *suspended;  // a multipart body, stopped at the upload
+  const char *args;
+  const char *path_info;
 
   void set_item(const char *name, const char *val) {
     set_item(name, val, strlen(val));
@@ -52,6 +56,10 @@ class HTTP_query_source : public query_source {
     req_method = r->method_number;
     content_type = ap_table_get(r->headers_in, "Content-Type");
     keep_tx_open = false;
+    is_upload = false;
+    suspended = 0;
+    args = r->args;
+    path_info = r->path_info;
   };
     
   int get_form_data();
@@ -64,3 +72,27 @@ class Apache_subrequest_query_source : public query_source {
   Apache_subrequest_query_source(request_rec *);
   int get_form_data();
 };
+
+
+/* The read of a nested resource ("?expand=").  It runs in the parent 
+   request's transaction, with key parameters built from the parent row.
+*/
+class Expansion_query_source : public query_source {
+  public:
+  Expansion_query_source(request_rec *req, const char *child_args) {
+    r = req;
+    req_method = M_GET;
+    content_type = 0;
+    keep_tx_open = true;
+    is_upload = false;
+    suspended = 0;
+    args = child_args;
+    path_info = "";
+  };
+  int get_form_data() { return OK; }
+};
+
+
+/* Stream the request body into a BLOB, in request_body.cc */
+int upload_blob(query_source *, NdbTransaction *, NdbBlob *, unsigned long,
+                NdbError &);
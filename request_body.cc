@@ -17,13 +17,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 
-/* util_read() and some other code in this file is originally from mod_hello.cc, 
+/* Some of the code in this file was originally from mod_hello.cc, 
    which is available from http://www.modperl.com/book/source/ without any 
    attached copyright notice or licensing restrictions.
    Originally by Doug MacEachern.
 */
 
 #include "JSON/Parser.h"
+#include "ndb_api_compat.h"
+#ifdef THIS_IS_APACHE2
+#include "util_filter.h"
+#endif
 
 #ifdef MOD_NDB_DEBUG
 int walk_tab(void *rec, const char *k, const char *v) {
@@ -36,22 +40,94 @@ int walk_tab(void *rec, const char *k, const char *v) {
 #define DEBUG_LOG_TABLE(A, B)
 #endif
 
-typedef int BODY_READER(query_source *, apr_pool_t *, int);
+/* The request body is read a piece at a time -- in Apache 2, a bucket at
+   a time from the input filters; in Apache 1.3, with ap_get_client_block() 
+   -- so a chunked body is read just like one with a Content-Length, and no
+   body larger than the endpoint's MaxRequestBody is ever held in memory.
+
+   Each piece is handed to the reader for the content-type, which consumes
+   what it can from the front of the body_buffer and leaves the rest: the
+   form reader takes every complete key=value pair, while the JSON reader 
+   waits for the whole body.  Whatever is left over is copied into the
+   body's own buffer, which grows as needed.  A body that arrives in one
+   piece, as a small body usually does, is parsed where it lies.
+   A reader that needs more than the query_source finds it in the context.
+
+   A reader can also suspend the body, as the multipart reader does when
+   it reaches the file part at a BlobUpload endpoint.  The body_reader
+   keeps its place, and upload_blob() resumes it once the operation that
+   will receive the file has been defined.
+*/
+struct body_buffer {
+  const char *data;     /* the part that has not been consumed yet */
+  size_t len;
+  char *space;          /* the body's own buffer */
+  size_t size;
+  bool in_space;        /* data points into space */
+  bool at_end;          /* this is the last piece */
+  void *context;
+};
+
+typedef int BODY_READER(query_source *, apr_pool_t *, body_buffer &);
+
+/* A reader can stop before the end of the body, returning BODY_SUSPENDED;
+   then the body_reader keeps everything that has been read, and a later
+   call to read_body() goes on from there.
+*/
+#define BODY_SUSPENDED  (-10)
+
+struct body_reader {
+  BODY_READER *reader;
+  body_buffer body;
+  unsigned long limit;
+  unsigned long total;
+  bool started;
+  bool seen_eos;
+};
+
+
+body_reader *new_body_reader(apr_pool_t *pool, BODY_READER *reader,
+                             void *context, unsigned long limit) {
+  body_reader *br = (body_reader *) ap_pcalloc(pool, sizeof(body_reader));
+  br->reader = reader;
+  br->body.context = context;
+  br->limit = limit;
+  return br;
+}
 
 /* read_urlencoded(): for application/x-www-form-urlencoded
    key1=val1&key2=val2...
  */
-int read_urlencoded(query_source *qsource, apr_pool_t *pool, int) {
-  const char *key, *val;  
-  const unsigned char * &data = qsource->databuffer;
+int read_urlencoded(query_source *qsource, apr_pool_t *pool, 
+                    body_buffer &body) {
+  const char *end, *eq;
+  char *key, *val;
   
-  while(*data && (val = ap_getword(pool, (const char **) & data, '&'))) {
-    key = ap_getword(pool, &val, '=');
+  while(body.len) {
+    end = (const char *) memchr(body.data, '&', body.len);
+    if(! end) {
+      if(! body.at_end) break;    /* wait for the rest of this pair */
+      end = body.data + body.len;
+    }
+    if(end > body.data) {
+      eq = (const char *) memchr(body.data, '=', end - body.data);
+      if(eq) {
+        key = ap_pstrndup(pool, body.data, eq - body.data);
+        val = ap_pstrndup(pool, eq + 1, end - eq - 1);
+      }
+      else {
+        key = ap_pstrndup(pool, body.data, end - body.data);
+        val = ap_pstrndup(pool, end, 0);
+      }
     
-    ap_unescape_url((char*)key);
-    ap_unescape_url((char*)val);
+      ap_unescape_url(key);
+      ap_unescape_url(val);
     
-    qsource->set_item(key, val);
+      qsource->set_item(key, val);
+    }
+    if(end < body.data + body.len) end++;   /* the '&' */
+    body.len -= end - body.data;
+    body.data = end;
   }  
   return OK;
 }
@@ -60,14 +136,18 @@ int read_urlencoded(query_source *qsource, apr_pool_t *pool, int) {
 /* read_jsonrequest(): for application/jsonrequest
    The JSON parser is generated by Coco from JSON/JSON.atg
  */
-int read_jsonrequest(query_source *qsource, apr_pool_t *pool, int length) {
-  JSON::Scanner scanner(qsource->databuffer, length);
+int read_jsonrequest(query_source *qsource, apr_pool_t *pool, 
+                     body_buffer &body) {
+  if(! body.at_end) return OK;    /* the parser needs the whole body */
+
+  JSON::Scanner scanner((const unsigned char *) body.data, body.len);
   JSON::Parser parser(&scanner);
   
   parser.pool = pool;
   parser.qsource = qsource;
   
   parser.Parse();
+  body.len = 0;
   
   if(parser.errors->count) {
     log_debug(qsource->r->server,"JSON parser: %d errors.  Returning 400.", 
@@ -78,48 +158,462 @@ int read_jsonrequest(query_source *qsource, apr_pool_t *pool, int length) {
 }
 
 
+/* A streamed BLOB upload ("BlobUpload").  The blob belongs to the 
+   request's single write operation, which has already been executed with 
+   NoCommit; the transaction is committed afterwards in ExecuteAll().
+*/
+struct blob_upload {
+  NdbTransaction *tx;
+  NdbBlob *blob;
+  Uint64 written;
+  Uint64 flushed;       /* written as of the last NoCommit execute */
+  Uint32 inline_size;
+  Uint32 part_size;
+  NdbError error;
+};
+
+
+/* blob_write():
+   Each call to writeData() ends on a part boundary -- the end of the inline 
+   bytes, or of a part -- so that NDB can send whole parts without holding 
+   a partial one back; only the last piece of the blob ends anywhere.  An 
+   execute(NoCommit) after every BLOB_UPLOAD_FLUSH bytes sends the parts to
+   the data nodes, so that the NDB send buffer stays small.
+   Returns the number of bytes written (from the front of data), or -1.
+ */
+long blob_write(blob_upload *up, const char *data, size_t len, bool last) {
+  Uint64 end = up->written + len;
+  size_t n;
+
+  if(! last) {
+    if(end < up->inline_size) return 0;
+    end = up->inline_size + 
+          ((end - up->inline_size) / up->part_size) * up->part_size;
+  }
+  if((n = end - up->written) == 0) return 0;
+
+  if(up->blob->writeData(data, n)) {
+    up->error = up->blob->getNdbError();
+    return -1;
+  }
+  up->written = end;
+
+  if(up->written - up->flushed >= BLOB_UPLOAD_FLUSH) {
+    if(up->tx->execute(NdbTransaction::NoCommit, TX_ABORT_OPT)) {
+      up->error = up->tx->getNdbError();
+      return -1;
+    }
+    up->flushed = up->written;
+  }
+  return n;
+}
+
+
+/* write_blob(): for the raw body of a BlobUpload
+ */
+int write_blob(query_source *qsource, apr_pool_t *pool, body_buffer &body) {
+  long n = blob_write((blob_upload *) body.context, body.data, body.len,
+                      body.at_end);
+  if(n < 0) return 500;
+  body.data += n;
+  body.len -= n;
+  return OK;
+}
 
-int util_read(request_rec *r, const unsigned char **rbuf, int *len)
-{
-  int rc = OK;
+
+/* multipart/form-data (RFC 2388)
+   Every part follows a delimiter: CRLF, "--", and the boundary.  The 
+   reader finds each candidate CR with memchr(), which scans quickly, and
+   compares the rest with memcmp().  A part's data is passed on as soon as
+   it is read, except for a short tail that could be the start of the next
+   delimiter.
+
+   A text part -- or a file for an ordinary column -- becomes a form item.
+   But a file for the endpoint's BlobUpload column is written into the blob
+   as it arrives.  The reader suspends at the start of the file's data, so
+   that Query() can set up the write with the items read so far, and then
+   upload_blob() resumes it.  Items after the file are ignored.
+*/
+enum { MP_PREAMBLE, MP_DELIMITER, MP_HEADERS, MP_DATA, MP_END };
+enum { TO_ITEM, TO_BLOB, TO_NOWHERE };
+
+struct multipart {
+  char *delim;              /* CRLF "--" boundary */
+  size_t delim_len;
+  int state;
+  int dest;
+  const char *name;         /* the current part */
+  char *val;
+  size_t val_len;
+  size_t val_size;
+  const char *blob_col;     /* "BlobUpload" */
+  bool blob_seen;
+  blob_upload *upload;      /* set when upload_blob() resumes the reader */
+};
+
+
+/* scan(): find pat in data */
+inline const char *scan(const char *data, size_t len, 
+                        const char *pat, size_t pat_len) {
+  const char *p = data, *end = data + len;
   
-  if ((rc = ap_setup_client_block(r, REQUEST_CHUNKED_ERROR))) {
-    return rc;    // To do: accept chunked transfers?
+  while(end - p >= (long) pat_len && 
+        (p = (const char *) memchr(p, *pat, end - p - pat_len + 1)) != 0) {
+    if(! memcmp(p + 1, pat + 1, pat_len - 1)) return p;
+    p++;
   }
+  return 0;
+}
+
+
+multipart *new_multipart(request_rec *r, const char *content_type,
+                         config::dir *dir) {
+  const char *b = ap_strcasestr(content_type, "boundary=");
+  const char *end;
+  multipart *mp;
   
-  if (ap_should_client_block(r)) {
-    char argsbuffer[HUGE_STRING_LEN];
-    int rsize, len_read, rpos=0;
-    long length = r->remaining;
-    *rbuf = (const unsigned char *) ap_pcalloc(r->pool, length + 1); 
-    
-    ap_hard_timeout("util_read", r);
-    
-    while ((len_read =
-            ap_get_client_block(r, argsbuffer, sizeof(argsbuffer))) > 0) {
-      ap_reset_timeout(r);
-      if ((rpos + len_read) > length) {
-        rsize = length - rpos;
+  if(! b) return 0;
+  b += 9;
+  if(*b == '"') end = strchr(++b, '"');
+  else for(end = b ; *end && *end != ';' && *end != ' ' ; end++);
+  if(! end || end == b || end - b > 70) return 0;
+
+  mp = (multipart *) ap_pcalloc(r->pool, sizeof(multipart));
+  mp->delim = ap_pstrcat(r->pool, "\r\n--", ap_pstrndup(r->pool, b, end - b),
+                         NULL);
+  mp->delim_len = strlen(mp->delim);
+  mp->blob_col = dir->blob_upload;
+  return mp;
+}
+
+
+/* part_headers(): 
+   Get the name from the Content-Disposition header, and decide where the
+   part goes.
+*/
+void part_headers(apr_pool_t *pool, multipart *mp, const char *h, 
+                  const char *end) {
+  const char *line, *eol, *p, *q;
+  bool is_file = false;
+
+  mp->name = 0;
+  for(line = h ; line < end ; line = eol + 2) {
+    if(! (eol = scan(line, end - line, "\r\n", 2))) break;
+    if(strncasecmp(line, "Content-Disposition:", 20)) continue;
+    for(p = line + 20 ; p < eol ; p++) {
+      if(*p != ';') continue;
+      while(p + 1 < eol && p[1] == ' ') p++;
+      if(! strncasecmp(p + 1, "filename=", 9)) is_file = true;
+      else if(! strncasecmp(p + 1, "name=\"", 6)) {
+        p += 7;
+        for(q = p ; q < eol && *q != '"' ; q++);
+        mp->name = ap_pstrndup(pool, p, q - p);
       }
-      else {
-        rsize = len_read;
+    }
+  }
+
+  mp->val = 0;
+  mp->val_len = mp->val_size = 0;
+  if(! mp->name) 
+    mp->dest = TO_NOWHERE;
+  else if(is_file && mp->blob_col && ! strcmp(mp->name, mp->blob_col)) {
+    mp->dest = mp->blob_seen ? TO_NOWHERE : TO_BLOB;
+    mp->blob_seen = true;
+  }
+  else 
+    mp->dest = mp->upload ? TO_NOWHERE : TO_ITEM;
+}
+
+
+/* part_data(): 
+   Pass on the first n bytes of the body, which are data of the current 
+   part.  Returns how many were used, or -1.
+*/
+long part_data(apr_pool_t *pool, multipart *mp, const char *data, size_t n,
+               bool last) {
+  char *val;
+
+  switch(mp->dest) {
+    case TO_BLOB:
+      return blob_write(mp->upload, data, n, last);
+    case TO_ITEM:
+      if(mp->val_len + n + 1 > mp->val_size) {
+        mp->val_size = (mp->val_len + n + 1) * 2;
+        val = (char *) ap_palloc(pool, mp->val_size);
+        if(mp->val_len) memcpy(val, mp->val, mp->val_len);
+        mp->val = val;
+      }
+      memcpy(mp->val + mp->val_len, data, n);
+      mp->val_len += n;
+      mp->val[mp->val_len] = 0;
+      return n;
+    default:
+      return n;
+  }
+}
+
+
+/* read_multipart(): for multipart/form-data
+ */
+int read_multipart(query_source *qsource, apr_pool_t *pool, 
+                   body_buffer &body) {
+  multipart *mp = (multipart *) body.context;
+  const char *p;
+  long n;
+  
+  while(true) {
+    switch(mp->state) {
+      case MP_PREAMBLE:    /* the first delimiter has no CRLF */
+        p = scan(body.data, body.len, mp->delim + 2, mp->delim_len - 2);
+        if(! p) {
+          if(body.at_end) return 400;
+          if(body.len > mp->delim_len) {
+            n = body.len - mp->delim_len;
+            body.data += n;
+            body.len -= n;
+          }
+          return OK;
+        }
+        body.len -= (p + mp->delim_len - 2) - body.data;
+        body.data = p + mp->delim_len - 2;
+        mp->state = MP_DELIMITER;
+        break;
+        
+      case MP_DELIMITER:   /* "--" after the last one, or else CRLF */
+        if(body.len < 2) return body.at_end ? 400 : OK;
+        if(! memcmp(body.data, "--", 2)) {
+          mp->state = MP_END;
+          break;
+        }
+        if(memcmp(body.data, "\r\n", 2)) return 400;
+        body.data += 2;
+        body.len -= 2;
+        mp->state = MP_HEADERS;
+        break;
+        
+      case MP_HEADERS:     /* up to a blank line */
+        if(body.len >= 2 && ! memcmp(body.data, "\r\n", 2)) p = body.data;
+        else if((p = scan(body.data, body.len, "\r\n\r\n", 4)) != 0) p += 2;
+        else {
+          if(body.at_end || body.len > HUGE_STRING_LEN) return 400;
+          return OK;
+        }
+        part_headers(pool, mp, body.data, p);
+        body.len -= (p + 2) - body.data;
+        body.data = p + 2;
+        mp->state = MP_DATA;
+        if(mp->dest == TO_BLOB && ! mp->upload) 
+          return BODY_SUSPENDED;
+        break;
+        
+      case MP_DATA:
+        p = scan(body.data, body.len, mp->delim, mp->delim_len);
+        if(p) n = p - body.data;
+        else if(body.at_end) return 400;
+        else n = (body.len < mp->delim_len) ? 0 : body.len - mp->delim_len + 1;
+        if(n || p) {
+          if((n = part_data(pool, mp, body.data, n, p != 0)) < 0) return 500;
+          body.data += n;
+          body.len -= n;
+        }
+        if(! p) return OK;
+        if(mp->dest == TO_ITEM) 
+          qsource->set_item(mp->name, mp->val ? mp->val : "", mp->val_len);
+        body.data += mp->delim_len;
+        body.len -= mp->delim_len;
+        mp->state = MP_DELIMITER;
+        break;
+        
+      default:             /* MP_END: ignore the epilogue */
+        body.data += body.len;
+        body.len = 0;
+        return OK;
+    }
+  }
+}
+
+
+/* make_room():
+   Make room in the body's own buffer for n more bytes after the data that
+   has not been consumed, moving that data into the buffer if it is not 
+   there already.
+*/
+void make_room(apr_pool_t *pool, body_buffer &body, size_t n) {
+  size_t offset = body.in_space ? body.data - body.space : 0;
+
+  if(body.in_space && offset + body.len + n <= body.size) return;
+  if(body.len + n > body.size) {
+    size_t sz = body.size ? body.size * 2 : HUGE_STRING_LEN;
+    while(sz < body.len + n) sz *= 2;
+    char *space = (char *) ap_palloc(pool, sz);
+    if(body.len) memcpy(space, body.data, body.len);
+    body.space = space;
+    body.size = sz;
+  }
+  else if(body.len) memmove(body.space, body.data, body.len);
+  body.data = body.space;
+  body.in_space = true;
+}
+
+
+#ifdef THIS_IS_APACHE2
+
+/* feed():
+   Run the reader over one more piece of the body.  Anything that it does
+   not consume is kept, since the piece belongs to an input bucket.
+*/
+int feed(query_source *qsource, BODY_READER *reader, body_buffer &body,
+         const char *piece, size_t len, bool at_end) {
+  apr_pool_t *pool = qsource->r->pool;
+  int rc;
+
+  if(body.len == 0) {     /* use the piece where it lies */
+    body.data = piece;
+    body.len = len;
+    body.in_space = false;
+  }
+  else {
+    make_room(pool, body, len);
+    memcpy((char *) body.data + body.len, piece, len);
+    body.len += len;
+  }
+  body.at_end = at_end;
+
+  rc = reader(qsource, pool, body);
+  if(body.len && ! body.in_space) make_room(pool, body, 0);
+  return rc;
+}
+
+
+/* keep(): 
+   When the reader suspends, copy the rest of the brigade into the body.
+   It holds at most HUGE_STRING_LEN bytes.
+*/
+int keep(query_source *qsource, body_reader *br, apr_bucket_brigade *bb, 
+         apr_bucket *b) {
+  const char *piece;
+  apr_size_t len;
+
+  for( ; b != APR_BRIGADE_SENTINEL(bb) ; b = APR_BUCKET_NEXT(b)) {
+    if(APR_BUCKET_IS_EOS(b)) {
+      br->seen_eos = br->body.at_end = true;
+      break;
+    }
+    if(APR_BUCKET_IS_METADATA(b)) continue;
+    if(apr_bucket_read(b, &piece, &len, APR_BLOCK_READ) != APR_SUCCESS)
+      return 400;
+    if((br->total += len) > br->limit) 
+      return 413;
+    make_room(qsource->r->pool, br->body, len);
+    memcpy((char *) br->body.data + br->body.len, piece, len);
+    br->body.len += len;
+  }
+  apr_brigade_cleanup(bb);
+  return BODY_SUSPENDED;
+}
+
+
+int read_body(query_source *qsource, body_reader *br) {
+  request_rec *r = qsource->r;
+  body_buffer &body = br->body;
+  apr_bucket_brigade *bb;
+  apr_bucket *b, *next;
+  const char *piece;
+  apr_size_t len;
+  int rc;
+
+  if(br->started) {       /* resume with what has been read already */
+    rc = br->reader(qsource, r->pool, body);
+    if(rc != OK || body.at_end) return rc;
+  }
+  br->started = true;
+  bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+  while(! br->seen_eos) {
+    if(ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES, 
+                      APR_BLOCK_READ, HUGE_STRING_LEN) != APR_SUCCESS)
+      return 400;
+    for(b = APR_BRIGADE_FIRST(bb) ; b != APR_BRIGADE_SENTINEL(bb) ; b = next) {
+      next = APR_BUCKET_NEXT(b);
+      if(APR_BUCKET_IS_EOS(b)) {
+        br->seen_eos = true;
+        break;
       }
-      memcpy((char*)*rbuf + rpos, argsbuffer, rsize);
-      rpos += rsize;
+      if(APR_BUCKET_IS_METADATA(b)) continue;
+      if(apr_bucket_read(b, &piece, &len, APR_BLOCK_READ) != APR_SUCCESS)
+        return 400;
+      if((br->total += len) > br->limit) 
+        return 413;
+      rc = feed(qsource, br->reader, body, piece, len, 
+                next != APR_BRIGADE_SENTINEL(bb) && APR_BUCKET_IS_EOS(next));
+      if(rc == BODY_SUSPENDED) return keep(qsource, br, bb, next);
+      if(rc != OK) return rc;
     }
-    
-    ap_kill_timeout(r);
-    *len = rpos;
+    apr_brigade_cleanup(bb);
   }
+
+  if(! body.at_end) 
+    return feed(qsource, br->reader, body, "", 0, true);
+  return OK;
+}
+
+#else
+
+/* In Apache 1.3, ap_get_client_block() copies the body straight into its 
+   own buffer. 
+*/
+int read_body(query_source *qsource, body_reader *br) {
+  request_rec *r = qsource->r;
+  body_buffer &body = br->body;
+  long len;
+  int rc;
   
+  if(br->started) {       /* resume with what has been read already */
+    rc = br->reader(qsource, r->pool, body);
+    if(rc != OK || body.at_end) return rc;
+  }
+  else {
+    if((rc = ap_setup_client_block(r, REQUEST_CHUNKED_DECHUNK)) != OK)
+      return rc;
+    br->started = true;
+    if(! ap_should_client_block(r)) {
+      body.data = "";
+      body.at_end = true;
+      return br->reader(qsource, r->pool, body);
+    }
+  }
+
+  ap_hard_timeout("read_body", r);
+  do {
+    make_room(r->pool, body, HUGE_STRING_LEN);
+    len = ap_get_client_block(r, (char *) body.data + body.len, 
+                              HUGE_STRING_LEN);
+    ap_reset_timeout(r);
+    if(len < 0) rc = 400;
+    else if((br->total += len) > br->limit) rc = 413;
+    else {
+      body.len += len;
+      body.at_end = (len == 0);
+      rc = br->reader(qsource, r->pool, body);
+    }
+  } while(rc == OK && ! body.at_end);
+  ap_kill_timeout(r);
+
   return rc;
 }
 
+#endif
+
 
 int HTTP_query_source::get_form_data() {
-  int rc = OK;
   BODY_READER *reader = 0;  
-  int buf_size = 0;
+  void *context = 0;
+  config::dir *dir = (config::dir *) 
+    ap_get_module_config(r->per_dir_config, &ndb_module);
+  unsigned long limit = dir->max_body ? dir->max_body : DEFAULT_MAX_REQUEST_BODY;
+  const char *length;
+  body_reader *br;
+  int rc;
   
   // To do: support PUT  
   if(r->method_number != M_POST) 
@@ -137,19 +631,71 @@ int HTTP_query_source::get_form_data() {
     reader = read_urlencoded;
   else if(strcasecmp(content_type, "application/jsonrequest") == 0) 
     reader = read_jsonrequest;
-  else if(strncmp(content_type, "multipart/form-data", 19) == 0) 
-    assert(0); // reader = read_multipart;
+  else if(strncasecmp(content_type, "multipart/form-data", 19) == 0) {
+    reader = read_multipart;
+    if(! (context = new_multipart(r, content_type, dir))) {
+      log_debug(r->server, "No boundary in %s", content_type);
+      return 400;
+    }
+    if(dir->blob_upload) limit = dir->max_upload;
+  }
+  else if(dir->blob_upload) {
+    /* Leave the body to be streamed into the blob by upload_blob() */
+    is_upload = true;
+    return OK;
+  }
   else {
     log_debug(r->server, "Unsupported request body: %s", content_type);
     return DECLINED;   
   }
   
-  if((rc = util_read(r, &databuffer, &buf_size)) != OK)
-    return rc;
-  
-  rc = reader(this, r->pool, buf_size);
-    
+  /* Refuse a body that is too large before reading any of it */
+  length = ap_table_get(r->headers_in, "Content-Length");
+  if(length && strtoul(length, 0, 10) > limit)
+    return 413;
+
+  br = new_body_reader(r->pool, reader, context, limit);
+  rc = read_body(this, br);
+  if(rc == BODY_SUSPENDED) {   /* at a file for the BlobUpload column */
+    suspended = br;
+    is_upload = true;
+    return OK;
+  }
   return rc;
 }
 
 
+/* upload_blob():
+   Write the request body -- or the rest of a suspended multipart body -- 
+   into a blob, as it arrives.  Returns OK, or an HTTP error code; if the 
+   error came from NDB, it is copied into error.
+*/
+int upload_blob(query_source *qsource, NdbTransaction *tx, NdbBlob *blob,
+                unsigned long limit, NdbError &error) {
+  const char *length;
+  blob_upload up;
+  body_reader *br = qsource->suspended;
+  int rc;
+
+  up.tx = tx;
+  up.blob = blob;
+  up.written = up.flushed = 0;
+  up.inline_size = blob->getColumn()->getInlineSize();
+  up.part_size = blob->getColumn()->getPartSize();
+  if(up.part_size == 0) up.part_size = HUGE_STRING_LEN;  /* TINYBLOB */
+
+  if(br) 
+    ((multipart *) br->body.context)->upload = & up;
+  else {
+    length = ap_table_get(qsource->r->headers_in, "Content-Length");
+    if(length && strtoul(length, 0, 10) > limit)
+      return 413;
+    br = new_body_reader(qsource->r->pool, write_blob, & up, limit);
+  }
+
+  rc = read_body(qsource, br);
+  if(up.error.code) error = up.error;
+  log_debug(qsource->r->server, "Blob upload: %d bytes (%d)", 
+            (int) up.written, rc);
+  return rc;
+}
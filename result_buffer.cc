@@ -18,18 +18,192 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
 #include "mod_ndb.h"
+#include "util_md5.h"
+#ifdef THIS_IS_APACHE2
+#include "util_filter.h"
+#endif
+
+
+/* Blocks of RESULT_BLOCK_SIZE are kept in the pool for reuse; a larger 
+   block, made for a single large prepare(), is freed when it is released.
+*/
+inline buffer_block *get_block(block_pool *pool, size_t len) {
+  buffer_block *b;
+  size_t size = RESULT_BLOCK_SIZE;
+
+  if(len <= size && pool->free_blocks) {
+    b = pool->free_blocks;
+    pool->free_blocks = b->next;
+    pool->n_free--;
+  }
+  else {
+    if(len > size) size = len;
+    b = (buffer_block *) malloc(sizeof(buffer_block) + size);
+    if(! b) return 0;
+    b->alloc_sz = size;
+  }
+  b->next = 0;
+  b->sz = 0;
+  return b;
+}
+
+
+inline unsigned int blocks_wanted(block_pool *pool) {
+  size_t n = (2 * pool->page_estimate) / RESULT_BLOCK_SIZE + 1;
+  return (n < RESULT_BLOCKS_KEPT) ? n : RESULT_BLOCKS_KEPT;
+}
+
+
+inline void put_block(block_pool *pool, buffer_block *b) {
+  if(b->alloc_sz == RESULT_BLOCK_SIZE && pool->n_free < blocks_wanted(pool)) {
+    b->next = pool->free_blocks;
+    pool->free_blocks = b;
+    pool->n_free++;
+  }
+  else free(b);
+}
+
+
+/* A contiguous buffer is the first free one that is large enough.  Since
+   a buffer keeps the size it has grown to, the free buffers come to fit
+   the values that use them.
+*/
+inline buffer_block *get_buffer(block_pool *pool, size_t size) {
+  buffer_block *b, **link;
+
+  for(link = & pool->free_buffers ; *link ; link = & (*link)->next) 
+    if((*link)->alloc_sz >= size) {
+      b = *link;
+      *link = b->next;
+      pool->buffer_bytes -= b->alloc_sz;
+      return b;
+    }
+  b = (buffer_block *) malloc(sizeof(buffer_block) + size);
+  if(b) b->alloc_sz = size;
+  return b;
+}
+
+
+inline void put_buffer(block_pool *pool, buffer_block *b) {
+  if(pool->buffer_bytes + b->alloc_sz <= RESULT_BUFFER_BYTES_KEPT) {
+    b->next = pool->free_buffers;
+    pool->free_buffers = b;
+    pool->buffer_bytes += b->alloc_sz;
+  }
+  else free(b);
+}
+
+
+inline char *block_data(buffer_block *b) {
+  return (char *) (b + 1);
+}
+
+
+inline buffer_block *block_of(char *data) {
+  return ((buffer_block *) data) - 1;
+}
 
 
 char * result_buffer::init(request_rec *r, size_t size) {
+  release();
   alloc_sz = size;
-  sz = 0;
-  if(buff) free(buff);
   buff = (char *) malloc(alloc_sz);
-  if(r && !buff) log_err(r->server, "mod_ndb result_buffer::init() out of memory");
+  if(! buff) {
+    alloc_sz = 0;
+    if(r) log_err(r->server, "mod_ndb result_buffer::init() out of memory");
+  }
+  return buff;
+}
+
+
+/* init() with a size and a block_pool makes a contiguous buffer that will
+   be returned to the pool */
+char * result_buffer::init(request_rec *r, size_t size, block_pool *p) {
+  buffer_block *b;
+
+  release();
+  b = get_buffer(p, size);
+  if(! b) {
+    if(r) log_err(r->server, "mod_ndb result_buffer::init() out of memory");
+    return 0;
+  }
+  pool = p;
+  buff = block_data(b);
+  alloc_sz = b->alloc_sz;
+  return buff;
+}
+
+
+/* init() with just a block_pool makes a segmented buffer */
+char * result_buffer::init(request_rec *r, block_pool *p) {
+  buffer_block *b;
+
+  release();
+  b = get_block(p, 0);
+  if(! b) {
+    if(r) log_err(r->server, "mod_ndb result_buffer::init() out of memory");
+    return 0;
+  }
+  pool = p;
+  segmented = true;
+  buff = block_data(b);
+  alloc_sz = b->alloc_sz;
   return buff;
 }
 
 
+/* release(): return the buffer, or the blocks of a segmented buffer, to 
+   their pool, or free the buffer.  Afterwards the buffer is empty.
+*/
+void result_buffer::release() {
+  buffer_block *b, *next;
+
+  if(pool && segmented) {
+    pool->page_estimate = (7 * pool->page_estimate + length()) / 8;
+    for(b = chain ; b != 0 ; b = next) {
+      next = b->next;
+      put_block(pool, b);
+    }
+    if(buff) put_block(pool, block_of(buff));
+    chain = chain_last = 0;
+    chain_sz = 0;
+  }
+  else if(pool) {
+    if(buff) put_buffer(pool, block_of(buff));
+  }
+  else if(alloc_sz) free(buff);
+  pool = 0;
+  segmented = false;
+  buff = 0;
+  alloc_sz = 0;
+  sz = 0;
+}
+
+
+/* next_block(): add the current block to the chain, and continue in a new
+   block with room for at least len bytes.  An empty block is replaced.
+*/
+bool result_buffer::next_block(size_t len) {
+  buffer_block *full = block_of(buff);
+  buffer_block *b = get_block(pool, len);
+
+  if(! b) return false;
+  if(sz) {
+    full->sz = sz;
+    if(chain_last) chain_last->next = full;
+    else chain = full;
+    chain_last = full;
+    chain_sz += sz;
+  }
+  else put_block(pool, full);
+
+  buff = block_data(b);
+  alloc_sz = b->alloc_sz;
+  sz = 0;
+  return true;
+}
+
+
 /* prepare(size_t len): make room for *len* new characters in the buffer.
    Expect them to be placed there one at a time using putc or out(fmt, ...).
    It is OK to prepare more space than you will actually use.
@@ -40,11 +214,27 @@ bool result_buffer::prepare(size_t len) {
   register size_t new_sz = sz + len;
   
   if(new_sz > alloc_sz) {
+    if(segmented) return next_block(len);
     register int factor = (new_sz / alloc_sz) + 1;
     alloc_sz *= factor;
+    if(pool) {            /* a buffer from the pool has a header */
+      buffer_block *b = (buffer_block *) 
+        realloc(block_of(old_buff), sizeof(buffer_block) + alloc_sz);
+      if(! b) {
+        free(block_of(old_buff));
+        buff = 0;
+        alloc_sz = 0;
+        pool = 0;
+        return false;
+      }
+      b->alloc_sz = alloc_sz;
+      buff = block_data(b);
+      return true;
+    }
     buff = (char *) realloc(old_buff, alloc_sz);
     if(! buff) {
       free(old_buff);
+      alloc_sz = 0;
       return false;
     }
   }
@@ -52,39 +242,46 @@ bool result_buffer::prepare(size_t len) {
 }
   
 
+/* In a segmented buffer, a long string is split across blocks */
 void result_buffer::out(size_t len, const char *s) {
-  if(len == 0 || (! this->prepare(len))) return;
-  char *dst = buff + sz;
-  sz += len;
-  while(len--) *dst++ = *s++;
+  size_t n;
+
+  while(len) {
+    n = len;
+    if(segmented && sz + n > alloc_sz) {
+      n = alloc_sz - sz;
+      if(n == 0) {
+        n = (len < RESULT_BLOCK_SIZE) ? len : RESULT_BLOCK_SIZE;
+        if(! next_block(n)) return;
+      }
+    }
+    else if(! this->prepare(n)) return;
+    memcpy(buff + sz, s, n);
+    sz += n;
+    s += n;
+    len -= n;
+  }
 }
 
 
 void result_buffer::out(const char *fmt, ... ) {
   va_list args;
-  size_t old_size = sz;
-  bool try_again;
-  char *old_buff;
+  int len;
 
-  do {    
-    try_again = false;
+  if(! buff) return;
+  va_start(args,fmt);
+  len = vsnprintf((buff + sz), alloc_sz - sz, fmt, args);
+  va_end(args);
+  if(len < 0) return;
+    
+  if(sz + len >= alloc_sz) {
+    // The write was truncated.  Make room and do it again
+    if(! prepare(len + 1)) return;
     va_start(args,fmt);
-    sz += vsnprintf((buff + sz), alloc_sz - sz, fmt, args);
+    vsnprintf((buff + sz), alloc_sz - sz, fmt, args);
     va_end(args);
-    
-    if(sz >= alloc_sz) {
-      try_again = true;
-      // The write was truncated.  Get a bigger buffer and do it again
-      alloc_sz *= 4;
-      sz = old_size;
-      old_buff = buff;
-      buff = (char *) realloc(old_buff, alloc_sz);
-      if(! buff) {
-        free(old_buff);
-        return;
-      }
-    }
-  } while(try_again);
+  }
+  sz += len;
 }
 
 
@@ -105,16 +302,108 @@ void result_buffer::read_blob(NdbBlob *blob) {
    as the output buffer, instead of copying.
 */
 void result_buffer::overlay(result_buffer *other) {
-  if(alloc_sz) free(buff);
+  release();
 
+  assert(! other->segmented);
   alloc_sz = other->alloc_sz;  // other->buff will be freed here,
   other->alloc_sz = 0;         // not there.
+  pool = other->pool;
+  other->pool = 0;
   
   sz = other->sz;
   buff = other->buff;
 }
 
 
+/* copy(): copy the whole result, length() bytes, to dst */
+void result_buffer::copy(char *dst) {
+  for(buffer_block *b = chain ; b != 0 ; b = b->next) {
+    memcpy(dst, block_data(b), b->sz);
+    dst += b->sz;
+  }
+  if(sz) memcpy(dst, buff, sz);
+}
+
+
+/* flatten(): make a buffer contiguous, and null-terminated */
+void result_buffer::flatten() {
+  size_t len = length();
+  char *flat;
+
+  if(! segmented) {
+    if(buff && prepare(1)) buff[sz] = 0;
+    return;
+  }
+  flat = (char *) malloc(len + 1);
+  if(! flat) return;
+  copy(flat);
+  flat[len] = 0;
+  release();
+  buff = flat;
+  sz = len;
+  alloc_sz = len + 1;
+}
+
+
+/* md5(): the hex MD5 digest of the whole result, for an ETag */
+char * result_buffer::md5(ap_pool *p) {
+  static const char hex[] = "0123456789abcdef";
+  unsigned char digest[16];
+  char *result;
+
+  if(! chain) return ap_md5_binary(p, (const unsigned char *) buff, sz);
+
+#ifdef THIS_IS_APACHE2
+  apr_md5_ctx_t ctx;
+  apr_md5_init(& ctx);
+  for(buffer_block *b = chain ; b != 0 ; b = b->next)
+    apr_md5_update(& ctx, block_data(b), b->sz);
+  apr_md5_update(& ctx, buff, sz);
+  apr_md5_final(digest, & ctx);
+#else
+  AP_MD5_CTX ctx;
+  ap_MD5Init(& ctx);
+  for(buffer_block *b = chain ; b != 0 ; b = b->next)
+    ap_MD5Update(& ctx, (const unsigned char *) block_data(b), b->sz);
+  ap_MD5Update(& ctx, (const unsigned char *) buff, sz);
+  ap_MD5Final(digest, & ctx);
+#endif
+
+  result = (char *) ap_palloc(p, 33);
+  for(int n = 0 ; n < 16 ; n++) {
+    result[2 * n] = hex[digest[n] >> 4];
+    result[2 * n + 1] = hex[digest[n] & 0x0F];
+  }
+  result[32] = 0;
+  return result;
+}
+
+
+/* send(): write the result to the client.  In Apache 2, each block is a
+   transient bucket, so the blocks are written out (with writev) where 
+   they are, and the brigade ends with a flush, because the blocks will 
+   be reused.
+*/
+void result_buffer::send(request_rec *r) {
+#ifdef THIS_IS_APACHE2
+  apr_bucket_alloc_t *ba = r->connection->bucket_alloc;
+  apr_bucket_brigade *bb = apr_brigade_create(r->pool, ba);
+
+  for(buffer_block *b = chain ; b != 0 ; b = b->next)
+    APR_BRIGADE_INSERT_TAIL(bb, 
+      apr_bucket_transient_create(block_data(b), b->sz, ba));
+  if(sz) 
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_transient_create(buff, sz, ba));
+  APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_flush_create(ba));
+  ap_pass_brigade(r->output_filters, bb);
+#else
+  for(buffer_block *b = chain ; b != 0 ; b = b->next)
+    ap_rwrite(block_data(b), b->sz, r);
+  if(sz) ap_rwrite(buff, sz, r);
+#endif
+}
+
+
 result_buffer::~result_buffer() {
-  if(alloc_sz) free(buff);
+  release();
 }
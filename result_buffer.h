@@ -57,22 +57,71 @@ public:
 };
 
 
+/* A block of a segmented result_buffer.  The header is at the start of 
+   the block, and the data follows it. */
+struct buffer_block {
+  struct buffer_block *next;
+  size_t sz;              /* bytes used */
+  size_t alloc_sz;        /* bytes available */
+};
+
+
+/* The free memory of one thread (in its ndb_instance): blocks for result
+   pages, and contiguous buffers of any size.  page_estimate is a running
+   average of the length of a result page.
+*/
+struct block_pool {
+  struct buffer_block *free_blocks;
+  unsigned int n_free;
+  struct buffer_block *free_buffers;
+  size_t buffer_bytes;
+  size_t page_estimate;
+};
+
+
+/* A result_buffer is either one contiguous buffer, grown with realloc(), 
+   or -- when it is initialized with just a block_pool -- a chain of 
+   blocks.  Either way, buff and sz are the block being written, and the 
+   space made by prepare() is contiguous.  The full blocks of a segmented 
+   buffer are kept in order, from "chain" to "chain_last".  A contiguous 
+   buffer can also come from a block_pool, and go back to it.
+*/
 class result_buffer {
 private:
   size_t alloc_sz;
+  struct block_pool *pool;
+  bool segmented;
+  struct buffer_block *chain;
+  struct buffer_block *chain_last;
+  size_t chain_sz;
+  bool next_block(size_t);
+  void release();
   
 public:
   char *buff;
   size_t sz; 
-  result_buffer() : buff(0) , sz(0) {};
+  result_buffer() : alloc_sz(0) , pool(0) , segmented(false) , chain(0) ,
+                    chain_last(0) , chain_sz(0) , buff(0) , sz(0) {};
   char *init(request_rec *r, size_t );
+  char *init(request_rec *r, size_t, struct block_pool *);
+  char *init(request_rec *r, struct block_pool *);
   bool prepare(size_t);
+  size_t length() { return chain_sz + sz; };
+  void copy(char *);
+  void flatten();
+  char *md5(ap_pool *);
+  void send(request_rec *);
   inline void putc(char c) { *(buff + sz++) = c; };
   void out(const char *fmt, ...);
   void out(size_t, const char *);
-  void out(struct st_decimal_t *);   /* in MySQL_Field.cc */
+  void out_int(long long);             /* in number_format.cc */
+  void out_uint(unsigned long long);
+  void out_float(float);
+  void out_double(double);
+  void put_digits(unsigned int, int);  /* in number_format.cc */
   inline void out(len_string &ls) { out(ls.len, ls.string); }
   void read_blob(NdbBlob *blob);
+  bool inflate();                      /* in blob_compress.cc */
   void overlay(result_buffer *);
   ~result_buffer();
 };
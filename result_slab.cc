@@ -0,0 +1,166 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <new>
+#include "mod_ndb.h"
+#include "ndb_api_compat.h"
+
+extern config::dir *all_endpoints[MAX_ENDPOINTS];
+extern int n_endp;
+
+/* Result slabs.
+   A slab is a list of chunks.  Memory is handed out from the current chunk
+   by bumping an offset, and reset() simply goes back to the start of the 
+   first chunk.  The first chunk is allocated from the child's pool by 
+   init(), in child_init, and is sized for the widest endpoint.  When a 
+   request needs more than that, another chunk is added to the list with 
+   malloc() -- not from the child's pool, which every thread shares -- and 
+   reset() frees it at the end of the request.
+   
+   A result with a blob keeps a result_buffer outside the slab, so each of
+   these is put on the "blobs" list (itself allocated from the slab) to be
+   destroyed by reset().
+*/
+
+struct slab_chunk {
+  struct slab_chunk *next;
+  size_t size;
+  size_t used;
+};
+
+struct slab_blob {
+  MySQL::result *result;
+  struct slab_blob *next;
+};
+
+/* Chunk headers and allocations are kept aligned for any member of 
+   MySQL::result */
+#define SLAB_ALIGN(x) (((x) + 15) & ~ (size_t) 15)
+#define CHUNK_DATA(c) (((char *) (c)) + SLAB_ALIGN(sizeof(struct slab_chunk)))
+
+
+/* columns_read():
+   How many result columns a request to this endpoint can read.  A join
+   reads the columns of every joined table.
+*/
+static int columns_read(config::dir *dir) {
+  int n, cols, updates;
+  
+  cols = dir->flag.select_star ? SLAB_STAR_COLUMNS : dir->visible->size();
+  if(dir->joins) 
+    for(n = 0 ; n < dir->joins->size() ; n++) {
+      config::join &jn = dir->joins->item(n);
+      cols += jn.flag.select_star ? SLAB_STAR_COLUMNS : jn.visible->size();
+    }
+  updates = dir->updatable ? dir->updatable->size() : 0;
+  return (cols > updates) ? cols : updates;
+}
+
+
+static struct slab_chunk *new_chunk(ap_pool *p, size_t size) {
+  size_t total = SLAB_ALIGN(sizeof(struct slab_chunk)) + size;
+  struct slab_chunk *c = (struct slab_chunk *) 
+    (p ? ap_palloc(p, total) : malloc(total));
+
+  c->next = 0;
+  c->size = size;
+  c->used = 0;
+  return c;
+}
+
+
+void result_slab::init(ap_pool *p, int max_read_operations) {
+  int n, cols, widest = 1;
+  size_t per_column;
+
+  for(n = 0 ; n < n_endp ; n++) {
+    cols = columns_read(all_endpoints[n]);
+    if(cols > widest) widest = cols;
+  }
+  per_column = SLAB_ALIGN(sizeof(MySQL::result)) + sizeof(MySQL::result *);
+
+  first = current = new_chunk(p, max_read_operations * widest * per_column);
+  blobs = 0;
+}
+
+
+/* alloc() returns zeroed memory, as ap_pcalloc() would.
+*/
+void *result_slab::alloc(size_t sz) {
+  char *mem;
+
+  sz = SLAB_ALIGN(sz);
+  if(current->used + sz > current->size) {
+    struct slab_chunk *c = new_chunk(0, (sz > first->size) ? sz : first->size);
+    current->next = c;
+    current = c;
+  }
+  mem = CHUNK_DATA(current) + current->used;
+  current->used += sz;
+  bzero(mem, sz);
+  return mem;
+}
+
+
+MySQL::result *result_slab::keep(MySQL::result *result) {
+  if(result->contents) {
+    struct slab_blob *b = (struct slab_blob *) alloc(sizeof(struct slab_blob));
+    b->result = result;
+    b->next = blobs;
+    blobs = b;
+  }
+  return result;
+}
+
+
+MySQL::result *result_slab::new_result(NdbOperation *op, 
+                                       const NdbDictionary::Column *col,
+                                       block_pool *blocks) {
+  return keep(new(alloc(sizeof(MySQL::result))) 
+              MySQL::result(op, col, blocks));
+}
+
+
+#ifdef HAVE_NDB_SPJ
+MySQL::result *result_slab::new_result(NdbQueryOperation *op, 
+                                       const NdbDictionary::Column *col,
+                                       block_pool *blocks) {
+  return keep(new(alloc(sizeof(MySQL::result))) 
+              MySQL::result(op, col, blocks));
+}
+#endif
+
+
+/* reset():
+   Called from ndb_instance::cleanup().  Every other result needs no 
+   destructor, and is simply forgotten.  The growth chunks are freed.
+*/
+void result_slab::reset() {
+  struct slab_chunk *c, *next;
+
+  for(struct slab_blob *b = blobs ; b ; b = b->next) 
+    b->result->~result();
+  blobs = 0;
+  for(c = first->next ; c ; c = next) {
+    next = c->next;
+    free(c);
+  }
+  first->next = 0;
+  current = first;
+  first->used = 0;
+}
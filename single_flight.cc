@@ -0,0 +1,266 @@
+/* Copyright (C) 2006 - 2009 Sun Microsystems
+ All rights reserved. Use is subject to license terms.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "mod_ndb.h"
+
+/* Single-flight reads.
+   When many threads in one process GET the same row at the same time, only
+   the first of them (the "leader") runs the NDB read.  The others find the
+   leader's flight in a table keyed on the endpoint and the normalized set of
+   request keys, wait for it to land, and send a copy of its formatted result
+   and ETag.  A flight exists only while the leader is executing; this is not
+   a cache.
+
+   The table is split into shards, each with its own mutex and condition
+   variable, so unrelated keys rarely contend for a lock.  Everything that is
+   shared between threads is allocated with malloc(), because its lifetime
+   is not tied to any one request pool.
+*/
+
+enum { in_flight = 0, landed, abandoned };
+
+struct flight {
+  struct flight *next;
+  char *key;
+  unsigned int hash;
+  int refcount;
+  int state;
+  int status;
+  char *buff;
+  size_t sz;
+  char *etag;
+};
+
+
+#ifdef THIS_IS_APACHE2
+
+#include "apr_thread_cond.h"
+
+#define N_FLIGHT_SHARDS 16
+
+struct flight_shard {
+  apr_thread_mutex_t *lock;
+  apr_thread_cond_t *landed;
+  struct flight *head;
+};
+
+static struct flight_shard *shards = 0;
+
+
+/* FNV-1a */
+inline unsigned int flight_hash(const char *key) {
+  register unsigned int h = 2166136261U;
+  for(register const unsigned char *c = (const unsigned char *) key; *c ; c++)
+    h = (h ^ *c) * 16777619U;
+  return h;
+}
+
+
+/* Free a flight once the last thread has let go of it.
+   The caller holds the shard lock.
+*/
+inline void release_flight(struct flight *f) {
+  if(--f->refcount == 0) {
+    free(f->key);
+    free(f->buff);
+    free(f->etag);
+    free(f);
+  }
+}
+
+
+/* Remove a flight from its shard's chain, so that later requests
+   start a new flight.  The caller holds the shard lock.
+*/
+inline void unlink_flight(struct flight_shard *shard, struct flight *f) {
+  struct flight **p;
+  for(p = & shard->head ; *p ; p = & (*p)->next) {
+    if(*p == f) {
+      *p = f->next;
+      break;
+    }
+  }
+}
+
+
+/* initialize_single_flight() is called from child_init, and only in a
+   threaded MPM; with one thread per process there is nothing to share.
+*/
+void initialize_single_flight(ap_pool *p) {
+  shards = (struct flight_shard *)
+    ap_pcalloc(p, N_FLIGHT_SHARDS * sizeof(struct flight_shard));
+  for(int n = 0 ; n < N_FLIGHT_SHARDS ; n++) {
+    apr_thread_mutex_create(& shards[n].lock, APR_THREAD_MUTEX_DEFAULT, p);
+    apr_thread_cond_create(& shards[n].landed, p);
+  }
+}
+
+
+/* single_flight_wait():
+   Returns DECLINED if the caller should run its own query -- either as
+   the leader of a new flight (in which case i->flight is set) or because
+   the flight it waited on did not land in time.
+   Otherwise the shared result has already been sent, and the return value
+   is the HTTP response code.
+*/
+int single_flight_wait(request_rec *r, ndb_instance *i, const char *key) {
+  struct flight *f;
+  struct flight_shard *shard;
+  unsigned int hash;
+  apr_time_t deadline;
+  int status;
+
+  if(! shards) return DECLINED;
+
+  hash = flight_hash(key);
+  shard = & shards[hash % N_FLIGHT_SHARDS];
+
+  apr_thread_mutex_lock(shard->lock);
+  for(f = shard->head ; f ; f = f->next)
+    if(f->hash == hash && ! strcmp(f->key, key)) break;
+
+  if(! f) {  /* Become the leader */
+    f = (struct flight *) calloc(1, sizeof(struct flight));
+    f->key = strdup(key);
+    f->hash = hash;
+    f->refcount = 1;
+    f->state = in_flight;
+    f->next = shard->head;
+    shard->head = f;
+    apr_thread_mutex_unlock(shard->lock);
+    i->flight = f;
+    return DECLINED;
+  }
+
+  /* Follow */
+  f->refcount++;
+  deadline = apr_time_now() + (apr_time_t) SINGLE_FLIGHT_WAIT_MS * 1000;
+  while(f->state == in_flight) {
+    apr_time_t now = apr_time_now();
+    if(now >= deadline) break;
+    apr_thread_cond_timedwait(shard->landed, shard->lock, deadline - now);
+  }
+
+  if(f->state != landed) {
+    log_debug(r->server, "Single-flight: %s; running query.",
+              f->state == abandoned ? "leader abandoned flight" : "timed out");
+    release_flight(f);
+    apr_thread_mutex_unlock(shard->lock);
+    return DECLINED;
+  }
+
+  /* The flight has landed.  Its contents are read-only now, so the
+     response can be written without holding the lock, as long as we keep
+     our reference until the end.
+  */
+  apr_thread_mutex_unlock(shard->lock);
+  i->stats.shared_reads++;
+
+  status = f->status;
+  if(status == 404)
+    status = ndb_handle_error(r, 404, NULL, NULL);
+  else if(status == 204)
+    ap_set_content_length(r, 0);
+  else {
+    ap_set_content_length(r, f->sz);
+    if(f->etag) {
+      ap_table_set(r->headers_out, "ETag", f->etag);
+      status = ap_meets_conditions(r);
+    }
+    if(status == OK) {
+      ap_send_http_header(r);
+      ap_rwrite(f->buff, f->sz, r);
+    }
+  }
+
+  apr_thread_mutex_lock(shard->lock);
+  release_flight(f);
+  apr_thread_mutex_unlock(shard->lock);
+
+  return status;
+}
+
+
+/* single_flight_land():
+   The leader publishes its result and wakes the followers.
+*/
+void single_flight_land(ndb_instance *i, int status, result_buffer *res,
+                        const char *etag) {
+  struct flight *f = i->flight;
+  struct flight_shard *shard = & shards[f->hash % N_FLIGHT_SHARDS];
+  char *buff = 0, *etag_copy = 0;
+  size_t sz = 0;
+
+  /* Copy outside the lock */
+  if(res && res->buff) {
+    sz = res->length();
+    buff = (char *) malloc(sz);
+    res->copy(buff);
+  }
+  if(etag) etag_copy = strdup(etag);
+
+  apr_thread_mutex_lock(shard->lock);
+  f->status = status;
+  f->buff = buff;
+  f->sz = sz;
+  f->etag = etag_copy;
+  f->state = landed;
+  unlink_flight(shard, f);
+  apr_thread_cond_broadcast(shard->landed);
+  release_flight(f);
+  apr_thread_mutex_unlock(shard->lock);
+
+  i->flight = 0;
+}
+
+
+/* single_flight_abandon():
+   Called from ndb_instance::cleanup() if the leader never landed, e.g. on
+   an error.  Followers wake up and run their own queries.
+*/
+void single_flight_abandon(ndb_instance *i) {
+  struct flight *f = i->flight;
+  struct flight_shard *shard = & shards[f->hash % N_FLIGHT_SHARDS];
+
+  apr_thread_mutex_lock(shard->lock);
+  f->state = abandoned;
+  unlink_flight(shard, f);
+  apr_thread_cond_broadcast(shard->landed);
+  release_flight(f);
+  apr_thread_mutex_unlock(shard->lock);
+
+  i->flight = 0;
+}
+
+#else
+          /* Apache 1.3: one request per process, so nothing is ever shared */
+
+int single_flight_wait(request_rec *r, ndb_instance *i, const char *key) {
+  return DECLINED;
+}
+
+void single_flight_land(ndb_instance *i, int status, result_buffer *res,
+                        const char *etag) {
+  i->flight = 0;
+}
+
+void single_flight_abandon(ndb_instance *i) {
+  i->flight = 0;
+}
+
+#endif